@@ -397,6 +397,24 @@ class BlueFogBasics(object):
         """
         return bool(self._MPI_LIB_CTYPES.bluefog_nccl_built())
 
+    def neighbor_allreduce_streaming(self) -> bool:
+        """Returns True if the streaming neighbor_allreduce is enabled through
+        BLUEFOG_NEIGHBOR_ALLREDUCE_STREAMING.
+        """
+        streaming = self._MPI_LIB_CTYPES.bluefog_neighbor_allreduce_streaming()
+        if streaming == -1:
+            raise ValueError("BlueFog has not been initialized; use bf.init().")
+        return bool(streaming)
+
+    def hierarchical_shared_memory(self) -> bool:
+        """Returns True if the hierarchical neighbor_allreduce goes through the
+        node-shared memory, see BLUEFOG_HIERARCHICAL_SHARED_MEMORY.
+        """
+        shared = self._MPI_LIB_CTYPES.bluefog_hierarchical_shared_memory()
+        if shared == -1:
+            raise ValueError("BlueFog has not been initialized; use bf.init().")
+        return bool(shared)
+
     def set_skip_negotiate_stage(self, value: bool) -> None:
         """Skip the negotiate stage or not. (Default state is no skip).
 
@@ -54,6 +54,9 @@ const std::string& DataType_Name(DataType value) {
     case DataType::BLUEFOG_BOOL:
       static const std::string bool_("bool");
       return bool_;
+    case DataType::BLUEFOG_BFLOAT16:
+      static const std::string bfloat16("bfloat16");
+      return bfloat16;
     default:
       static const std::string unknown("<unknown>");
       return unknown;
@@ -96,6 +99,8 @@ std::size_t DataType_Size(DataType value) {
       return sizeof(double);
     case DataType::BLUEFOG_BOOL:
       return sizeof(bool);
+    case DataType::BLUEFOG_BFLOAT16:
+      return 2;
     default:
       throw std::logic_error("Type " + DataType_Name(value) +
                              " is not supported.");
@@ -96,6 +96,7 @@ enum class DataType {
   BLUEFOG_FLOAT64 = 8,
   BLUEFOG_BOOL = 9,
   BLUEFOG_BYTE = 10,
+  BLUEFOG_BFLOAT16 = 11,
 };
 
 enum class MPIOpsType {
@@ -115,6 +116,14 @@ enum class MPIOpsType {
   WIN_FREE = 13,
 };
 
+// Compression of the tensor sent to the neighbors in neighbor_allreduce.
+enum class CompressionType {
+  NONE = 0,
+  FP16 = 1,
+  INT8 = 2,
+  TOPK = 3,
+};
+
 template <typename E>
 constexpr typename std::underlying_type<E>::type to_underlying(E e) noexcept {
     return static_cast<typename std::underlying_type<E>::type>(e);
@@ -270,10 +279,12 @@ struct TensorTableEntry {
   int device = CPU_DEVICE_ID;
   // Event indicating that data is ready.
   std::shared_ptr<ReadyEvent> ready_event;
-  // Source and destination of ranks used in win ops.
-  // It maps the src(dst) rank to the weight.
+  // Source and destination of ranks used in win ops and streaming
+  // neighbor_allreduce. It maps the src(dst) rank to the weight.
   std::unordered_map<int, double> dst_weights = {};
   std::unordered_map<int, double> src_weights = {};
+  // Weight of the tensor itself in streaming neighbor_allreduce.
+  double self_weight = 0.0;
 
   // Neighbors for dynamic neighbor_allreduce.
   std::shared_ptr<std::vector<int>> send_neighbors;
@@ -288,6 +299,15 @@ struct TensorTableEntry {
   // Boolean value for hierarchical operation or not.
   bool is_hierarchical = false;
 
+  // If set, neighbor_allreduce reduces the neighbor tensors with src_weights
+  // as they arrive and the output has the same size as the tensor.
+  bool streaming_reduce = false;
+
+  // Compression of the tensor sent to the neighbors. The ratio is the fraction
+  // of the values kept by top-k compression.
+  CompressionType compression = CompressionType::NONE;
+  double compression_ratio = 0.0;
+
   // The ops requires the mutex.
   bool require_mutex = false;
 
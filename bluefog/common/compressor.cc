@@ -0,0 +1,256 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include "compressor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+
+#include "half.h"
+
+namespace bluefog {
+namespace common {
+
+namespace {
+
+// Casts the values to float16, which halves the payload.
+class Float16Compressor : public Compressor {
+ public:
+  int64_t CompressedSize(int64_t num_elements) const override {
+    return num_elements * sizeof(unsigned short);
+  }
+
+  void Compress(const float* input, int64_t num_elements,
+                char* output) override {
+    Float2HalfBitsArray(input, reinterpret_cast<unsigned short*>(output),
+                        num_elements);
+  }
+
+  void Decompress(const char* input, int64_t num_elements,
+                  float* output) const override {
+    HalfBits2FloatArray(reinterpret_cast<const unsigned short*>(input),
+                        output, num_elements);
+  }
+};
+
+// The seed of the random rounding of all the int8 compressors, drawn once per
+// process unless it is given for reproducible runs.
+static const char* BLUEFOG_INT8_COMPRESSION_SEED_ENV =
+    std::getenv("BLUEFOG_INT8_COMPRESSION_SEED");
+
+uint64_t Int8CompressionSeed() {
+  static const uint64_t seed =
+      BLUEFOG_INT8_COMPRESSION_SEED_ENV != nullptr
+          ? std::strtoull(BLUEFOG_INT8_COMPRESSION_SEED_ENV, nullptr, 10)
+          : (uint64_t(std::random_device()()) << 32) | std::random_device()();
+  return seed;
+}
+
+// Every compressor starts from the next state of splitmix64 over the seed, so
+// the compressors created for consecutive puts are not correlated.
+uint64_t NextInt8CompressorState() {
+  static std::atomic<uint64_t> counter(0);
+  uint64_t z = Int8CompressionSeed() +
+               (counter.fetch_add(1) + 1) * 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return (z ^ (z >> 31)) | 1ull;
+}
+
+// Quantizes every block of values to int8 with the scale of the largest
+// magnitude in the block. Rounding up or down is random with the probability
+// of the distance, so the decompressed values are unbiased.
+//
+// The payload is the float scales of all the blocks followed by the int8
+// values.
+class Int8Compressor : public Compressor {
+ public:
+  static constexpr int64_t BLOCK_SIZE = 256;
+
+  Int8Compressor() : state_(NextInt8CompressorState()) {}
+
+  // Padded to a multiple of 4 bytes, so the scales of every payload in the
+  // receive buffer stay aligned.
+  int64_t CompressedSize(int64_t num_elements) const override {
+    int64_t size = NumBlocks(num_elements) * sizeof(float) + num_elements;
+    return (size + 3) / 4 * 4;
+  }
+
+  void Compress(const float* input, int64_t num_elements,
+                char* output) override {
+    float* scales = reinterpret_cast<float*>(output);
+    int8_t* values = reinterpret_cast<int8_t*>(
+        output + NumBlocks(num_elements) * sizeof(float));
+    for (int64_t b = 0; b < NumBlocks(num_elements); ++b) {
+      const int64_t begin = b * BLOCK_SIZE;
+      const int64_t end = std::min(begin + BLOCK_SIZE, num_elements);
+      float max_abs = 0.0f;
+      for (int64_t i = begin; i < end; ++i) {
+        max_abs = std::max(max_abs, std::abs(input[i]));
+      }
+      scales[b] = max_abs / 127.0f;
+      const float inv_scale = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+      for (int64_t i = begin; i < end; ++i) {
+        float q = std::floor(input[i] * inv_scale + NextUniform());
+        values[i] = (int8_t)std::min(127.0f, std::max(-127.0f, q));
+      }
+    }
+  }
+
+  void Decompress(const char* input, int64_t num_elements,
+                  float* output) const override {
+    const float* scales = reinterpret_cast<const float*>(input);
+    const int8_t* values = reinterpret_cast<const int8_t*>(
+        input + NumBlocks(num_elements) * sizeof(float));
+    for (int64_t i = 0; i < num_elements; ++i) {
+      output[i] = values[i] * scales[i / BLOCK_SIZE];
+    }
+  }
+
+ private:
+  static int64_t NumBlocks(int64_t num_elements) {
+    return (num_elements + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  }
+
+  // xorshift64, which is much cheaper than std::mt19937 for one random
+  // number per value. Returns a float in [0, 1).
+  float NextUniform() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return (state_ >> 40) * (1.0f / (1 << 24));
+  }
+
+  uint64_t state_;
+};
+
+// Keeps the values of the largest magnitude and drops the others, which are
+// taken as zero by the receivers. What is dropped is too much to lose, so it
+// is meant to be used with error feedback.
+//
+// The payload is the uint32 indices of the values kept followed by the values.
+class TopKCompressor : public Compressor {
+ public:
+  explicit TopKCompressor(double ratio) : ratio_(ratio) {}
+
+  int64_t CompressedSize(int64_t num_elements) const override {
+    return NumKept(num_elements) * (sizeof(uint32_t) + sizeof(float));
+  }
+
+  void Compress(const float* input, int64_t num_elements,
+                char* output) override {
+    const int64_t k = NumKept(num_elements);
+    SelectTopK(input, num_elements, k, &indices_);
+    uint32_t* kept_indices = reinterpret_cast<uint32_t*>(output);
+    float* kept_values =
+        reinterpret_cast<float*>(output + k * sizeof(uint32_t));
+    for (int64_t j = 0; j < k; ++j) {
+      kept_indices[j] = indices_[j];
+      kept_values[j] = input[indices_[j]];
+    }
+  }
+
+  void Decompress(const char* input, int64_t num_elements,
+                  float* output) const override {
+    const int64_t k = NumKept(num_elements);
+    const uint32_t* kept_indices = reinterpret_cast<const uint32_t*>(input);
+    const float* kept_values =
+        reinterpret_cast<const float*>(input + k * sizeof(uint32_t));
+    std::fill(output, output + num_elements, 0.0f);
+    for (int64_t j = 0; j < k; ++j) {
+      output[kept_indices[j]] = kept_values[j];
+    }
+  }
+
+  bool NeedsErrorFeedback() const override { return true; }
+
+ private:
+  int64_t NumKept(int64_t num_elements) const {
+    return TopKCount(num_elements, ratio_);
+  }
+
+  double ratio_;
+  std::vector<uint32_t> indices_;
+};
+
+}  // namespace
+
+int64_t TopKCount(int64_t num_elements, double ratio) {
+  int64_t k = (int64_t)std::ceil(ratio * num_elements);
+  return std::min(num_elements, std::max<int64_t>(1, k));
+}
+
+void SelectTopK(const float* input, int64_t num_elements, int64_t k,
+                std::vector<uint32_t>* indices) {
+  indices->resize(num_elements);
+  for (int64_t i = 0; i < num_elements; ++i) {
+    (*indices)[i] = (uint32_t)i;
+  }
+  if (k < num_elements) {
+    std::nth_element(indices->begin(), indices->begin() + k, indices->end(),
+                     [input](uint32_t a, uint32_t b) {
+                       return std::abs(input[a]) > std::abs(input[b]);
+                     });
+    // Sorted indices make the scatter of the receivers sequential.
+    std::sort(indices->begin(), indices->begin() + k);
+  }
+  indices->resize(k);
+}
+
+std::unique_ptr<Compressor> CreateCompressor(CompressionType type,
+                                             double ratio) {
+  switch (type) {
+    case CompressionType::NONE:
+      return nullptr;
+    case CompressionType::FP16:
+      return std::unique_ptr<Compressor>(new Float16Compressor());
+    case CompressionType::INT8:
+      return std::unique_ptr<Compressor>(new Int8Compressor());
+    case CompressionType::TOPK:
+      if (!(ratio > 0.0 && ratio <= 1.0)) {
+        throw std::invalid_argument(
+            "The ratio of top-k compression should be in (0, 1].");
+      }
+      return std::unique_ptr<Compressor>(new TopKCompressor(ratio));
+    default:
+      throw std::invalid_argument("Unknown compression type.");
+  }
+}
+
+void CompressWithErrorFeedback(Compressor& compressor, const float* input,
+                               int64_t num_elements,
+                               std::vector<float>* residual,
+                               std::vector<float>* scratch, char* output) {
+  float* error = residual->data();
+  for (int64_t i = 0; i < num_elements; ++i) {
+    error[i] += input[i];
+  }
+  compressor.Compress(error, num_elements, output);
+  if ((int64_t)scratch->size() < num_elements) {
+    scratch->resize(num_elements);
+  }
+  float* sent = scratch->data();
+  compressor.Decompress(output, num_elements, sent);
+  for (int64_t i = 0; i < num_elements; ++i) {
+    error[i] -= sent[i];
+  }
+}
+
+}  // namespace common
+}  // namespace bluefog
@@ -0,0 +1,72 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#ifndef BLUEFOG_COMMON_COMPRESSOR_H
+#define BLUEFOG_COMMON_COMPRESSOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+
+namespace bluefog {
+namespace common {
+
+// Compressor turns float32 values into the payload sent to the neighbors and
+// back. The payload size only depends on the number of values, so the
+// receivers know how many bytes to expect without another message.
+class Compressor {
+ public:
+  virtual ~Compressor() = default;
+
+  // Number of bytes of the payload of num_elements values.
+  virtual int64_t CompressedSize(int64_t num_elements) const = 0;
+
+  virtual void Compress(const float* input, int64_t num_elements,
+                        char* output) = 0;
+
+  virtual void Decompress(const char* input, int64_t num_elements,
+                          float* output) const = 0;
+
+  // Whether the compression loses too much to be dropped, so the error should
+  // be added to the next tensor of the same name instead.
+  virtual bool NeedsErrorFeedback() const { return false; }
+};
+
+// Returns nullptr for CompressionType::NONE. The ratio is the fraction of the
+// values kept by TOPK, and is ignored by the others.
+std::unique_ptr<Compressor> CreateCompressor(CompressionType type,
+                                             double ratio);
+
+// Number of the values kept by top-k compression with the ratio.
+int64_t TopKCount(int64_t num_elements, double ratio);
+
+// Indices of the k values of the largest magnitude in ascending order.
+void SelectTopK(const float* input, int64_t num_elements, int64_t k,
+                std::vector<uint32_t>* indices);
+
+// Compresses input + residual, then keeps what the payload misses of it in
+// residual for the next call. The residual must have num_elements values, and
+// scratch is grown to num_elements to decompress the payload into.
+void CompressWithErrorFeedback(Compressor& compressor, const float* input,
+                               int64_t num_elements,
+                               std::vector<float>* residual,
+                               std::vector<float>* scratch, char* output);
+
+}  // namespace common
+}  // namespace bluefog
+
+#endif  // BLUEFOG_COMMON_COMPRESSOR_H
@@ -25,6 +25,8 @@
 
 #include "tensor_queue.h"
 #include "mpi_controller.h"
+#include "parameter_manager.h"
+#include "response_cache.h"
 #include "timeline.h"
 
 #if HAVE_NCCL
@@ -63,6 +65,14 @@ struct BluefogGlobalState {
   // Background thread cycle time in milliseconds.  Fractional numbers are permitted.
   double cycle_time_ms = 0.5;
 
+  // If set, the background thread is woken up by the tensor queue as soon as
+  // new request arrives instead of sleeping out the rest of the cycle time.
+  bool event_driven = false;
+
+  // Current waiting time of the background thread under event-driven mode.
+  // It grows when the thread keeps idling and is reset when work arrives.
+  std::chrono::microseconds idle_backoff{0};
+
   // Time point when last cycle started.
   std::chrono::steady_clock::time_point last_cycle_start;
 
@@ -77,17 +87,71 @@ struct BluefogGlobalState {
 
   TensorQueue tensor_queue;
 
+  // If set, negotiated entries are performed by the execution thread so that
+  // the negotiation of next requests runs concurrently with them.
+  bool pipeline_execution = false;
+
+  // Thread performing the entries in execution_queue.
+  std::thread execution_thread;
+
+  ExecutionQueue execution_queue;
+
+  // If set, a thread keeps entering the MPI library, so that the one-sided ops
+  // targeting this process progress while the main thread is computing.
+  bool win_progress = false;
+
+  // Thread polling the MPI progress engine.
+  std::thread win_progress_thread;
+
+  // Private duplicate of the global communicator the progress thread probes,
+  // so the probe cannot match the messages of the ops.
+  MPI_Comm win_progress_comm = MPI_COMM_NULL;
+
+  // Sleep of the progress thread between two polls in microseconds.
+  int win_progress_interval_us = 100;
+
+  // CPU the progress thread is pinned to. Not pinned if negative.
+  int win_progress_cpu = -1;
+
   // Threshold for Tensor Fusion.  All tensors that occupy memory beyond this
   // threshold will be fused.
   int64_t tensor_fusion_threshold = 8 * 1024 * 1024;
   FusionBufferManager fusion_buffer;
 
+  // Maximum number of fused responses that are open for more tensors at the
+  // same time. Ready tensors can be fused out of order across them, and 1
+  // only fuses consecutive tensors.
+  int fusion_reorder_window = 8;
+
+  // Reduce the neighbor_allreduce of eligible tensors as the neighbor messages
+  // arrive instead of receiving all of them first.
+  bool neighbor_allreduce_streaming = false;
+
+  // Tunes the fusion threshold and cycle time online if autotuning is enabled.
+  ParameterManager parameter_manager;
+
   // Because setting topology happens in the main thread instead of communication
   // thread. Following three variables are to sync between them.
   std::atomic_bool setting_topology{false};
   std::atomic_bool setting_topology_done{false};
   std::atomic_bool ready_to_setting_topology{false};
 
+  // Responses constructed by the coordinator before. Tensors hitting the cache
+  // skip the negotiation through the coordinator. Disabled if capacity is 0.
+  ResponseCache response_cache;
+
+  // Requests that hit the response cache but not all ranks are ready yet.
+  std::deque<Request> cached_message_queue;
+
+  // If set, requests are reduced to the coordinator along a binomial tree
+  // instead of being gathered to the coordinator directly.
+  bool tree_negotiation = false;
+
+  // Only used by tree-based negotiation, where message_table exists on every
+  // rank and only keeps the requests with different signatures. It counts how
+  // many ranks of the subtree rooted at this rank have requested the tensor.
+  std::unordered_map<std::string, int> subtree_request_counts;
+
   // Only exists on the coordinator node (rank zero). Maintains a vector of
   // requests to allreduce every tensor (keyed by tensor name).
   // The associated time_point is recorded when the request is received, which
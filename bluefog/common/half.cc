@@ -15,18 +15,32 @@
 
 #include "half.h"
 
+// The SIMD implementations are compiled with the target attribute and chosen
+// at runtime, so the library still runs on CPUs without them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLUEFOG_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define BLUEFOG_X86_SIMD 0
+#endif
+
+// AVX512-FP16 intrinsics need GCC 12 or Clang 14.
+#if BLUEFOG_X86_SIMD &&                                     \
+    ((!defined(__clang__) && __GNUC__ >= 12) ||             \
+     (defined(__clang__) && __clang_major__ >= 14))
+#define BLUEFOG_AVX512FP16 1
+#else
+#define BLUEFOG_AVX512FP16 0
+#endif
+
 namespace bluefog {
 namespace common {
 
-// float16 custom data type summation operation.
-void float16_sum(void* invec, void* inoutvec, int* len,
-                 MPI_Datatype* datatype) {
-  // cast invec and inoutvec to your float16 type
-  auto* in = (unsigned short*)invec;
-  auto* inout = (unsigned short*)inoutvec;
+namespace {
 
-  int i = 0;
-  for (; i < *len; ++i) {
+void Float16SumScalar(const unsigned short* in, unsigned short* inout,
+                      int begin, int end) {
+  for (int i = begin; i < end; ++i) {
     float in_float;
     float inout_float;
     HalfBits2Float(in + i, &in_float);
@@ -36,5 +50,310 @@ void float16_sum(void* invec, void* inoutvec, int* len,
   }
 }
 
+// The sum of two float16 is rounded only once in float, because float has
+// more than twice the precision of float16 plus 2 bits. So adding them in
+// float and converting back gives the same bits as adding them in float16.
+#if BLUEFOG_X86_SIMD
+__attribute__((target("avx,f16c"))) void Float16SumF16C(
+    const unsigned short* in, unsigned short* inout, int len) {
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i)));
+    __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(inout + i)));
+    _mm_storeu_si128(
+        (__m128i*)(inout + i),
+        _mm256_cvtps_ph(_mm256_add_ps(a, b),
+                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+  Float16SumScalar(in, inout, i, len);
+}
+
+__attribute__((target("avx,f16c"))) void HalfBits2FloatF16C(
+    const unsigned short* src, float* res, int64_t len) {
+  int64_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm256_storeu_ps(res + i, _mm256_cvtph_ps(h));
+  }
+  for (; i < len; ++i) {
+    HalfBits2Float(src + i, res + i);
+  }
+}
+
+__attribute__((target("avx,f16c"))) void Float2HalfBitsF16C(
+    const float* src, unsigned short* dest, int64_t len) {
+  int64_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128((__m128i*)(dest + i), h);
+  }
+  for (; i < len; ++i) {
+    Float2HalfBits(src + i, dest + i);
+  }
+}
+
+// GCC warns about the undefined vectors the AVX-512 intrinsics start from,
+// which they overwrite entirely.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) void Float16SumAVX512F(
+    const unsigned short* in, unsigned short* inout, int len) {
+  int i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m512 a = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(in + i)));
+    __m512 b = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(inout + i)));
+    _mm256_storeu_si256(
+        (__m256i*)(inout + i),
+        _mm512_cvtps_ph(_mm512_add_ps(a, b),
+                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+  Float16SumScalar(in, inout, i, len);
+}
+#pragma GCC diagnostic pop
+#endif
+
+#if BLUEFOG_AVX512FP16
+__attribute__((target("avx512fp16,avx512bw,avx512vl"))) void
+Float16SumAVX512FP16(const unsigned short* in, unsigned short* inout, int len) {
+  int i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m512h a = _mm512_loadu_ph(in + i);
+    __m512h b = _mm512_loadu_ph(inout + i);
+    _mm512_storeu_ph(inout + i, _mm512_add_ph(a, b));
+  }
+  Float16SumScalar(in, inout, i, len);
+}
+#endif
+
+void BFloat16SumScalar(const unsigned short* in, unsigned short* inout,
+                       int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    float in_float;
+    float inout_float;
+    BFloat16Bits2Float(in + i, &in_float);
+    BFloat16Bits2Float(inout + i, &inout_float);
+    inout_float += in_float;
+    Float2BFloat16Bits(&inout_float, inout + i);
+  }
+}
+
+// There is no conversion instruction rounding like Float2BFloat16Bits for
+// subnormals, so the rounding is done with integer instructions.
+#if BLUEFOG_X86_SIMD
+__attribute__((target("avx2"))) void BFloat16SumAVX2(const unsigned short* in,
+                                                     unsigned short* inout,
+                                                     int len) {
+  const __m256i rounding = _mm256_set1_epi32(0x7fff);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i nan = _mm256_set1_epi32(0x7fc0);
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256 a = _mm256_castsi256_ps(_mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i))), 16));
+    __m256 b = _mm256_castsi256_ps(_mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(inout + i))),
+        16));
+    __m256 sum = _mm256_add_ps(a, b);
+    __m256i bits = _mm256_castps_si256(sum);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+    __m256i res = _mm256_srli_epi32(
+        _mm256_add_epi32(bits, _mm256_add_epi32(rounding, lsb)), 16);
+    res = _mm256_blendv_epi8(
+        res, nan, _mm256_castps_si256(_mm256_cmp_ps(sum, sum, _CMP_UNORD_Q)));
+    // Pack within the 128-bit lanes, then move the halves together.
+    res = _mm256_permute4x64_epi64(_mm256_packus_epi32(res, res), 0xd8);
+    _mm_storeu_si128((__m128i*)(inout + i), _mm256_castsi256_si128(res));
+  }
+  BFloat16SumScalar(in, inout, i, len);
+}
+
+// The same false warnings as Float16SumAVX512F.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f"))) void BFloat16SumAVX512F(
+    const unsigned short* in, unsigned short* inout, int len) {
+  const __m512i rounding = _mm512_set1_epi32(0x7fff);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i nan = _mm512_set1_epi32(0x7fc0);
+  int i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m512 a = _mm512_castsi512_ps(_mm512_slli_epi32(
+        _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(in + i))),
+        16));
+    __m512 b = _mm512_castsi512_ps(_mm512_slli_epi32(
+        _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(inout + i))),
+        16));
+    __m512 sum = _mm512_add_ps(a, b);
+    __m512i bits = _mm512_castps_si512(sum);
+    __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16), one);
+    __m512i res = _mm512_srli_epi32(
+        _mm512_add_epi32(bits, _mm512_add_epi32(rounding, lsb)), 16);
+    res = _mm512_mask_mov_epi32(res, _mm512_cmp_ps_mask(sum, sum, _CMP_UNORD_Q),
+                                nan);
+    _mm256_storeu_si256((__m256i*)(inout + i), _mm512_cvtepi32_epi16(res));
+  }
+  BFloat16SumScalar(in, inout, i, len);
+}
+#pragma GCC diagnostic pop
+#endif
+
+Float16SumImpl DetectFloat16SumImpl() {
+  for (int impl = (int)Float16SumImpl::AVX512FP16;
+       impl > (int)Float16SumImpl::SCALAR; --impl) {
+    if (Float16SumSupported((Float16SumImpl)impl)) {
+      return (Float16SumImpl)impl;
+    }
+  }
+  return Float16SumImpl::SCALAR;
+}
+
+BFloat16SumImpl DetectBFloat16SumImpl() {
+  for (int impl = (int)BFloat16SumImpl::AVX512F;
+       impl > (int)BFloat16SumImpl::SCALAR; --impl) {
+    if (BFloat16SumSupported((BFloat16SumImpl)impl)) {
+      return (BFloat16SumImpl)impl;
+    }
+  }
+  return BFloat16SumImpl::SCALAR;
+}
+
+bool HasF16C() {
+  static const bool has_f16c = Float16SumSupported(Float16SumImpl::F16C);
+  return has_f16c;
+}
+
+}  // namespace
+
+bool Float16SumSupported(Float16SumImpl impl) {
+#if BLUEFOG_X86_SIMD
+  __builtin_cpu_init();
+#endif
+  switch (impl) {
+    case Float16SumImpl::SCALAR:
+      return true;
+#if BLUEFOG_X86_SIMD
+    case Float16SumImpl::F16C:
+      return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    case Float16SumImpl::AVX512F:
+      return __builtin_cpu_supports("avx512f");
+#endif
+#if BLUEFOG_AVX512FP16
+    case Float16SumImpl::AVX512FP16:
+      return __builtin_cpu_supports("avx512fp16") &&
+             __builtin_cpu_supports("avx512bw") &&
+             __builtin_cpu_supports("avx512vl");
+#endif
+    default:
+      return false;
+  }
+}
+
+Float16SumImpl Float16SumBestImpl() {
+  static const Float16SumImpl impl = DetectFloat16SumImpl();
+  return impl;
+}
+
+void Float16Sum(Float16SumImpl impl, const unsigned short* in,
+                unsigned short* inout, int len) {
+  switch (impl) {
+#if BLUEFOG_X86_SIMD
+    case Float16SumImpl::F16C:
+      Float16SumF16C(in, inout, len);
+      break;
+    case Float16SumImpl::AVX512F:
+      Float16SumAVX512F(in, inout, len);
+      break;
+#endif
+#if BLUEFOG_AVX512FP16
+    case Float16SumImpl::AVX512FP16:
+      Float16SumAVX512FP16(in, inout, len);
+      break;
+#endif
+    default:
+      Float16SumScalar(in, inout, 0, len);
+  }
+}
+
+void HalfBits2FloatArray(const unsigned short* src, float* res, int64_t len) {
+#if BLUEFOG_X86_SIMD
+  if (HasF16C()) {
+    HalfBits2FloatF16C(src, res, len);
+    return;
+  }
+#endif
+  for (int64_t i = 0; i < len; ++i) {
+    HalfBits2Float(src + i, res + i);
+  }
+}
+
+void Float2HalfBitsArray(const float* src, unsigned short* dest, int64_t len) {
+#if BLUEFOG_X86_SIMD
+  if (HasF16C()) {
+    Float2HalfBitsF16C(src, dest, len);
+    return;
+  }
+#endif
+  for (int64_t i = 0; i < len; ++i) {
+    Float2HalfBits(src + i, dest + i);
+  }
+}
+
+// float16 custom data type summation operation.
+void float16_sum(void* invec, void* inoutvec, int* len,
+                 MPI_Datatype* datatype) {
+  // cast invec and inoutvec to your float16 type
+  auto* in = (unsigned short*)invec;
+  auto* inout = (unsigned short*)inoutvec;
+  Float16Sum(Float16SumBestImpl(), in, inout, *len);
+}
+
+bool BFloat16SumSupported(BFloat16SumImpl impl) {
+#if BLUEFOG_X86_SIMD
+  __builtin_cpu_init();
+#endif
+  switch (impl) {
+    case BFloat16SumImpl::SCALAR:
+      return true;
+#if BLUEFOG_X86_SIMD
+    case BFloat16SumImpl::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case BFloat16SumImpl::AVX512F:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+BFloat16SumImpl BFloat16SumBestImpl() {
+  static const BFloat16SumImpl impl = DetectBFloat16SumImpl();
+  return impl;
+}
+
+void BFloat16Sum(BFloat16SumImpl impl, const unsigned short* in,
+                 unsigned short* inout, int len) {
+  switch (impl) {
+#if BLUEFOG_X86_SIMD
+    case BFloat16SumImpl::AVX2:
+      BFloat16SumAVX2(in, inout, len);
+      break;
+    case BFloat16SumImpl::AVX512F:
+      BFloat16SumAVX512F(in, inout, len);
+      break;
+#endif
+    default:
+      BFloat16SumScalar(in, inout, 0, len);
+  }
+}
+
+// bfloat16 custom data type summation operation.
+void bfloat16_sum(void* invec, void* inoutvec, int* len,
+                  MPI_Datatype* datatype) {
+  auto* in = (unsigned short*)invec;
+  auto* inout = (unsigned short*)inoutvec;
+  BFloat16Sum(BFloat16SumBestImpl(), in, inout, *len);
+}
+
 } // namespace common
 } // namespace horovod
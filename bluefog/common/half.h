@@ -27,6 +27,7 @@
 #define BLUEFOG_COMMON_HALF_H
 
 #include <stdint.h>
+#include <cstring>
 
 #define OMPI_SKIP_MPICXX
 #include "mpi.h"
@@ -132,8 +133,61 @@ inline void Float2HalfBits(const float* src, unsigned short* dest) {
   *dest = u;
 }
 
+// bfloat16 is the upper half of float, so the conversion to float is exact.
+inline void BFloat16Bits2Float(const unsigned short* src, float* res) {
+  unsigned f = ((unsigned)*src) << 16;
+  std::memcpy(res, &f, sizeof(f));
+}
+
+inline void Float2BFloat16Bits(const float* src, unsigned short* dest) {
+  // rounds toward nearest even, the same as PyTorch
+  unsigned s;
+  std::memcpy(&s, src, sizeof(s));
+  if ((s & 0x7fffffff) > 0x7f800000) {
+    *dest = 0x7fc0;  // not a number
+    return;
+  }
+  s += 0x7fff + ((s >> 16) & 1);
+  *dest = (unsigned short)(s >> 16);
+}
+
+// Converts len values with F16C when the CPU supports it. The results are the
+// same bits as HalfBits2Float and Float2HalfBits on every value.
+void HalfBits2FloatArray(const unsigned short* src, float* res, int64_t len);
+
+void Float2HalfBitsArray(const float* src, unsigned short* dest, int64_t len);
+
+// Implementations of the float16 summation, from the slowest to the fastest.
+enum class Float16SumImpl { SCALAR = 0, F16C = 1, AVX512F = 2, AVX512FP16 = 3 };
+
+// Whether the implementation is compiled in and supported by the CPU.
+bool Float16SumSupported(Float16SumImpl impl);
+
+// The fastest implementation supported, which is used by float16_sum.
+Float16SumImpl Float16SumBestImpl();
+
+// inout[i] = in[i] + inout[i]. All the implementations round the sum to the
+// nearest even like Float2HalfBits, so they give the same bits except for the
+// payload and sign of NaN.
+void Float16Sum(Float16SumImpl impl, const unsigned short* in,
+                unsigned short* inout, int len);
+
 void float16_sum(void* invec, void* inoutvec, int* len, MPI_Datatype* datatype);
 
+// Same as above for bfloat16. All the implementations give the same bits as
+// Float2BFloat16Bits.
+enum class BFloat16SumImpl { SCALAR = 0, AVX2 = 1, AVX512F = 2 };
+
+bool BFloat16SumSupported(BFloat16SumImpl impl);
+
+BFloat16SumImpl BFloat16SumBestImpl();
+
+void BFloat16Sum(BFloat16SumImpl impl, const unsigned short* in,
+                 unsigned short* inout, int len);
+
+void bfloat16_sum(void* invec, void* inoutvec, int* len,
+                  MPI_Datatype* datatype);
+
 } // namespace common
 } // namespace horovod
 
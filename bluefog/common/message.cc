@@ -108,6 +108,10 @@ void Request::set_tensor_shape(const std::vector<int64_t>& value) {
   tensor_shape_ = value;
 }
 
+int32_t Request::tensor_id() const { return tensor_id_; }
+
+void Request::set_tensor_id(int32_t value) { tensor_id_ = value; }
+
 void Request::add_tensor_shape(int64_t value) {
   tensor_shape_.push_back(value);
 }
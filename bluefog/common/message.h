@@ -77,6 +77,13 @@ class Request {
   void set_tensor_shape(const std::vector<int64_t>& value);
   void add_tensor_shape(int64_t value);
 
+  // Id of the tensor in the tensor queue of the requesting rank. It is only
+  // meaningful within that rank so it is not serialized. The negotiation,
+  // Response and the timeline still identify the tensors by name, since the
+  // ids are not agreed on across the ranks.
+  int32_t tensor_id() const;
+  void set_tensor_id(int32_t value);
+
   static void ParseFromBytes(Request& request, const uint8_t* input);
 
   static void SerializeToString(const Request& request, std::string& output);
@@ -90,6 +97,7 @@ private:
   bool is_hierarchical_ = false;
   std::string tensor_name_;
   std::vector<int64_t> tensor_shape_;
+  int32_t tensor_id_ = -1;
 };
 
 class RequestList {
@@ -39,12 +39,59 @@ void MPIContextManager::EnvFinalize() {
   }
 }
 
+void WindowManager::AttachNeighborTensor(int rank,
+                                         std::shared_ptr<Tensor> tensor) {
+  MPI_Win_attach(*neighbor_win_, (void*)tensor->data(), tensor->size());
+  neighbor_tensors_[rank] = tensor;
+}
+
+void WindowManager::SetSharedNeighborTensor(int rank,
+                                            std::shared_ptr<Tensor> tensor,
+                                            void* buffer) {
+  neighbor_tensors_[rank] = tensor;
+  shared_neighbor_buffers_[rank] = buffer;
+}
+
+void WindowManager::AttachCompressedBuffer(int rank, int64_t size) {
+  std::vector<char>& buffer = compressed_buffers_[rank];
+  buffer.assign(size, 0);
+  MPI_Win_attach(*neighbor_win_, buffer.data(), size);
+}
+
 void WindowManager::FreeAllWins() {
-  for (auto& win_tensor : wins_tensor_vec_) {
-    MPI_Win_free(win_tensor.first.get());
+  for (auto& kv : neighbor_tensors_) {
+    if (shared_neighbor_buffers_.count(kv.first) == 0) {
+      MPI_Win_detach(*neighbor_win_, kv.second->data());
+    }
+  }
+  for (auto& kv : compressed_buffers_) {
+    MPI_Win_detach(*neighbor_win_, kv.second.data());
   }
+  MPI_Win_free(neighbor_win_.get());
   MPI_Win_free(global_win_.get());
-  wins_tensor_vec_.clear();
+  if (shared_win_) {
+    MPI_Win_unlock_all(*shared_win_);
+    MPI_Win_free(shared_win_.get());
+    shared_win_.reset();
+  }
+  neighbor_tensors_.clear();
+  target_disps_.clear();
+  shared_neighbor_buffers_.clear();
+  shared_target_ptrs_.clear();
+  compressed_buffers_.clear();
+  compressed_target_disps_.clear();
+  put_sequences_.clear();
+  synced_put_sequences_.clear();
+  put_replicas_.clear();
+  put_residuals_.clear();
+  accumulate_residuals_.clear();
+}
+
+void InitializeMutexWinMemory(std::vector<int>& mutex_mem, int world_size) {
+  mutex_mem.assign(MUTEX_WIN_INTS_PER_RANK * world_size, 0);
+  // The tails of the queues and the "next" of the queue nodes are empty.
+  std::fill_n(mutex_mem.begin(), 2 * world_size, -1);
+  std::fill_n(mutex_mem.begin() + 3 * world_size, world_size, -1);
 }
 
 bool WindowManager::InitializeMutexWin(const MPI_Comm& mpi_comm) {
@@ -60,13 +107,11 @@ bool WindowManager::InitializeMutexWin(const MPI_Comm& mpi_comm) {
   if (!mutex_win_) {
     mutex_win_ = std::make_shared<MPI_Win>();
   }
-  // We only need one value for self mutex.
-  mutex_mem_.resize(global_size);
-  std::fill_n(mutex_mem_.data(), global_size, 0);
+  InitializeMutexWinMemory(mutex_mem_, global_size);
 
   int element_size = 0;
   MPI_Type_size(MPI_INT, &element_size);
-  int win_size = global_size * element_size;
+  int win_size = mutex_mem_.size() * element_size;
   MPI_Win_create((void*)mutex_mem_.data(), win_size, element_size,
                  MPI_INFO_NULL, mpi_comm, mutex_win_.get());
   return true;
@@ -88,6 +133,18 @@ void WindowManager::incrementVersionWinMem(int position) {
   version_mem_[position]++;
 }
 
+void WindowManager::ConsumeVersionWinMem(const std::vector<int>& versions) {
+  for (size_t i = 0; i < version_mem_.size(); i++) {
+    version_mem_[i] -= versions[i];
+  }
+}
+
+void WindowManager::UpdateMissedSyncs(const std::vector<int>& versions) {
+  for (size_t i = 0; i < version_mem_.size(); i++) {
+    missed_syncs_[i] = versions[i] > 0 ? 0 : missed_syncs_[i] + 1;
+  }
+}
+
 bool WindowManager::InitializeVersionWin(
     const MPI_Comm& mpi_comm, const std::vector<int>& neighbor_in_ranks) {
   int self_rank = 0;
@@ -104,6 +161,7 @@ bool WindowManager::InitializeVersionWin(
   }
 
   version_mem_.resize(global_size, 0);
+  missed_syncs_.assign(global_size, 0);
 
   int element_size = 0;
   MPI_Type_size(MPI_INT, &element_size);
@@ -121,6 +179,7 @@ bool WindowManager::DestroyVersionWin() {
   MPI_Win_free(version_win_.get());
   version_win_.reset();
   version_mem_.clear();
+  missed_syncs_.clear();
   return true;
 }
 
@@ -204,6 +263,8 @@ MPI_Datatype MPIContext::GetMPIDataType(const DataType dtype) {
       return MPI_INT64_T;
     case DataType::BLUEFOG_FLOAT16:
       return mpi_float16_t;
+    case DataType::BLUEFOG_BFLOAT16:
+      return mpi_bfloat16_t;
     case DataType::BLUEFOG_FLOAT32:
       return MPI_FLOAT;
     case DataType::BLUEFOG_FLOAT64:
@@ -219,7 +280,14 @@ MPI_Datatype MPIContext::GetMPIDataType(const DataType dtype) {
 }
 
 MPI_Op MPIContext::GetMPISumOp(DataType dtype) {
-  return dtype == DataType::BLUEFOG_FLOAT16 ? mpi_float16_sum : MPI_SUM;
+  switch (dtype) {
+    case DataType::BLUEFOG_FLOAT16:
+      return mpi_float16_sum;
+    case DataType::BLUEFOG_BFLOAT16:
+      return mpi_bfloat16_sum;
+    default:
+      return MPI_SUM;
+  }
 }
 
 MPI_Comm MPIContext::GetMPICommunicator(Communicator comm) {
@@ -310,6 +378,8 @@ void MPIContext::Initialize(const std::vector<int>& ranks,
     BFLOG(DEBUG) << "Using the existing mpi_comm.";
   }
 
+  MPI_Comm_dup(mpi_comm, &negotiation_comm);
+
   // Create local comm, Determine local rank by querying the local communicator.
   MPI_Comm_split_type(mpi_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
                       &local_comm);
@@ -332,6 +402,11 @@ void MPIContext::Initialize(const std::vector<int>& ranks,
 
   // Create custom MPI float16 summation op.
   MPI_Op_create(&float16_sum, 1, &mpi_float16_sum);
+
+  // Create custom MPI bfloat16 data type and summation op.
+  MPI_Type_contiguous(2, MPI_BYTE, &mpi_bfloat16_t);
+  MPI_Type_commit(&mpi_bfloat16_t);
+  MPI_Op_create(&bfloat16_sum, 1, &mpi_bfloat16_sum);
 }
 
 void MPIContext::Finalize(MPIContextManager& ctx_manager) {
@@ -349,6 +424,15 @@ void MPIContext::Finalize(MPIContextManager& ctx_manager) {
     MPI_Comm_free(&mpi_comm);
   }
 
+  if (negotiation_comm != MPI_COMM_NULL) {
+    MPI_Comm_free(&negotiation_comm);
+  }
+
+  if (hierarchical_shared_win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(hierarchical_shared_win);
+    MPI_Win_free(&hierarchical_shared_win);
+  }
+
   if (local_comm != MPI_COMM_NULL) {
     MPI_Comm_free(&local_comm);
   }
@@ -365,6 +449,14 @@ void MPIContext::Finalize(MPIContextManager& ctx_manager) {
     MPI_Op_free(&mpi_float16_sum);
   }
 
+  if (mpi_bfloat16_t != MPI_DATATYPE_NULL) {
+    MPI_Type_free(&mpi_bfloat16_t);
+  }
+
+  if (mpi_bfloat16_sum != MPI_OP_NULL) {
+    MPI_Op_free(&mpi_bfloat16_sum);
+  }
+
   if (should_finalize) {
     ctx_manager.EnvFinalize();
   }
@@ -507,6 +599,66 @@ Status MPIContext::AllocateOutput(TensorTableEntry& entry, int*& recvcounts,
   return status;
 }
 
+Status MPIContext::AllocateOutputs(std::vector<TensorTableEntry>& entries,
+                                   std::vector<int>& first_dims,
+                                   Communicator comm_type) {
+  Timeline* timeline_ptr;
+  Status timeline_status = GetBluefogTimeline(timeline_ptr);
+  timeline_ptr->ActivityStartAll(entries, "ALLOCATE_OUTPUT");
+
+  int cnt_size = 0;
+  if (comm_type == Communicator::GLOBAL) {
+    cnt_size = size_;
+  } else if (comm_type == Communicator::GRAPH) {
+    cnt_size = neighbor_indgree_;
+  }
+
+  int num_entries = (int)entries.size();
+  std::vector<int> send_dims(num_entries);
+  for (int i = 0; i < num_entries; ++i) {
+    send_dims[i] = entries[i].tensor->shape().dim_size(0);
+  }
+  first_dims.resize((size_t)cnt_size * num_entries);
+  int ret_code = -1;
+  if (comm_type == Communicator::GLOBAL) {
+    ret_code = MPI_Allgather(send_dims.data(), num_entries, MPI_INT,
+                             first_dims.data(), num_entries, MPI_INT,
+                             GetMPICommunicator(Communicator::GLOBAL));
+  } else if (comm_type == Communicator::GRAPH) {
+    ret_code = MPI_Neighbor_allgather(send_dims.data(), num_entries, MPI_INT,
+                                      first_dims.data(), num_entries, MPI_INT,
+                                      GetMPICommunicator(Communicator::GRAPH));
+  }
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error(
+        "MPI_Allgather (pre-allgather to get size) failed, see MPI output for "
+        "details.");
+  }
+
+  Status status = Status::OK();
+  for (int i = 0; i < num_entries; ++i) {
+    auto& entry = entries[i];
+    TensorShape single_slice_shape;
+    for (int d = 1; d < entry.tensor->shape().dims(); ++d) {
+      single_slice_shape.AddDim(entry.tensor->shape().dim_size(d));
+    }
+    int64_t total_entry_dimension_size = 0;
+    for (int rc = 0; rc < cnt_size; ++rc) {
+      total_entry_dimension_size += first_dims[rc * num_entries + i];
+    }
+    TensorShape output_shape;
+    output_shape.AddDim(total_entry_dimension_size);
+    output_shape.AppendShape(single_slice_shape);
+    status = entry.context->AllocateOutput(output_shape, &entry.output);
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  timeline_ptr->ActivityEndAll(entries);
+  return status;
+}
+
 void MPIContext::SetDisplacements(const int* recvcounts, int*& displcmnts,
                                   Communicator comm_type) {
   int cnt_size = 0;
@@ -38,25 +38,72 @@ class MPIContextManager {
   virtual void EnvFinalize();
 };
 
+// The mutex window keeps the queue locks of the mutexes hosted by each rank,
+// see MPIWinMutexAcquireImpl. For every rank y of N ranks, it holds
+//   [0, N):   the tail of the queue of the mutex of y at self, -1 if free;
+//   [N, 2N):  "next" of the queue node of self for the mutex of y at self;
+//   [2N, 3N): "blocked" of the same node;
+//   [3N, 4N): "next" of the queue node of self for the mutex of self at y;
+//   [4N, 5N): "blocked" of the same node.
+constexpr int MUTEX_WIN_INTS_PER_RANK = 5;
+
+// Fills the memory of the mutex window of the world size with free mutexes.
+void InitializeMutexWinMemory(std::vector<int>& mutex_mem, int world_size);
+
 class WindowManager {
  public:
   WindowManager() = default;
 
-  inline std::shared_ptr<MPI_Win> GetWinByRank(int rank) { 
-    return wins_tensor_vec_[rank].first; 
+  // The window of the neighbor tensors, used by win_put and win_accumulate.
+  inline std::shared_ptr<MPI_Win> GetNeighborWin() { return neighbor_win_; }
+  inline void SetNeighborWin(std::shared_ptr<MPI_Win> win) {
+    neighbor_win_ = win;
   }
-  inline std::shared_ptr<Tensor> GetAssociateTensorByRank(int rank) { 
-    return wins_tensor_vec_[rank].second; 
+  inline std::shared_ptr<Tensor> GetAssociateTensorByRank(int rank) {
+    auto it = neighbor_tensors_.find(rank);
+    return it == neighbor_tensors_.end() ? nullptr : it->second;
   }
   inline std::shared_ptr<MPI_Win> GetGlobalWin() { return global_win_; }
 
-  inline const void* GetWinMemoryByRank(int rank) { 
-    return wins_tensor_vec_[rank].second->data(); 
+  inline const void* GetWinMemoryByRank(int rank) {
+    return neighbor_tensors_.at(rank)->data();
+  }
+
+  // Attaches the tensor receiving from the rank to the neighbor window.
+  void AttachNeighborTensor(int rank, std::shared_ptr<Tensor> tensor);
+
+  // Window of the memory shared with the ranks on the same node, which holds
+  // the tensors receiving from them instead of the neighbor window. Null if
+  // the window does not use shared memory.
+  inline std::shared_ptr<MPI_Win> GetSharedWin() { return shared_win_; }
+  inline void SetSharedWin(std::shared_ptr<MPI_Win> win) { shared_win_ = win; }
+
+  // Records the tensor receiving from the rank, whose memory is going to be
+  // replaced by the buffer in the shared window.
+  void SetSharedNeighborTensor(int rank, std::shared_ptr<Tensor> tensor,
+                               void* buffer);
+  inline void* GetSharedNeighborBuffer(int rank) {
+    auto it = shared_neighbor_buffers_.find(rank);
+    return it == shared_neighbor_buffers_.end() ? nullptr : it->second;
   }
 
-  inline void PushBackWinAndTensor(std::shared_ptr<MPI_Win> win,
-                                   std::shared_ptr<Tensor> tensor) {
-    wins_tensor_vec_.push_back(std::make_pair(win, tensor));
+  // Memory for this rank in the shared window of the target rank, which is
+  // written with plain stores. Null if the target is not on the same node.
+  inline char* GetSharedTargetPtr(int target_rank) {
+    auto it = shared_target_ptrs_.find(target_rank);
+    return it == shared_target_ptrs_.end() ? nullptr : it->second;
+  }
+  inline void SetSharedTargetPtr(int target_rank, char* ptr) {
+    shared_target_ptrs_[target_rank] = ptr;
+  }
+
+  // Address of the memory for this rank in the neighbor window of the target
+  // rank, which is the target displacement of win_put and win_accumulate.
+  inline MPI_Aint GetTargetDisp(int target_rank) {
+    return target_disps_.at(target_rank);
+  }
+  inline void SetTargetDisp(int target_rank, MPI_Aint disp) {
+    target_disps_[target_rank] = disp;
   }
 
   inline void SetGlobalWin(std::shared_ptr<MPI_Win> win) {
@@ -78,6 +125,13 @@ class WindowManager {
   void resetVersionWinMem(int initialValue = 0);
   void incrementVersionWinMem(int position);
   void setVersionWinMem(int value, int position);
+  // Takes the versions seen by a win_sync off the version memory, so the
+  // versions written since then are left for the next win_sync.
+  void ConsumeVersionWinMem(const std::vector<int>& versions);
+  // Counts one more missed win_sync for every rank without a new version.
+  void UpdateMissedSyncs(const std::vector<int>& versions);
+  // Number of win_sync in a row that found no new data from the rank.
+  inline int GetMissedSyncs(int rank) { return missed_syncs_[rank]; }
 
   inline std::shared_ptr<MPI_Win> GetVersionWin() { return version_win_; }
   inline std::shared_ptr<MPI_Win> GetMutexWin() { return mutex_win_; }
@@ -89,12 +143,63 @@ class WindowManager {
   double GetAssociatedP(int rank);
   void SetAssociatedP(int rank, double weight);
 
+  // Compression of win_put and win_accumulate, which is chosen by win_create.
+  inline void SetCompression(CompressionType compression, double ratio) {
+    compression_ = compression;
+    compression_ratio_ = ratio;
+  }
+  inline CompressionType GetCompression() { return compression_; }
+  inline double GetCompressionRatio() { return compression_ratio_; }
+
+  // Buffers of the compressed win_put payloads received from the rank, which
+  // are attached to the neighbor window as well.
+  void AttachCompressedBuffer(int rank, int64_t size);
+  inline char* GetCompressedBufferByRank(int rank) {
+    return compressed_buffers_.at(rank).data();
+  }
+  inline MPI_Aint GetCompressedTargetDisp(int target_rank) {
+    return compressed_target_disps_.at(target_rank);
+  }
+  inline void SetCompressedTargetDisp(int target_rank, MPI_Aint disp) {
+    compressed_target_disps_[target_rank] = disp;
+  }
+
+  // Number of the payloads put to the destination rank, which is sent in the
+  // header of the buffer, and the number last taken by win_sync from the
+  // buffer of the source rank.
+  inline int& GetPutSequence(int rank) { return put_sequences_[rank]; }
+  inline int& GetSyncedPutSequence(int rank) {
+    return synced_put_sequences_[rank];
+  }
+
+  // Values the sender keeps for every destination rank: what the buffer of
+  // top-k compression holds there after win_put, and what the compressed
+  // payloads did not send yet of win_put and win_accumulate.
+  inline std::vector<float>& GetPutReplica(int rank) {
+    return put_replicas_[rank];
+  }
+  inline std::vector<float>& GetPutResidual(int rank) {
+    return put_residuals_[rank];
+  }
+  inline std::vector<float>& GetAccumulateResidual(int rank) {
+    return accumulate_residuals_[rank];
+  }
+
  private:
-  // Store all the pointers to the MPI WIN and underlying tensor.
-  // It should always keep the order from 0 to WORLD_SIZE-1.
+  // A dynamic window with the tensors of all the in-neighbors attached, so
+  // creating it is one collective call regardless of the world size.
   // Used with win_put and win_accumulate.
-  std::vector<std::pair<std::shared_ptr<MPI_Win>, std::shared_ptr<Tensor>>>
-      wins_tensor_vec_;
+  std::shared_ptr<MPI_Win> neighbor_win_;
+  // In-neighbor rank -> the tensor receiving from it.
+  std::unordered_map<int, std::shared_ptr<Tensor>> neighbor_tensors_;
+  // Out-neighbor rank -> the address of the tensor for this rank there.
+  std::unordered_map<int, MPI_Aint> target_disps_;
+
+  std::shared_ptr<MPI_Win> shared_win_;
+  // In-neighbor rank on the same node -> its buffer in the shared window.
+  std::unordered_map<int, void*> shared_neighbor_buffers_;
+  // Out-neighbor rank on the same node -> the buffer for this rank there.
+  std::unordered_map<int, char*> shared_target_ptrs_;
 
   // A window associated with the self (all connected).
   // Used with win_get.
@@ -108,10 +213,21 @@ class WindowManager {
   std::shared_ptr<MPI_Win> version_win_;
   // Each element represents the version of corresponding rank.
   std::vector<int> version_mem_;
+  std::vector<int> missed_syncs_;
 
   // MPI Window used for p. Mainly used for push-sum algorithm.
   std::shared_ptr<MPI_Win> p_win_;
   std::vector<double> p_mem_;
+
+  CompressionType compression_ = CompressionType::NONE;
+  double compression_ratio_ = 0.0;
+  std::unordered_map<int, std::vector<char>> compressed_buffers_;
+  std::unordered_map<int, MPI_Aint> compressed_target_disps_;
+  std::unordered_map<int, int> put_sequences_;
+  std::unordered_map<int, int> synced_put_sequences_;
+  std::unordered_map<int, std::vector<float>> put_replicas_;
+  std::unordered_map<int, std::vector<float>> put_residuals_;
+  std::unordered_map<int, std::vector<float>> accumulate_residuals_;
 };
 
 class MPIContext {
@@ -157,6 +273,11 @@ class MPIContext {
   bool UnregisterAllWindowName();
 
   Status AllocateOutput(TensorTableEntry& entries, int*& recvcounts, Communicator comm_type);
+  // Same as AllocateOutput but gathers the first dimension of all entries in
+  // one call. first_dims[rc * entries.size() + i] is the first dimension of
+  // entries[i] on the rc-th rank (or in-neighbor for GRAPH communicator).
+  Status AllocateOutputs(std::vector<TensorTableEntry>& entries,
+                         std::vector<int>& first_dims, Communicator comm_type);
   void SetDisplacements(const int* recvcounts, int*& displcmnts, Communicator comm_type);
 
   // Flag indicating whether mpi is enabled.
@@ -170,12 +291,26 @@ class MPIContext {
   // threads using MPI.
   MPI_Comm mpi_comm;
 
+  // Communicator used by the negotiation of requests only, so that it can run
+  // concurrently with the communication of tensors.
+  MPI_Comm negotiation_comm;
+
   // Node-local communicator.
   MPI_Comm local_comm;
 
   // Cross-node communicator for hierarchical allreduce.
   MPI_Comm cross_comm;
 
+  // Node-shared memory of hierarchical neighbor_allreduce, see
+  // BLUEFOG_HIERARCHICAL_SHARED_MEMORY. Every local rank has an input slot of
+  // hierarchical_slot_size_ bytes, and local rank 0 also has the slot of the
+  // local sum and hierarchical_recv_size_ bytes of received tensors after it.
+  // Indexed by the local rank. It grows when a larger tensor comes.
+  MPI_Win hierarchical_shared_win = MPI_WIN_NULL;
+  std::vector<char*> hierarchical_shared_bases;
+  int64_t hierarchical_slot_size_ = 0;
+  int64_t hierarchical_recv_size_ = 0;
+
   // Graph-based communicator for neighbor collective operations.
   MPI_Comm graph_comm;
 
@@ -215,6 +350,10 @@ class MPIContext {
   // MPI Custom  data type for float16.
   MPI_Datatype mpi_float16_t;
   MPI_Op mpi_float16_sum;
+
+  // MPI Custom  data type for bfloat16.
+  MPI_Datatype mpi_bfloat16_t;
+  MPI_Op mpi_bfloat16_sum;
 };
 
 }  // namespace common
@@ -22,12 +22,20 @@
 
 #include <algorithm>
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <set>
 #include <thread>
+#include <tuple>
 
+#include "compressor.h"
 #include "cuda_util.h"
 #include "operations.h"
 #include "timeline.h"
+#include "weighted_sum.h"
 
 namespace bluefog {
 namespace common {
@@ -45,6 +53,70 @@ static const int MAX_WIN_SENT =
         ? 1000
         : std::strtol(BLUEFOG_MAX_WIN_SENT, nullptr, 10);
 
+// Fused allreduce larger than this number of bytes is split into chunks, so
+// that copying the chunks in and out of the fusion buffer overlaps with the
+// nonblocking allreduce of the other chunks. 0 disables it.
+static const char* BLUEFOG_FUSION_CHUNK =
+    std::getenv("BLUEFOG_FUSION_CHUNK_SIZE");
+static const int64_t FUSION_CHUNK_SIZE =
+    BLUEFOG_FUSION_CHUNK == nullptr
+        ? 0
+        : std::strtoll(BLUEFOG_FUSION_CHUNK, nullptr, 10);
+// Maximum number of chunks being reduced at the same time.
+static const int FUSION_PIPELINE_DEPTH = 4;
+
+// Streaming neighbor_allreduce receives the neighbor tensors in chunks of this
+// number of bytes, so the staging area is bounded by the chunk size times the
+// number of receives posted at the same time.
+static const char* BLUEFOG_STREAMING_CHUNK =
+    std::getenv("BLUEFOG_NEIGHBOR_ALLREDUCE_CHUNK_SIZE");
+static const int64_t STREAMING_CHUNK_SIZE =
+    BLUEFOG_STREAMING_CHUNK == nullptr
+        ? 256 * 1024
+        : std::strtoll(BLUEFOG_STREAMING_CHUNK, nullptr, 10);
+static const int STREAMING_NUM_STAGING_CHUNKS = 8;
+
+// Compressed win_put payloads start with the number of payloads put so far,
+// which the sender makes odd while it writes the payload and even after, so
+// win_sync can tell a new payload from one still being written. Top-k
+// compression puts the values that changed into a copy of the tensor of the
+// sender instead, and counts by one after they are written. The header is 8
+// bytes to keep the payload aligned.
+static const int COMPRESSED_WIN_HEADER_SIZE = 8;
+
+// Longest sleep between two reads of the versions while win_sync waits for
+// the neighbors.
+static const int MAX_WIN_VERSION_WAIT_SLEEP_US = 100;
+
+// Win_put, win_accumulate and win_get lock all the targets first, issue the
+// transfers to all of them and complete them together, instead of one lock
+// epoch after another.
+static const char* BLUEFOG_WIN_BATCHED_RMA_ENV =
+    std::getenv("BLUEFOG_WIN_BATCHED_RMA");
+static const bool WIN_BATCHED_RMA = BLUEFOG_WIN_BATCHED_RMA_ENV != nullptr &&
+                                    *BLUEFOG_WIN_BATCHED_RMA_ENV == '1';
+
+// The tensors receiving from the neighbors on the same node are allocated in
+// shared memory, where win_put and win_accumulate of those neighbors write
+// with plain stores instead of RMA.
+static const char* BLUEFOG_WIN_SHARED_MEMORY_ENV =
+    std::getenv("BLUEFOG_WIN_SHARED_MEMORY");
+static const bool WIN_SHARED_MEMORY = BLUEFOG_WIN_SHARED_MEMORY_ENV != nullptr &&
+                                      *BLUEFOG_WIN_SHARED_MEMORY_ENV == '1';
+
+// Every buffer in the shared window starts at a cache line.
+static const int64_t SHARED_WIN_ALIGNMENT = 64;
+
+// Hierarchical neighbor_allreduce sums the tensors of the node in shared
+// memory, every local rank a slice, and the local ranks read the tensors
+// received by local rank 0 from there, instead of an allreduce and a
+// broadcast over the local communicator.
+static const char* BLUEFOG_HIERARCHICAL_SHARED_MEMORY_ENV =
+    std::getenv("BLUEFOG_HIERARCHICAL_SHARED_MEMORY");
+static const bool HIERARCHICAL_SHARED_MEMORY =
+    BLUEFOG_HIERARCHICAL_SHARED_MEMORY_ENV != nullptr &&
+    *BLUEFOG_HIERARCHICAL_SHARED_MEMORY_ENV == '1';
+
 // MPIController
 void MPIController::Initialize() {
   // Check if multi-thread is supported.
@@ -62,7 +134,8 @@ void MPIController::Initialize() {
   MPI_Comm_rank(mpi_ctx_.local_comm, &mpi_ctx_.local_rank_);
   MPI_Comm_size(mpi_ctx_.local_comm, &mpi_ctx_.local_size_);
   mpi_ctx_.local_comm_ranks_ = std::vector<int>((size_t)mpi_ctx_.local_size_);
-  mpi_ctx_.local_comm_ranks_[mpi_ctx_.local_rank_] = mpi_ctx_.rank_;
+  MPI_Allgather(&mpi_ctx_.rank_, 1, MPI_INT, mpi_ctx_.local_comm_ranks_.data(),
+                1, MPI_INT, mpi_ctx_.local_comm);
 
   // Get cross-node rank and size in case of hierarchical allreduce.
   MPI_Comm_rank(mpi_ctx_.cross_comm, &mpi_ctx_.cross_rank_);
@@ -210,6 +283,8 @@ int MPIController::SetTopology(int indegree, const int* sources, int outdegree,
   }
   mpi_ctx_.DisableTopoWeights();  // Topology weights are always set at
                                   // SetTopologyWeights.
+  // The residuals were kept for the previous neighbors.
+  ClearCompressionResiduals();
   return 1;
 }
 
@@ -248,6 +323,11 @@ int MPIController::LoadTopologyWeights(
   return 1;
 }
 
+void MPIController::ClearCompressionResiduals() {
+  compression_residuals_.clear();
+  std::vector<float>().swap(compression_scratch_);
+}
+
 void MPIController::NeighborAllgather(TensorTableEntry& entry) {
   int* recvcounts = new int[mpi_ctx_.neighbor_indgree_];
   int* displcmnts = new int[mpi_ctx_.neighbor_indgree_];
@@ -366,6 +446,387 @@ std::string GenerateNeighborAllreduceErrorMessage(const std::vector<MPI_Status>&
   return error_message;
 }
 
+void MPIController::NeighborAllreduceStreaming(TensorTableEntry& entry) {
+  const char* sendbuf = static_cast<const char*>(entry.tensor->data());
+  char* outbuf = (char*)entry.output->data();
+  const int64_t num_elements = entry.tensor->shape().num_elements();
+  const DataType dtype = entry.tensor->dtype();
+  const int element_size = mpi_ctx_.GetMPITypeSize(dtype);
+  MPI_Datatype datatype = mpi_ctx_.GetMPIDataType(entry.tensor);
+  MPI_Comm comm = mpi_ctx_.GetMPICommunicator(Communicator::GRAPH);
+
+  // Both the static and dynamic topology are served by point-to-point
+  // messages, with the same tags as the dynamic neighbor_allreduce.
+  const std::vector<int>& send_ranks = entry.dynamic_neighbors_enabled
+                                           ? *entry.send_neighbors
+                                           : mpi_ctx_.neighbor_out_ranks_;
+  const std::vector<int>& recv_ranks = entry.dynamic_neighbors_enabled
+                                           ? *entry.recv_neighbors
+                                           : mpi_ctx_.neighbor_in_ranks_;
+  const int nsend = send_ranks.size();
+  const int nrecv = recv_ranks.size();
+  std::vector<double> recv_weights(nrecv, 0.0);
+  for (int i = 0; i < nrecv; ++i) {
+    auto it = entry.src_weights.find(recv_ranks[i]);
+    if (it != entry.src_weights.end()) {
+      recv_weights[i] = it->second;
+    }
+  }
+
+  const int64_t chunk_elements =
+      std::max<int64_t>(1, STREAMING_CHUNK_SIZE / element_size);
+  const int64_t chunk_bytes = chunk_elements * element_size;
+  const int64_t num_chunks = (num_elements + chunk_elements - 1) / chunk_elements;
+  auto ChunkLength = [&](int64_t chunk) -> int {
+    return (int)std::min(chunk_elements, num_elements - chunk * chunk_elements);
+  };
+
+  std::vector<MPI_Request> send_requests(nsend * num_chunks);
+  for (int i = 0; i < nsend; ++i) {
+    for (int64_t c = 0; c < num_chunks; ++c) {
+      int ret_code = MPI_Isend(sendbuf + c * chunk_bytes, ChunkLength(c),
+                               datatype, send_ranks[i],
+                               mpi_ctx_.rank_ + send_ranks[i], comm,
+                               &send_requests[i * num_chunks + c]);
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            "MPI_Isend (for streaming neighbor_allreduce) failed, see MPI "
+            "output for details.");
+      }
+    }
+  }
+
+  // Messages are received chunk by chunk across the neighbors. Chunks from
+  // the same neighbor share the tag, so they are matched in the posted order.
+  const int64_t num_messages = nrecv * num_chunks;
+  const int num_slots =
+      (int)std::min<int64_t>(STREAMING_NUM_STAGING_CHUNKS, num_messages);
+  if ((int64_t)streaming_staging_buffer_.size() < num_slots * chunk_bytes) {
+    streaming_staging_buffer_.resize(num_slots * chunk_bytes);
+  }
+  char* staging = streaming_staging_buffer_.data();
+  std::vector<MPI_Request> recv_requests(num_slots, MPI_REQUEST_NULL);
+  std::vector<int64_t> slot_messages(num_slots, -1);
+  int64_t next_message = 0;
+  auto PostRecv = [&](int slot) {
+    int64_t chunk = next_message / nrecv;
+    int neighbor = next_message % nrecv;
+    slot_messages[slot] = next_message++;
+    int ret_code = MPI_Irecv(staging + slot * chunk_bytes, ChunkLength(chunk),
+                             datatype, recv_ranks[neighbor],
+                             mpi_ctx_.rank_ + recv_ranks[neighbor], comm,
+                             &recv_requests[slot]);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Irecv (for streaming neighbor_allreduce) failed, see MPI "
+          "output for details.");
+    }
+  };
+  for (int slot = 0; slot < num_slots; ++slot) {
+    PostRecv(slot);
+  }
+
+  // The self part is computed while the first chunks are in flight.
+  WeightedSum(dtype, outbuf, sendbuf, entry.self_weight, {}, {}, num_elements);
+
+  std::vector<int> completed(num_slots);
+  std::vector<MPI_Status> statuses(num_slots);
+  int64_t num_reduced = 0;
+  while (num_reduced < num_messages) {
+    int outcount = 0;
+    int ret_code = MPI_Waitsome(num_slots, recv_requests.data(), &outcount,
+                                completed.data(), statuses.data());
+    if (ret_code != MPI_SUCCESS || outcount == MPI_UNDEFINED) {
+      throw std::runtime_error(
+          "MPI_Waitsome (for streaming neighbor_allreduce) failed, see MPI "
+          "output for details.");
+    }
+    for (int k = 0; k < outcount; ++k) {
+      int slot = completed[k];
+      int64_t chunk = slot_messages[slot] / nrecv;
+      int neighbor = slot_messages[slot] % nrecv;
+      char* outbuf_chunk = outbuf + chunk * chunk_bytes;
+      WeightedSum(dtype, outbuf_chunk, outbuf_chunk, 1.0,
+                  {staging + slot * chunk_bytes}, {recv_weights[neighbor]},
+                  ChunkLength(chunk));
+      num_reduced++;
+      if (next_message < num_messages) {
+        PostRecv(slot);
+      }
+    }
+  }
+
+  int ret_code =
+      MPI_Waitall(send_requests.size(), send_requests.data(), MPI_STATUSES_IGNORE);
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error(
+        "MPI_Isend (for streaming neighbor_allreduce) failed, see MPI "
+        "output for details.");
+  }
+}
+
+std::string MPIController::NeighborAllreduceCompressed(TensorTableEntry& entry) {
+  const float* input = static_cast<const float*>(entry.tensor->data());
+  float* output = (float*)entry.output->data();
+  const int64_t num_elements = entry.tensor->shape().num_elements();
+  MPI_Comm comm = mpi_ctx_.GetMPICommunicator(Communicator::GRAPH);
+  const int nrecv = entry.dynamic_neighbors_enabled
+                        ? entry.recv_neighbors->size()
+                        : mpi_ctx_.neighbor_in_ranks_.size();
+
+  std::unique_ptr<Compressor> compressor =
+      CreateCompressor(entry.compression, entry.compression_ratio);
+  const int64_t compressed_size = compressor->CompressedSize(num_elements);
+  if ((int64_t)compression_buffer_.size() < (nrecv + 1) * compressed_size) {
+    compression_buffer_.resize((nrecv + 1) * compressed_size);
+  }
+  char* sendbuf = compression_buffer_.data();
+  char* recvbuf = sendbuf + compressed_size;
+
+  if (compressor->NeedsErrorFeedback()) {
+    std::vector<float>& residual = compression_residuals_[entry.tensor_name];
+    if ((int64_t)residual.size() != num_elements) {
+      residual.assign(num_elements, 0.0f);
+    }
+    CompressWithErrorFeedback(*compressor, input, num_elements, &residual,
+                              &compression_scratch_, sendbuf);
+  } else {
+    compressor->Compress(input, num_elements, sendbuf);
+  }
+
+  std::string error_message = "";
+  if (!entry.dynamic_neighbors_enabled) {
+    int ret_code = MPI_Neighbor_allgather(sendbuf, (int)compressed_size,
+                                          MPI_BYTE, recvbuf,
+                                          (int)compressed_size, MPI_BYTE, comm);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Neighbor_allgather (for compressed neighbor_allreduce) failed, "
+          "see MPI output for details.");
+    }
+  } else {
+    int nsend = entry.send_neighbors->size();
+    std::vector<MPI_Request> requests(nsend + nrecv);
+    std::vector<MPI_Status> statuses(nsend + nrecv);
+    for (int i = 0; i < nrecv; ++i) {
+      int ret_code = MPI_Irecv(
+          recvbuf + i * compressed_size, (int)compressed_size, MPI_BYTE,
+          entry.recv_neighbors->at(i),
+          mpi_ctx_.rank_ + entry.recv_neighbors->at(i), comm,
+          &requests[i + nsend]);
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            "MPI_Irecv (for compressed neighbor_allreduce) failed, see MPI "
+            "output for details.");
+      }
+    }
+    for (int i = 0; i < nsend; ++i) {
+      int ret_code = MPI_Isend(
+          sendbuf, (int)compressed_size, MPI_BYTE, entry.send_neighbors->at(i),
+          mpi_ctx_.rank_ + entry.send_neighbors->at(i), comm, &requests[i]);
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            "MPI_Isend (for compressed neighbor_allreduce) failed, see MPI "
+            "output for details.");
+      }
+    }
+    MPI_Waitall(nsend + nrecv, requests.data(), statuses.data());
+    error_message =
+        GenerateNeighborAllreduceErrorMessage(statuses, nsend, nrecv);
+  }
+
+  // The output is laid out as if the tensors were received uncompressed, so
+  // the reduction afterwards is the same.
+  for (int i = 0; i < nrecv; ++i) {
+    compressor->Decompress(recvbuf + i * compressed_size, num_elements,
+                           output + i * num_elements);
+  }
+  return error_message;
+}
+
+namespace {
+
+// Makes the stores of every local rank before it visible to the loads of every
+// local rank after it.
+void SharedMemoryBarrier(MPI_Win win, MPI_Comm comm) {
+  MPI_Win_sync(win);
+  MPI_Barrier(comm);
+  MPI_Win_sync(win);
+}
+
+}  // namespace
+
+bool MPIController::UseHierarchicalSharedMemory(const TensorTableEntry& entry) {
+  return HIERARCHICAL_SHARED_MEMORY && entry.device == CPU_DEVICE_ID &&
+         WeightedSumSupported(entry.tensor->dtype());
+}
+
+bool MPIController::HierarchicalSharedMemoryEnabled() const {
+  return HIERARCHICAL_SHARED_MEMORY;
+}
+
+std::string MPIController::HierarchicalNeighborAllreduceShared(
+    const TensorTableEntry& entry, const void* sendbuf, int64_t num_elements,
+    const char*& local_sum, const char*& neighbor_data) {
+  const DataType dtype = entry.tensor->dtype();
+  const int element_size = mpi_ctx_.GetMPITypeSize(dtype);
+  const int64_t tensor_size = num_elements * element_size;
+  const int nrecv = entry.recv_neighbors->size();
+  const int local_size = mpi_ctx_.local_size_;
+  const int local_rank = mpi_ctx_.local_rank_;
+  MPI_Comm local_comm = mpi_ctx_.GetMPICommunicator(Communicator::LOCAL);
+  if (entry.send_neighbors->empty()) {
+    throw std::runtime_error(
+        "Under hierarchical neighbor_allreduce, argument "
+        "send_machine_neighbors should not be empty.");
+  }
+  if (local_size < 2) {
+    throw std::runtime_error(
+        "Local size is smaller than 2, in this case, you should use "
+        "neighbor_allreduce instead of hierarchical_neighbor_allreduce.");
+  }
+
+  // The local ranks come with the same tensor and machine neighbors, so they
+  // agree on when to grow the shared memory, which is collective.
+  const int64_t slot_size = (tensor_size + SHARED_WIN_ALIGNMENT - 1) /
+                            SHARED_WIN_ALIGNMENT * SHARED_WIN_ALIGNMENT;
+  const int64_t recv_size = tensor_size * nrecv;
+  if (slot_size > mpi_ctx_.hierarchical_slot_size_ ||
+      recv_size > mpi_ctx_.hierarchical_recv_size_) {
+    if (mpi_ctx_.hierarchical_shared_win != MPI_WIN_NULL) {
+      // The other local ranks may still be reading the last results.
+      MPI_Barrier(local_comm);
+      MPI_Win_unlock_all(mpi_ctx_.hierarchical_shared_win);
+      MPI_Win_free(&mpi_ctx_.hierarchical_shared_win);
+    }
+    mpi_ctx_.hierarchical_slot_size_ =
+        std::max(slot_size, mpi_ctx_.hierarchical_slot_size_);
+    mpi_ctx_.hierarchical_recv_size_ =
+        std::max(recv_size, mpi_ctx_.hierarchical_recv_size_);
+    MPI_Aint segment_size = mpi_ctx_.hierarchical_slot_size_;
+    if (local_rank == 0) {
+      segment_size += mpi_ctx_.hierarchical_slot_size_ +
+                      mpi_ctx_.hierarchical_recv_size_;
+    }
+    // Noncontiguous allocation lets every rank place its slot in the memory
+    // close to itself.
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    char* base = nullptr;
+    int ret_code =
+        MPI_Win_allocate_shared(segment_size, 1, info, local_comm, &base,
+                                &mpi_ctx_.hierarchical_shared_win);
+    MPI_Info_free(&info);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Win_allocate_shared (for hierarchical neighbor_allreduce) "
+          "failed, see MPI output for details.");
+    }
+    // The epoch stays open until the memory is freed, and MPI_Win_sync orders
+    // the stores and loads of the local ranks.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, mpi_ctx_.hierarchical_shared_win);
+    mpi_ctx_.hierarchical_shared_bases.resize(local_size);
+    for (int i = 0; i < local_size; i++) {
+      MPI_Aint size;
+      int disp_unit;
+      MPI_Win_shared_query(mpi_ctx_.hierarchical_shared_win, i, &size,
+                           &disp_unit, &mpi_ctx_.hierarchical_shared_bases[i]);
+    }
+  }
+  MPI_Win win = mpi_ctx_.hierarchical_shared_win;
+  const std::vector<char*>& bases = mpi_ctx_.hierarchical_shared_bases;
+  char* shared_sum = bases[0] + mpi_ctx_.hierarchical_slot_size_;
+  char* shared_recvbuf = shared_sum + mpi_ctx_.hierarchical_slot_size_;
+
+  // 1. Every local rank copies its tensor into its slot.
+  std::memcpy(bases[local_rank], sendbuf, tensor_size);
+  SharedMemoryBarrier(win, local_comm);
+
+  // 2. Every local rank sums one slice of the slots. The slices start at cache
+  // lines, so no two ranks write the same line.
+  const int64_t line_elements = SHARED_WIN_ALIGNMENT / element_size;
+  int64_t slice_elements = (num_elements + local_size - 1) / local_size;
+  slice_elements =
+      (slice_elements + line_elements - 1) / line_elements * line_elements;
+  const int64_t begin = std::min(num_elements, slice_elements * local_rank);
+  const int64_t end = std::min(num_elements, begin + slice_elements);
+  if (begin < end) {
+    const int64_t offset = begin * element_size;
+    std::vector<const void*> srcs;
+    for (int i = 1; i < local_size; i++) {
+      srcs.push_back(bases[i] + offset);
+    }
+    std::vector<double> weights(local_size - 1, 1.0);
+    WeightedSum(dtype, shared_sum + offset, bases[0] + offset, 1.0, srcs,
+                weights, end - begin);
+  }
+  SharedMemoryBarrier(win, local_comm);
+
+  // 3. Local rank 0 sends the local sum to the machine neighbors and receives
+  // theirs into the shared memory.
+  std::string error_message = "";
+  if (local_rank == 0) {
+    int nsend = entry.send_neighbors->size();
+    std::vector<MPI_Request> requests(nsend + nrecv);
+    std::vector<MPI_Status> statuses(nsend + nrecv);
+    for (int i = 0; i < nrecv; ++i) {
+      int ret_code = MPI_Irecv(
+          shared_recvbuf + i * tensor_size, num_elements,
+          mpi_ctx_.GetMPIDataType(entry.output), entry.recv_neighbors->at(i),
+          mpi_ctx_.rank_ + entry.recv_neighbors->at(i),
+          mpi_ctx_.GetMPICommunicator(Communicator::GRAPH),
+          &requests[i + nsend]);
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            "MPI_Irecv (for hierarchical neighbor_allreduce) failed, see MPI "
+            "output for details.");
+      }
+    }
+    for (int i = 0; i < nsend; ++i) {
+      int ret_code = MPI_Isend(
+          shared_sum, num_elements, mpi_ctx_.GetMPIDataType(entry.tensor),
+          entry.send_neighbors->at(i),
+          mpi_ctx_.rank_ + entry.send_neighbors->at(i),
+          mpi_ctx_.GetMPICommunicator(Communicator::GRAPH), &requests[i]);
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            "MPI_Isend (for hierarchical neighbor_allreduce) failed, see MPI "
+            "output for details.");
+      }
+    }
+    MPI_Waitall(nsend + nrecv, requests.data(), statuses.data());
+    error_message =
+        GenerateNeighborAllreduceErrorMessage(statuses, nsend, nrecv);
+  }
+  SharedMemoryBarrier(win, local_comm);
+
+  // 4. Every local rank reads the results from the shared memory. They are
+  // only written again after the barrier of step 1 of the next call.
+  local_sum = shared_sum;
+  neighbor_data = shared_recvbuf;
+  return error_message;
+}
+
+void MPIController::ReduceHierarchicalSharedNeighbors(
+    const TensorTableEntry& entry, void* output, const char* local_sum,
+    const char* neighbor_data, int64_t stride, int64_t count) {
+  // Both the local sum and the received tensors are sums over the local ranks.
+  const double local_size = mpi_ctx_.local_size_;
+  const int nrecv = entry.recv_neighbors->size();
+  std::vector<const void*> srcs(nrecv);
+  std::vector<double> weights(nrecv, 0.0);
+  for (int i = 0; i < nrecv; ++i) {
+    srcs[i] = neighbor_data + i * stride;
+    auto it = entry.src_weights.find(entry.recv_neighbors->at(i));
+    if (it != entry.src_weights.end()) {
+      weights[i] = it->second / local_size;
+    }
+  }
+  WeightedSum(entry.tensor->dtype(), output, local_sum,
+              entry.self_weight / local_size, srcs, weights, count);
+}
+
 void MPIController::NeighborAllreduce(TensorTableEntry& entry) {
   const void* sendbuf = entry.tensor->data();
   int num_elements = entry.tensor->shape().num_elements();
@@ -403,7 +864,11 @@ void MPIController::NeighborAllreduce(TensorTableEntry& entry) {
   // including itself is more intuitive.
   std::string error_message = "";
 
-  if (!entry.is_hierarchical) {
+  if (entry.compression != CompressionType::NONE) {
+    error_message = NeighborAllreduceCompressed(entry);
+  } else if (entry.streaming_reduce && !entry.is_hierarchical) {
+    NeighborAllreduceStreaming(entry);
+  } else if (!entry.is_hierarchical) {
     if (!entry.dynamic_neighbors_enabled) {
       int ret_code = MPI_Neighbor_allgather(
           sendbuf, num_elements, mpi_ctx_.GetMPIDataType(entry.tensor),
@@ -452,6 +917,24 @@ void MPIController::NeighborAllreduce(TensorTableEntry& entry) {
       error_message =
           GenerateNeighborAllreduceErrorMessage(statuses, nsend, nrecv);
     }
+  } else if (entry.streaming_reduce || UseHierarchicalSharedMemory(entry)) {
+    const char* local_sum = nullptr;
+    const char* neighbor_data = nullptr;
+    error_message = HierarchicalNeighborAllreduceShared(
+        entry, sendbuf, num_elements, local_sum, neighbor_data);
+    const int64_t tensor_size = entry.tensor->size();
+    if (entry.streaming_reduce) {
+      // The output is reduced straight from the shared memory.
+      ReduceHierarchicalSharedNeighbors(entry, buffer_data, local_sum,
+                                        neighbor_data, tensor_size,
+                                        num_elements);
+    } else {
+      // The callback reduces the copies, like the allreduce and broadcast of
+      // the path without the shared memory leave them.
+      std::memcpy((void*)sendbuf, local_sum, tensor_size);
+      std::memcpy(buffer_data, neighbor_data,
+                  tensor_size * entry.recv_neighbors->size());
+    }
   } else {
     if (entry.send_neighbors->empty()) {
       throw std::runtime_error(
@@ -531,8 +1014,14 @@ void MPIController::Allreduce(std::vector<TensorTableEntry>& entries) {
   void* buffer_data;
   size_t buffer_len = 0;
   int64_t num_elements = 0;
+  int64_t fused_size = 0;
   for (auto& e : entries) {
     num_elements += e.tensor->shape().num_elements();
+    fused_size += e.tensor->size();
+  }
+  if (FUSION_CHUNK_SIZE > 0 && fused_size > FUSION_CHUNK_SIZE) {
+    AllreduceWithPipeline(entries);
+    return;
   }
   Timeline* timeline_ptr;
   GetBluefogTimeline(timeline_ptr);
@@ -565,6 +1054,103 @@ void MPIController::Allreduce(std::vector<TensorTableEntry>& entries) {
   }
 }
 
+void MPIController::AllreduceWithPipeline(std::vector<TensorTableEntry>& entries) {
+  auto& first_entry = entries[0];
+  Timeline* timeline_ptr;
+  GetBluefogTimeline(timeline_ptr);
+  FusionBufferManager* buffer_manager;
+  auto fusion_status = GetBluefogFusionBuffer(buffer_manager);
+  if (!fusion_status.ok()) {
+    throw std::runtime_error(fusion_status.reason());
+  }
+  uint8_t* buffer_data = (uint8_t*)const_cast<void*>(
+      buffer_manager->GetBuffer(first_entry.device)
+          ->AccessData(first_entry.context));
+
+  // Offset of each tensor in the fused payload, the last one is its size.
+  std::vector<int64_t> offsets(entries.size() + 1, 0);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    offsets[i + 1] = offsets[i] + entries[i].tensor->size();
+  }
+  const int64_t fused_size = offsets.back();
+  const int element_size = mpi_ctx_.GetMPITypeSize(first_entry.tensor->dtype());
+  const int64_t chunk_size =
+      std::max<int64_t>(FUSION_CHUNK_SIZE / element_size, 1) * element_size;
+  const int num_chunks = (int)((fused_size + chunk_size - 1) / chunk_size);
+
+  // Copy the bytes [begin, end) of the fused payload between the fusion
+  // buffer and the tensors, which may span several tensors.
+  auto CopyChunk = [&](int64_t begin, int64_t end, bool copy_in) {
+    size_t i = std::upper_bound(offsets.begin(), offsets.end(), begin) -
+               offsets.begin() - 1;
+    for (; i < entries.size() && offsets[i] < end; ++i) {
+      auto& e = entries[i];
+      int64_t copy_begin = std::max(begin, offsets[i]);
+      int64_t copy_end = std::min(end, offsets[i + 1]);
+      size_t count = (size_t)(copy_end - copy_begin);
+      int64_t tensor_offset = copy_begin - offsets[i];
+      if (copy_in) {
+        MemcpyWithDevice(buffer_data + copy_begin,
+                         (const uint8_t*)e.tensor->data() + tensor_offset,
+                         count, e.device);
+      } else {
+        MemcpyWithDevice((uint8_t*)e.output->data() + tensor_offset,
+                         buffer_data + copy_begin, count, e.device);
+      }
+    }
+  };
+
+  // Here is_hierarchical == true means local allreduce.
+  auto communicator_type =
+      first_entry.is_hierarchical ? Communicator::LOCAL : Communicator::GLOBAL;
+  std::vector<MPI_Request> requests(num_chunks, MPI_REQUEST_NULL);
+  int num_done = 0;
+  auto FinishChunk = [&](int k) {
+    int ret_code = MPI_Wait(&requests[k], MPI_STATUS_IGNORE);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Iallreduce failed, see MPI output for details.");
+    }
+    CopyChunk(k * chunk_size, std::min(fused_size, (k + 1) * chunk_size),
+              /*copy_in=*/false);
+  };
+
+  // The chunk k + 1 is copied in and the chunks before k are copied out while
+  // the chunk k is being reduced.
+  timeline_ptr->ActivityStartAll(entries, "PIPELINED_ALLREDUCE");
+  for (int k = 0; k < num_chunks; ++k) {
+    int64_t begin = k * chunk_size;
+    int64_t end = std::min(fused_size, begin + chunk_size);
+    CopyChunk(begin, end, /*copy_in=*/true);
+    int ret_code = MPI_Iallreduce(
+        MPI_IN_PLACE, buffer_data + begin, (int)((end - begin) / element_size),
+        mpi_ctx_.GetMPIDataType(first_entry.tensor),
+        mpi_ctx_.GetMPISumOp(first_entry.tensor->dtype()),
+        mpi_ctx_.GetMPICommunicator(communicator_type), &requests[k]);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Iallreduce failed, see MPI output for details.");
+    }
+    // Testing the requests also drives the progress of the reduction.
+    while (num_done < k) {
+      int flag = 0;
+      MPI_Test(&requests[num_done], &flag, MPI_STATUS_IGNORE);
+      if (!flag && k - num_done < FUSION_PIPELINE_DEPTH) {
+        break;
+      }
+      FinishChunk(num_done++);
+    }
+  }
+  while (num_done < num_chunks) {
+    FinishChunk(num_done++);
+  }
+  timeline_ptr->ActivityEndAll(entries);
+
+  for (auto& e : entries) {
+    e.callback(Status::OK());
+  }
+}
+
 // TODO: reuse the code of NeighborAllreduce without fusion.
 void MPIController::NeighborAllreduce(std::vector<TensorTableEntry>& entries) {
   auto& first_entry = entries[0];
@@ -662,6 +1248,29 @@ void MPIController::NeighborAllreduce(std::vector<TensorTableEntry>& entries) {
       error_message =
           GenerateNeighborAllreduceErrorMessage(statuses, nsend, nrecv);
     }
+  } else if (first_entry.streaming_reduce ||
+             UseHierarchicalSharedMemory(first_entry)) {
+    const char* local_sum = nullptr;
+    const char* neighbor_data = nullptr;
+    error_message = HierarchicalNeighborAllreduceShared(
+        first_entry, fused_input_data, num_elements, local_sum, neighbor_data);
+    const int64_t fused_size = num_elements * element_size;
+    if (first_entry.streaming_reduce) {
+      // Every output is reduced straight from its part of the shared memory.
+      int64_t offset = 0;
+      for (auto& e : entries) {
+        ReduceHierarchicalSharedNeighbors(
+            e, (void*)e.output->data(), local_sum + offset,
+            neighbor_data + offset, fused_size,
+            e.tensor->shape().num_elements());
+        offset += e.tensor->size();
+      }
+    } else {
+      std::memcpy((void*)fused_input_data, local_sum, fused_size);
+      std::memcpy(buffer_data, neighbor_data,
+                  fused_size * first_entry.recv_neighbors->size());
+      MemcpyOutFusionBufferForInputs(fused_input_data, entries);
+    }
   } else {
     if (first_entry.send_neighbors->empty()) {
       throw std::runtime_error(
@@ -727,14 +1336,17 @@ void MPIController::NeighborAllreduce(std::vector<TensorTableEntry>& entries) {
   timeline_ptr->ActivityEndAll(entries);
 
   // Remember buffer_data is already pointed at offset location (after self tensor).
-  timeline_ptr->ActivityStartAll(entries, "MEMCPY_OUT_FUSION_BUFFER");
-  int num_recv_neighbors = !first_entry.dynamic_neighbors_enabled
-                           ? mpi_ctx_.neighbor_indgree_
-                           : first_entry.recv_neighbors->size();
-  MemcpyOutFusionBufferForNeighbors(
-      buffer_data, entries, num_recv_neighbors,
-      /*fused_data_size=*/ num_elements * element_size);
-  timeline_ptr->ActivityEndAll(entries);
+  // The outputs reduced in place have nothing to copy out.
+  if (!first_entry.streaming_reduce) {
+    timeline_ptr->ActivityStartAll(entries, "MEMCPY_OUT_FUSION_BUFFER");
+    int num_recv_neighbors = !first_entry.dynamic_neighbors_enabled
+                             ? mpi_ctx_.neighbor_indgree_
+                             : first_entry.recv_neighbors->size();
+    MemcpyOutFusionBufferForNeighbors(
+        buffer_data, entries, num_recv_neighbors,
+        /*fused_data_size=*/ num_elements * element_size);
+    timeline_ptr->ActivityEndAll(entries);
+  }
 
   for (auto& e : entries) {
     if (error_message != "") {
@@ -745,6 +1357,217 @@ void MPIController::NeighborAllreduce(std::vector<TensorTableEntry>& entries) {
   }
 }
 
+void MPIController::Broadcast(std::vector<TensorTableEntry>& entries) {
+  auto& first_entry = entries[0];
+  with_device device_guard(first_entry.device);
+
+  const int root_rank = first_entry.root_rank;
+  void* buffer_data;
+  size_t buffer_len = 0;
+  Timeline* timeline_ptr;
+  GetBluefogTimeline(timeline_ptr);
+
+  // The output of root rank is not allocated so only root rank copies the
+  // tensors into the fusion buffer and only the other ranks copy them out.
+  if (mpi_ctx_.rank_ == root_rank) {
+    timeline_ptr->ActivityStartAll(entries, "MEMCPY_IN_FUSION_BUFFER");
+    MemcpyInFusionBuffer(entries, buffer_data, buffer_len);
+    timeline_ptr->ActivityEndAll(entries);
+  } else {
+    FusionBufferManager* buffer_manager;
+    GetBluefogFusionBuffer(buffer_manager);
+    buffer_data = const_cast<void*>(
+        buffer_manager->GetBuffer(first_entry.device)
+            ->AccessData(first_entry.context));
+  }
+  int64_t num_elements = 0;
+  for (auto& e : entries) {
+    num_elements += e.tensor->shape().num_elements();
+  }
+
+  timeline_ptr->ActivityStartAll(entries, "COMMUNICATE");
+  int ret_code =
+      MPI_Bcast(buffer_data, num_elements,
+                mpi_ctx_.GetMPIDataType(first_entry.tensor), root_rank,
+                mpi_ctx_.GetMPICommunicator(Communicator::GLOBAL));
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error("MPI_Bcast failed, see MPI output for details.");
+  }
+  timeline_ptr->ActivityEndAll(entries);
+
+  if (mpi_ctx_.rank_ != root_rank) {
+    timeline_ptr->ActivityStartAll(entries, "MEMCPY_OUT_FUSION_BUFFER");
+    MemcpyOutFusionBuffer(buffer_data, entries);
+    timeline_ptr->ActivityEndAll(entries);
+  }
+
+  for (auto& e : entries) {
+    e.callback(Status::OK());
+  }
+}
+
+void MPIController::Allgather(std::vector<TensorTableEntry>& entries) {
+  AllgathervWithFusion(entries, Communicator::GLOBAL);
+}
+
+void MPIController::NeighborAllgather(std::vector<TensorTableEntry>& entries) {
+  if (!mpi_ctx_.IsTopoSetup()) {
+    throw std::runtime_error("Topology of MPI has not been set yet.");
+  }
+  AllgathervWithFusion(entries, Communicator::GRAPH);
+}
+
+void MPIController::AllgathervWithFusion(std::vector<TensorTableEntry>& entries,
+                                         Communicator comm_type) {
+  auto& first_entry = entries[0];
+  with_device device_guard(first_entry.device);
+  Timeline* timeline_ptr;
+  GetBluefogTimeline(timeline_ptr);
+
+  // The first dimensions of all tensors are exchanged in one call instead of
+  // one call per tensor.
+  std::vector<int> first_dims;
+  Status status = mpi_ctx_.AllocateOutputs(entries, first_dims, comm_type);
+  if (!status.ok()) {
+    for (auto& e : entries) {
+      e.callback(status);
+    }
+    return;
+  }
+
+  int num_entries = (int)entries.size();
+  int cnt_size = (int)first_dims.size() / num_entries;
+  int element_size = mpi_ctx_.GetMPITypeSize(first_entry.tensor->dtype());
+  // Number of elements of one slice along the first dimension.
+  std::vector<int64_t> slice_elements(num_entries);
+  int64_t num_elements = 0;
+  for (int i = 0; i < num_entries; ++i) {
+    auto& e = entries[i];
+    int64_t dim0 = e.tensor->shape().dim_size(0);
+    slice_elements[i] =
+        dim0 == 0 ? 0 : e.tensor->shape().num_elements() / dim0;
+    num_elements += e.tensor->shape().num_elements();
+  }
+  std::vector<int> recvcounts(cnt_size, 0);
+  std::vector<int> displcmnts(cnt_size, 0);
+  int64_t num_recv_elements = 0;
+  for (int rc = 0; rc < cnt_size; ++rc) {
+    int64_t count = 0;
+    for (int i = 0; i < num_entries; ++i) {
+      count += first_dims[rc * num_entries + i] * slice_elements[i];
+    }
+    recvcounts[rc] = (int)count;
+    displcmnts[rc] = (int)num_recv_elements;
+    num_recv_elements += count;
+  }
+
+  MPI_Comm comm = mpi_ctx_.GetMPICommunicator(comm_type);
+  auto Allgatherv = [comm_type, comm](const void* sendbuf, int sendcount,
+                                      MPI_Datatype sendtype, void* recvbuf,
+                                      const int* counts, const int* displs,
+                                      MPI_Datatype recvtype) {
+    int ret_code;
+    if (comm_type == Communicator::GLOBAL) {
+      ret_code = MPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, counts,
+                                displs, recvtype, comm);
+    } else {
+      // Pitfall: mpi_neighbor_allgather do not include itself.
+      ret_code = MPI_Neighbor_allgatherv(sendbuf, sendcount, sendtype, recvbuf,
+                                         counts, displs, recvtype, comm);
+    }
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Allgatherv (or MPI_Neighbor_allgatherv) failed, see MPI output "
+          "for details.");
+    }
+  };
+
+  FusionBufferManager* buffer_manager;
+  GetBluefogFusionBuffer(buffer_manager);
+  // The size of tensors on other ranks are unknown when fusing the responses.
+  // If the gathered tensors don't fit in the fusion buffer, gather them one by
+  // one into the outputs directly, which still saves the calls to exchange the
+  // first dimensions. All the ranks have to take the same path since the calls
+  // are collective.
+  int fits_in_buffer;
+  if (comm_type == Communicator::GLOBAL) {
+    // Every rank knows the sizes of all the ranks, so the largest one is
+    // assumed to be sent to come to the same answer.
+    int64_t max_send_elements =
+        *std::max_element(recvcounts.begin(), recvcounts.end());
+    fits_in_buffer = (max_send_elements + num_recv_elements) * element_size <=
+                     buffer_manager->GetBufferSize(first_entry.device);
+  } else {
+    // The in-neighbors differ among the ranks, so they agree on whether all of
+    // them fit.
+    fits_in_buffer = (num_elements + num_recv_elements) * element_size <=
+                     buffer_manager->GetBufferSize(first_entry.device);
+    int ret_code = MPI_Allreduce(MPI_IN_PLACE, &fits_in_buffer, 1, MPI_INT,
+                                 MPI_MIN, comm);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          "MPI_Allreduce (for fused neighbor_allgather) failed, see MPI output "
+          "for details.");
+    }
+  }
+  if (!fits_in_buffer) {
+    timeline_ptr->ActivityStartAll(entries, "COMMUNICATE");
+    std::vector<int> counts(cnt_size);
+    std::vector<int> displs(cnt_size);
+    for (int i = 0; i < num_entries; ++i) {
+      auto& e = entries[i];
+      int64_t displ = 0;
+      for (int rc = 0; rc < cnt_size; ++rc) {
+        counts[rc] = (int)(first_dims[rc * num_entries + i] * slice_elements[i]);
+        displs[rc] = (int)displ;
+        displ += counts[rc];
+      }
+      Allgatherv(e.tensor->data(), (int)e.tensor->shape().num_elements(),
+                 mpi_ctx_.GetMPIDataType(e.tensor), (void*)e.output->data(),
+                 counts.data(), displs.data(), mpi_ctx_.GetMPIDataType(e.output));
+    }
+    timeline_ptr->ActivityEndAll(entries);
+  } else {
+    // The storage in fusion buffer is like
+    // [t_1, t_2 | t_1_r1, t_2_r1, t_1_r2, t_2_r2].
+    // Here t_1 and t_2 means self tensor 1 and 2 and _r1 and _r2 means the
+    // receiving tensors from rank (or in-neighbor) 1 and 2.
+    void* buffer_data;
+    size_t buffer_len = 0;
+    timeline_ptr->ActivityStartAll(entries, "MEMCPY_IN_FUSION_BUFFER");
+    MemcpyInFusionBuffer(entries, buffer_data, buffer_len);
+    timeline_ptr->ActivityEndAll(entries);
+    void* recv_data = (uint8_t*)buffer_data + buffer_len;
+
+    timeline_ptr->ActivityStartAll(entries, "COMMUNICATE");
+    Allgatherv(buffer_data, (int)num_elements,
+               mpi_ctx_.GetMPIDataType(first_entry.tensor), recv_data,
+               recvcounts.data(), displcmnts.data(),
+               mpi_ctx_.GetMPIDataType(first_entry.tensor));
+    timeline_ptr->ActivityEndAll(entries);
+
+    timeline_ptr->ActivityStartAll(entries, "MEMCPY_OUT_FUSION_BUFFER");
+    std::vector<int64_t> output_offsets(num_entries, 0);
+    int64_t offset = 0;
+    for (int rc = 0; rc < cnt_size; ++rc) {
+      for (int i = 0; i < num_entries; ++i) {
+        auto& e = entries[i];
+        size_t count = (size_t)(first_dims[rc * num_entries + i] *
+                                slice_elements[i] * element_size);
+        MemcpyWithDevice((uint8_t*)e.output->data() + output_offsets[i],
+                         (uint8_t*)recv_data + offset, count, e.device);
+        output_offsets[i] += count;
+        offset += count;
+      }
+    }
+    timeline_ptr->ActivityEndAll(entries);
+  }
+
+  for (auto& e : entries) {
+    e.callback(Status::OK());
+  }
+}
+
 void MPIController::PairGossip(TensorTableEntry& entry) {
   const void* sendbuf = entry.tensor->data();
   void* recvbuf = (void*)entry.output->data();
@@ -824,44 +1647,131 @@ void MPIController::WinCreate(TensorTableEntry& entry) {
                  global_mpi_win_ptr.get());
   win_manager->SetGlobalWin(global_mpi_win_ptr);
 
-  // Build extra buffers for win_put.
+  // Build the window of the neighbor tensors for win_put and win_accumulate.
+  // Every rank attaches the tensors of its in-neighbors to one dynamic
+  // window, then tells each in-neighbor where its tensor is, so the senders
+  // know the target displacements.
   // For example: size=4 exponential two ring topology
   // r\s   0    1    2    3
-  //  0    g    x         x
-  //  1    x    g    x
-  //  2         x    g    x
-  //  3    x         x    g
-  //  The following for-loop scans along columns
-  //  and the self-rank determines the rows.
-  //  If there is connection, the window is associated with the
-  //  neighbor_tensors. Otherwise, window is associated with null pointer.
-  std::shared_ptr<MPI_Win> mpi_win_ptr;
+  //  0         x         x
+  //  1    x         x
+  //  2         x         x
+  //  3    x         x
+  //  Rank r attaches the tensors of the columns marked in row r, and rank s
+  //  learns the addresses of the rows marked in column s.
+  auto neighbor_win_ptr = std::make_shared<MPI_Win>();
+  MPI_Win_create_dynamic(MPI_INFO_NULL,
+                         mpi_ctx_.GetMPICommunicator(Communicator::GLOBAL),
+                         neighbor_win_ptr.get());
+  win_manager->SetNeighborWin(neighbor_win_ptr);
+  win_manager->SetCompression(entry.compression, entry.compression_ratio);
+  bool compressed_put = entry.compression == CompressionType::FP16 ||
+                        entry.compression == CompressionType::INT8;
+  int64_t payload_size = 0;
+  if (compressed_put) {
+    // The compressed payloads for win_put are received in separate buffers.
+    std::unique_ptr<Compressor> compressor =
+        CreateCompressor(entry.compression, entry.compression_ratio);
+    payload_size = COMPRESSED_WIN_HEADER_SIZE +
+                   compressor->CompressedSize(tensor->shape().num_elements());
+  } else if (entry.compression == CompressionType::TOPK) {
+    // The copy of the tensor of the sender is not changed by this rank, so it
+    // always holds what the sender keeps as its replica.
+    payload_size = COMPRESSED_WIN_HEADER_SIZE + tensor->size();
+  }
+
+  // The in-neighbors on the same node write into a window of shared memory
+  // instead, where every rank allocates one buffer per such in-neighbor. It
+  // is collective over the node, so the condition has to be the same on all
+  // the ranks.
+  std::unordered_map<int, int> local_ranks;
+  if (WIN_SHARED_MEMORY && entry.device == CPU_DEVICE_ID &&
+      entry.compression == CompressionType::NONE &&
+      mpi_ctx_.local_size_ > 1 && WeightedSumSupported(tensor->dtype())) {
+    for (int i = 0; i < mpi_ctx_.local_size_; i++) {
+      local_ranks[mpi_ctx_.local_comm_ranks_[i]] = i;
+    }
+  }
+  const int64_t shared_buffer_size =
+      (tensor->size() + SHARED_WIN_ALIGNMENT - 1) / SHARED_WIN_ALIGNMENT *
+      SHARED_WIN_ALIGNMENT;
+  char* shared_base = nullptr;
+  if (!local_ranks.empty()) {
+    int num_local_in_ranks = 0;
+    for (int rank : mpi_ctx_.neighbor_in_ranks_) {
+      if (rank != mpi_ctx_.rank_ && local_ranks.count(rank) > 0) {
+        num_local_in_ranks++;
+      }
+    }
+    // Noncontiguous allocation lets every rank place its part in the memory
+    // close to itself.
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    auto shared_win_ptr = std::make_shared<MPI_Win>();
+    MPI_Win_allocate_shared(num_local_in_ranks * shared_buffer_size, 1, info,
+                            mpi_ctx_.local_comm, &shared_base,
+                            shared_win_ptr.get());
+    MPI_Info_free(&info);
+    // The epoch stays open until the window is freed, and MPI_Win_sync orders
+    // the stores and loads of the ranks.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *shared_win_ptr);
+    win_manager->SetSharedWin(shared_win_ptr);
+  }
+
+  // Two addresses per rank: the neighbor tensor and the compressed buffer.
+  // The address of a tensor in the shared window is its offset instead.
+  std::vector<MPI_Aint> send_disps(2 * mpi_ctx_.size_, 0);
+  std::vector<MPI_Aint> recv_disps(2 * mpi_ctx_.size_, 0);
+  // The neighbor tensors follow the ascending order of the in-neighbors.
+  std::vector<int> in_ranks = mpi_ctx_.neighbor_in_ranks_;
+  std::sort(in_ranks.begin(), in_ranks.end());
   int neighbor_tensor_index = 0;
-  for (int rank = 0; rank < mpi_ctx_.size_; rank++) {
-    auto mpi_win_ptr = std::make_shared<MPI_Win>();
-    std::shared_ptr<Tensor> t = nullptr;
-    if (rank == mpi_ctx_.rank_) {
-      // Sender (no need to allocate the memory with it.)
-      data_buf = nullptr;
-      element_size = 1;
-      win_size = 0;
-    } else if (std::find(mpi_ctx_.neighbor_in_ranks_.begin(), mpi_ctx_.neighbor_in_ranks_.end(),
-                         rank) != mpi_ctx_.neighbor_in_ranks_.end()) {
-      // Receiver
-      t = neighbor_tensors[neighbor_tensor_index++];
-      data_buf = (void*)t->data();
-      element_size = mpi_ctx_.GetMPITypeSize(t->dtype());
-      win_size = (t->shape().num_elements()) * element_size;
-    } else {
-      // Just participate in a collective call.
-      data_buf = nullptr;
-      element_size = 1;
-      win_size = 0;
+  MPI_Aint shared_offset = 0;
+  for (int rank : in_ranks) {
+    if (rank == mpi_ctx_.rank_) continue;
+    std::shared_ptr<Tensor> neighbor_tensor =
+        neighbor_tensors[neighbor_tensor_index++];
+    if (local_ranks.count(rank) > 0) {
+      void* buffer = shared_base + shared_offset;
+      std::memcpy(buffer, neighbor_tensor->data(), neighbor_tensor->size());
+      win_manager->SetSharedNeighborTensor(rank, neighbor_tensor, buffer);
+      send_disps[2 * rank] = shared_offset;
+      shared_offset += shared_buffer_size;
+      continue;
+    }
+    win_manager->AttachNeighborTensor(rank, neighbor_tensor);
+    MPI_Get_address(win_manager->GetAssociateTensorByRank(rank)->data(),
+                    &send_disps[2 * rank]);
+    if (payload_size > 0) {
+      win_manager->AttachCompressedBuffer(rank, payload_size);
+      MPI_Get_address(win_manager->GetCompressedBufferByRank(rank),
+                      &send_disps[2 * rank + 1]);
+    }
+  }
+  int ret_code = MPI_Alltoall(send_disps.data(), 2, MPI_AINT, recv_disps.data(),
+                              2, MPI_AINT,
+                              mpi_ctx_.GetMPICommunicator(Communicator::GLOBAL));
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error(
+        "MPI_Alltoall failed, see MPI output for details.");
+  }
+  for (int rank : mpi_ctx_.neighbor_out_ranks_) {
+    if (rank == mpi_ctx_.rank_) continue;
+    auto local_it = local_ranks.find(rank);
+    if (local_it != local_ranks.end()) {
+      MPI_Aint size;
+      int disp_unit;
+      char* base = nullptr;
+      MPI_Win_shared_query(*(win_manager->GetSharedWin()), local_it->second,
+                           &size, &disp_unit, &base);
+      win_manager->SetSharedTargetPtr(rank, base + recv_disps[2 * rank]);
+      continue;
+    }
+    win_manager->SetTargetDisp(rank, recv_disps[2 * rank]);
+    if (payload_size > 0) {
+      win_manager->SetCompressedTargetDisp(rank, recv_disps[2 * rank + 1]);
     }
-    MPI_Win_create(data_buf, win_size, element_size, MPI_INFO_NULL,
-                   mpi_ctx_.GetMPICommunicator(Communicator::GLOBAL),
-                   mpi_win_ptr.get());
-    win_manager->PushBackWinAndTensor(mpi_win_ptr, t);
   }
   timeline_ptr->ActivityEnd(name);
 
@@ -887,20 +1797,73 @@ void MPIController::WinFreeAll(TensorTableEntry& entry) {
   entry.callback(Status::OK());
 }
 
-Status MPIController::WinSync(const std::string& name, int device, bool with_associated_p) {
+Status MPIController::WinSync(const std::string& name, int device,
+                              bool with_associated_p,
+                              const std::vector<int>& versions) {
   auto it = mpi_ctx_.named_win_map.find(name);
   if (it == mpi_ctx_.named_win_map.end()) {
     return Status::InvalidArgument(std::string("Win_sync failed with ") + name);
   }
+  // The neighbors update the version after their data is complete here, so
+  // the versions taken before the data is synced only count the data synced.
+  // What arrives in between is counted again by the next win_sync.
+  VersionWinClear(name, versions);
 
   with_device device_guard(device);
   auto win_mananger = it->second;
-  for (auto rank : mpi_ctx_.neighbor_in_ranks_) {
-    auto mpi_win_ptr = win_mananger->GetWinByRank(rank);
-    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpi_ctx_.rank_, MPI_MODE_NOCHECK, *mpi_win_ptr);
-    MPI_Win_sync(*mpi_win_ptr);
-    MPI_Win_unlock(mpi_ctx_.rank_, *mpi_win_ptr);
+  MPI_Win neighbor_win = *(win_mananger->GetNeighborWin());
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpi_ctx_.rank_, MPI_MODE_NOCHECK,
+               neighbor_win);
+  MPI_Win_sync(neighbor_win);
+  if (win_mananger->GetSharedWin()) {
+    MPI_Win_sync(*(win_mananger->GetSharedWin()));
+  }
+  // Copy the payloads put since the last win_sync into the neighbor tensors,
+  // so the averaging afterwards sees them as usual.
+  CompressionType compression = win_mananger->GetCompression();
+  if (compression == CompressionType::TOPK) {
+    for (auto rank : mpi_ctx_.neighbor_in_ranks_) {
+      char* buffer = win_mananger->GetCompressedBufferByRank(rank);
+      int sequence = *reinterpret_cast<volatile int*>(buffer);
+      int& synced_sequence = win_mananger->GetSyncedPutSequence(rank);
+      if (sequence != synced_sequence) {
+        auto tensor = win_mananger->GetAssociateTensorByRank(rank);
+        std::memcpy((void*)tensor->data(), buffer + COMPRESSED_WIN_HEADER_SIZE,
+                    tensor->size());
+        synced_sequence = sequence;
+      }
+    }
+  } else if (compression == CompressionType::FP16 ||
+             compression == CompressionType::INT8) {
+    std::unique_ptr<Compressor> compressor =
+        CreateCompressor(compression, win_mananger->GetCompressionRatio());
+    for (auto rank : mpi_ctx_.neighbor_in_ranks_) {
+      char* buffer = win_mananger->GetCompressedBufferByRank(rank);
+      volatile int* sequence = reinterpret_cast<volatile int*>(buffer);
+      int& synced_sequence = win_mananger->GetSyncedPutSequence(rank);
+      auto tensor = win_mananger->GetAssociateTensorByRank(rank);
+      // The sender does not hold the mutex unless asked to, so a payload
+      // decompressed while the next one is written is decompressed again.
+      int begin = *sequence;
+      while (begin != synced_sequence) {
+        if (begin % 2 == 0) {
+          compressor->Decompress(buffer + COMPRESSED_WIN_HEADER_SIZE,
+                                 tensor->shape().num_elements(),
+                                 (float*)tensor->data());
+          MPI_Win_sync(neighbor_win);
+          if (*sequence == begin) {
+            synced_sequence = begin;
+            break;
+          }
+        } else {
+          std::this_thread::yield();
+          MPI_Win_sync(neighbor_win);
+        }
+        begin = *sequence;
+      }
+    }
   }
+  MPI_Win_unlock(mpi_ctx_.rank_, neighbor_win);
   if (with_associated_p) {
     auto p_win_ptr = win_mananger->GetPWin();
     MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpi_ctx_.rank_, MPI_MODE_NOCHECK,
@@ -909,8 +1872,6 @@ Status MPIController::WinSync(const std::string& name, int device, bool with_ass
     MPI_Win_unlock(mpi_ctx_.rank_, *p_win_ptr);
   }
 
-  VersionWinClear(name);
-
   return Status::OK();
 }
 
@@ -921,9 +1882,7 @@ Status MPIController::WinFence(const std::string& name) {
   }
 
   std::shared_ptr<WindowManager> win_mananger = it->second;
-  for (int rank = 0; rank < mpi_ctx_.size_; rank++) {
-    MPI_Win_fence(0, *(win_mananger->GetWinByRank(rank)));
-  }
+  MPI_Win_fence(0, *(win_mananger->GetNeighborWin()));
 
   return Status::OK();
 }
@@ -962,7 +1921,7 @@ void MPIController::WinPut(TensorTableEntry& entry) {
                              " in (MPI) registered win name.");
   }
   std::shared_ptr<WindowManager> win_mananger = it->second;
-  MPI_Win mpi_win = *(win_mananger->GetWinByRank(mpi_ctx_.rank_));
+  MPI_Win mpi_win = *(win_mananger->GetNeighborWin());
 
   Timeline* timeline_ptr;
   Status timeline_status = GetBluefogTimeline(timeline_ptr);
@@ -970,10 +1929,20 @@ void MPIController::WinPut(TensorTableEntry& entry) {
   std::vector<std::pair<int, double>> sorted_dst_weights =
       GetSortedDstWeights(mpi_ctx_.rank_, mpi_ctx_.size_, entry.dst_weights);
 
+  if (WIN_BATCHED_RMA &&
+      win_mananger->GetCompression() == CompressionType::NONE) {
+    WinPutOrAccumulateBatched(entry, *win_mananger, sorted_dst_weights,
+                              /*accumulate=*/false);
+    return;
+  }
+
   for (auto kv : sorted_dst_weights) {
     int target_rank = kv.first;
     double weight = kv.second;
 
+    // avoid putting the tensor for itself (NOT valid).
+    if (target_rank == mpi_ctx_.rank_) continue;
+
     BFLOG(TRACE, mpi_ctx_.rank_) << "Start MPI_Put for " << entry.tensor_name << " to " << target_rank;
 
     if (entry.require_mutex) {
@@ -982,26 +1951,40 @@ void MPIController::WinPut(TensorTableEntry& entry) {
       timeline_ptr->ActivityEnd(entry.tensor_name);
     }
     timeline_ptr->ActivityStart(entry.tensor_name, "COMMUNICATE");
-    MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
-    // avoid putting the tensor for itself (NOT valid).
-    if (target_rank == mpi_ctx_.rank_) continue;
-    auto tensor = entry.tensor->data_weight(weight);
-    void* sendbuf = (void*)tensor->data();
-    int target_disp = 0;  // offset in win buffer
-    int sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
-    while (sent_size != 0) {
-      void* sendbuf_start =
-          (void*)(static_cast<char*>(sendbuf) +
-                  target_disp * mpi_ctx_.GetMPITypeSize(tensor->dtype()));
-      int ret_code = MPI_Put(sendbuf_start, sent_size, data_type, target_rank,
-                             target_disp, sent_size, data_type, mpi_win);
-      if (ret_code != MPI_SUCCESS) {
-        throw std::runtime_error("MPI_Put failed, see MPI output for details.");
+    char* shared_target = win_mananger->GetSharedTargetPtr(target_rank);
+    if (shared_target != nullptr) {
+      WinPutOrAccumulateShared(entry, *win_mananger, shared_target, weight,
+                               /*accumulate=*/false);
+    } else {
+      MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
+      if (win_mananger->GetCompression() != CompressionType::NONE) {
+        WinPutCompressed(entry, *win_mananger, mpi_win, target_rank, weight);
+      } else {
+        std::shared_ptr<Tensor> weighted_tensor;
+        const void* sendbuf = WeightedWinData(
+            entry, weight, win_weighted_buffer_, weighted_tensor);
+        int element_size = mpi_ctx_.GetMPITypeSize(entry.tensor->dtype());
+        MPI_Aint target_base = win_mananger->GetTargetDisp(target_rank);
+        int target_disp = 0;  // offset in win buffer
+        int sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+        while (sent_size != 0) {
+          void* sendbuf_start =
+              (void*)(static_cast<const char*>(sendbuf) +
+                      target_disp * element_size);
+          int ret_code =
+              MPI_Put(sendbuf_start, sent_size, data_type, target_rank,
+                      target_base + target_disp * element_size, sent_size,
+                      data_type, mpi_win);
+          if (ret_code != MPI_SUCCESS) {
+            throw std::runtime_error(
+                "MPI_Put failed, see MPI output for details.");
+          }
+          target_disp += sent_size;
+          sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+        }
       }
-      target_disp += sent_size;
-      sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+      MPI_Win_unlock(target_rank, mpi_win);
     }
-    MPI_Win_unlock(target_rank, mpi_win);
     timeline_ptr->ActivityEnd(entry.tensor_name);
 
     WinVersionPutUpdate(entry.tensor_name, {target_rank});
@@ -1033,6 +2016,177 @@ void MPIController::WinPut(TensorTableEntry& entry) {
   timeline_ptr->ActivityEnd(entry.tensor_name);
 }
 
+const void* MPIController::WeightedWinData(
+    const TensorTableEntry& entry, double weight,
+    std::vector<char>& weighted_buffer,
+    std::shared_ptr<Tensor>& weighted_tensor) {
+  if (weight == 1.0) {
+    return entry.tensor->data();
+  }
+  DataType dtype = entry.tensor->dtype();
+  if (entry.device == CPU_DEVICE_ID && WeightedSumSupported(dtype)) {
+    if (weighted_buffer.size() < (size_t)entry.tensor->size()) {
+      weighted_buffer.resize(entry.tensor->size());
+    }
+    WeightedSum(dtype, weighted_buffer.data(), entry.tensor->data(), weight,
+                {}, {}, entry.tensor->shape().num_elements());
+    return weighted_buffer.data();
+  }
+  weighted_tensor = entry.tensor->data_weight(weight);
+  return weighted_tensor->data();
+}
+
+// Puts the sequence of the payloads into the header of the compressed buffer
+// at target_base. The sequence is read until the put completes.
+void PutSequence(const int* sequence, int target_rank, MPI_Aint target_base,
+                 MPI_Win mpi_win) {
+  int ret_code = MPI_Put(sequence, 1, MPI_INT, target_rank, target_base, 1,
+                         MPI_INT, mpi_win);
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error("MPI_Put failed, see MPI output for details.");
+  }
+}
+
+// Puts (or accumulates) values[j] at indices[j] of the float array at
+// target_disp of the target rank with an indexed datatype, in chunks of
+// MAX_WIN_SENT values. The displacements of a chunk are staged in
+// displacements.
+void PutIndexed(const float* values, const std::vector<uint32_t>& indices,
+                int target_rank, MPI_Aint target_disp, MPI_Win mpi_win,
+                bool accumulate, std::vector<int>* displacements) {
+  const int num_values = indices.size();
+  for (int begin = 0; begin < num_values; begin += MAX_WIN_SENT) {
+    int count = std::min(MAX_WIN_SENT, num_values - begin);
+    displacements->assign(indices.begin() + begin,
+                          indices.begin() + begin + count);
+    MPI_Datatype target_type;
+    MPI_Type_create_indexed_block(count, 1, displacements->data(), MPI_FLOAT,
+                                  &target_type);
+    MPI_Type_commit(&target_type);
+    int ret_code;
+    if (accumulate) {
+      ret_code = MPI_Accumulate(values + begin, count, MPI_FLOAT, target_rank,
+                                target_disp, 1, target_type, MPI_SUM, mpi_win);
+    } else {
+      ret_code = MPI_Put(values + begin, count, MPI_FLOAT, target_rank,
+                         target_disp, 1, target_type, mpi_win);
+    }
+    MPI_Type_free(&target_type);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error(
+          std::string(accumulate ? "MPI_Accumulate" : "MPI_Put") +
+          " failed, see MPI output for details.");
+    }
+  }
+}
+
+void MPIController::WinPutCompressed(TensorTableEntry& entry,
+                                     WindowManager& win_manager,
+                                     MPI_Win mpi_win, int target_rank,
+                                     double weight) {
+  const int64_t num_elements = entry.tensor->shape().num_elements();
+  std::shared_ptr<Tensor> weighted_tensor;
+  const float* scaled = static_cast<const float*>(
+      WeightedWinData(entry, weight, win_weighted_buffer_, weighted_tensor));
+
+  MPI_Aint target_base = win_manager.GetCompressedTargetDisp(target_rank);
+  int& sequence = win_manager.GetPutSequence(target_rank);
+  if (win_manager.GetCompression() == CompressionType::TOPK) {
+    // The buffer at the target holds what was put before, which is kept in
+    // the replica, so only the values that changed the most since then are
+    // sent. The whole tensor is sent on the first put.
+    std::vector<float>& replica = win_manager.GetPutReplica(target_rank);
+    if (replica.empty()) {
+      replica.assign(scaled, scaled + num_elements);
+      SelectTopK(scaled, num_elements, num_elements, &win_topk_indices_);
+    } else {
+      win_topk_delta_.resize(num_elements);
+      WeightedSum(DataType::BLUEFOG_FLOAT32, win_topk_delta_.data(), scaled,
+                  1.0, {replica.data()}, {-1.0}, num_elements);
+      SelectTopK(win_topk_delta_.data(), num_elements,
+                 TopKCount(num_elements, win_manager.GetCompressionRatio()),
+                 &win_topk_indices_);
+    }
+    win_topk_values_.resize(win_topk_indices_.size());
+    for (size_t j = 0; j < win_topk_indices_.size(); ++j) {
+      win_topk_values_[j] = scaled[win_topk_indices_[j]];
+      replica[win_topk_indices_[j]] = win_topk_values_[j];
+    }
+    PutIndexed(win_topk_values_.data(), win_topk_indices_, target_rank,
+               target_base + COMPRESSED_WIN_HEADER_SIZE, mpi_win,
+               /*accumulate=*/false, &win_topk_displacements_);
+    // The values are complete at the target before the sequence, which is
+    // sent by the unlock after this returns.
+    MPI_Win_flush(target_rank, mpi_win);
+    sequence++;
+    PutSequence(&sequence, target_rank, target_base, mpi_win);
+    return;
+  }
+
+  // The payload goes to the compressed buffer of this rank at the target, and
+  // is decompressed into the neighbor tensor by its next win_sync. What the
+  // payload misses of the tensor is added to the next put to the same rank.
+  std::unique_ptr<Compressor> compressor = CreateCompressor(
+      win_manager.GetCompression(), win_manager.GetCompressionRatio());
+  const int64_t payload_size = compressor->CompressedSize(num_elements);
+  if ((int64_t)win_compressed_payload_.size() < payload_size) {
+    win_compressed_payload_.resize(payload_size);
+  }
+  char* payload = win_compressed_payload_.data();
+  std::vector<float>& residual = win_manager.GetPutResidual(target_rank);
+  residual.resize(num_elements, 0.0f);
+  CompressWithErrorFeedback(*compressor, scaled, num_elements, &residual,
+                            &compression_scratch_, payload);
+
+  // The sequence is odd until the payload is complete at the target.
+  sequence++;
+  PutSequence(&sequence, target_rank, target_base, mpi_win);
+  MPI_Win_flush(target_rank, mpi_win);
+  const int64_t max_sent_bytes = (int64_t)MAX_WIN_SENT * sizeof(float);
+  for (int64_t offset = 0; offset < payload_size; offset += max_sent_bytes) {
+    int sent_size = (int)std::min(max_sent_bytes, payload_size - offset);
+    int ret_code =
+        MPI_Put(payload + offset, sent_size, MPI_BYTE, target_rank,
+                target_base + COMPRESSED_WIN_HEADER_SIZE + offset, sent_size,
+                MPI_BYTE, mpi_win);
+    if (ret_code != MPI_SUCCESS) {
+      throw std::runtime_error("MPI_Put failed, see MPI output for details.");
+    }
+  }
+  MPI_Win_flush(target_rank, mpi_win);
+  sequence++;
+  PutSequence(&sequence, target_rank, target_base, mpi_win);
+}
+
+void MPIController::WinAccumulateCompressed(TensorTableEntry& entry,
+                                            WindowManager& win_manager,
+                                            MPI_Win mpi_win, int target_rank,
+                                            double weight) {
+  if (win_manager.GetCompression() != CompressionType::TOPK) {
+    throw std::runtime_error(
+        "Win_accumulate only supports the top-k compression, since the "
+        "compressed payloads cannot be summed at the target.");
+  }
+  // The values not sent are kept in the residual and added to the next
+  // win_accumulate to the same rank, so nothing is lost in the sum.
+  const int64_t num_elements = entry.tensor->shape().num_elements();
+  std::vector<float>& residual = win_manager.GetAccumulateResidual(target_rank);
+  residual.resize(num_elements, 0.0f);
+  WeightedSum(DataType::BLUEFOG_FLOAT32, residual.data(), residual.data(), 1.0,
+              {entry.tensor->data()}, {weight}, num_elements);
+  SelectTopK(residual.data(), num_elements,
+             TopKCount(num_elements, win_manager.GetCompressionRatio()),
+             &win_topk_indices_);
+  win_topk_values_.resize(win_topk_indices_.size());
+  for (size_t j = 0; j < win_topk_indices_.size(); ++j) {
+    win_topk_values_[j] = residual[win_topk_indices_[j]];
+    residual[win_topk_indices_[j]] = 0.0f;
+  }
+  PutIndexed(win_topk_values_.data(), win_topk_indices_, target_rank,
+             win_manager.GetTargetDisp(target_rank), mpi_win,
+             /*accumulate=*/true, &win_topk_displacements_);
+}
+
 void MPIController::WinAccumulate(TensorTableEntry& entry) {
   // We need to explicitly set the device here.
   with_device device_guard(entry.device);
@@ -1045,7 +2199,7 @@ void MPIController::WinAccumulate(TensorTableEntry& entry) {
                              " in (MPI) registered win name.");
   }
   std::shared_ptr<WindowManager> win_mananger = it->second;
-  MPI_Win mpi_win = *(win_mananger->GetWinByRank(mpi_ctx_.rank_));
+  MPI_Win mpi_win = *(win_mananger->GetNeighborWin());
 
   Timeline* timeline_ptr;
   Status timeline_status = GetBluefogTimeline(timeline_ptr);
@@ -1053,6 +2207,13 @@ void MPIController::WinAccumulate(TensorTableEntry& entry) {
   std::vector<std::pair<int, double>> sorted_dst_weights =
       GetSortedDstWeights(mpi_ctx_.rank_, mpi_ctx_.size_, entry.dst_weights);
 
+  if (WIN_BATCHED_RMA &&
+      win_mananger->GetCompression() == CompressionType::NONE) {
+    WinPutOrAccumulateBatched(entry, *win_mananger, sorted_dst_weights,
+                              /*accumulate=*/true);
+    return;
+  }
+
   for (auto kv : sorted_dst_weights) {
     int target_rank = kv.first;
     double weight = kv.second;
@@ -1064,33 +2225,50 @@ void MPIController::WinAccumulate(TensorTableEntry& entry) {
       WinMutexAcquire(entry.tensor_name, {target_rank}, /*is_sync=*/false);
       timeline_ptr->ActivityEnd(entry.tensor_name);
     }
-    auto tensor = entry.tensor->data_weight(weight);
-    void* sendbuf = (void*)tensor->data();
-
     timeline_ptr->ActivityStart(entry.tensor_name, "COMMUNICATE");
 
-    MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
-    int target_disp = 0;  // offset in win buffer
-    int sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
-    while (sent_size != 0) {
-      void* sendbuf_start =
-          (void*)(static_cast<char*>(sendbuf) +
-                  target_disp * mpi_ctx_.GetMPITypeSize(tensor->dtype()));
-      int ret_code =
-          MPI_Accumulate(sendbuf_start, sent_size, data_type, target_rank,
-                         target_disp, sent_size, data_type, MPI_SUM, mpi_win);
-      if (ret_code != MPI_SUCCESS) {
-        if (entry.require_mutex)
-          WinMutexRelease(entry.tensor_name, {target_rank}, /*is_sync=*/false);
-        throw std::runtime_error(
-            "MPI_Accumulate failed, see MPI output for details.");
+    char* shared_target = win_mananger->GetSharedTargetPtr(target_rank);
+    if (shared_target != nullptr) {
+      WinPutOrAccumulateShared(entry, *win_mananger, shared_target, weight,
+                               /*accumulate=*/true);
+    } else {
+      MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
+      if (win_mananger->GetCompression() != CompressionType::NONE) {
+        WinAccumulateCompressed(entry, *win_mananger, mpi_win, target_rank,
+                                weight);
+      } else {
+        std::shared_ptr<Tensor> weighted_tensor;
+        const void* sendbuf = WeightedWinData(
+            entry, weight, win_weighted_buffer_, weighted_tensor);
+        int element_size = mpi_ctx_.GetMPITypeSize(entry.tensor->dtype());
+        MPI_Aint target_base = win_mananger->GetTargetDisp(target_rank);
+        int target_disp = 0;  // offset in win buffer
+        int sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+        while (sent_size != 0) {
+          void* sendbuf_start =
+              (void*)(static_cast<const char*>(sendbuf) +
+                      target_disp * element_size);
+          int ret_code = MPI_Accumulate(
+              sendbuf_start, sent_size, data_type, target_rank,
+              target_base + target_disp * element_size, sent_size, data_type,
+              MPI_SUM, mpi_win);
+          if (ret_code != MPI_SUCCESS) {
+            if (entry.require_mutex)
+              WinMutexRelease(entry.tensor_name, {target_rank},
+                              /*is_sync=*/false);
+            throw std::runtime_error(
+                "MPI_Accumulate failed, see MPI output for details.");
+          }
+          target_disp += sent_size;
+          sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+        }
       }
-      target_disp += sent_size;
-      sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+      MPI_Win_unlock(target_rank, mpi_win);
     }
-    MPI_Win_unlock(target_rank, mpi_win);
     timeline_ptr->ActivityEnd(entry.tensor_name);
 
+    WinVersionPutUpdate(entry.tensor_name, {target_rank});
+
     if (entry.win_ops_with_associated_p) {
       std::shared_ptr<MPI_Win> weight_win = win_mananger->GetPWin();
       MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, *weight_win);
@@ -1133,6 +2311,11 @@ void MPIController::WinGet(TensorTableEntry& entry) {
   Timeline* timeline_ptr;
   Status timeline_status = GetBluefogTimeline(timeline_ptr);
 
+  if (WIN_BATCHED_RMA) {
+    WinGetBatched(entry, *win_mananger);
+    return;
+  }
+
   MPI_Win mpi_win = *(win_mananger->GetGlobalWin());
   for (auto kv : entry.src_weights) {
     int target_rank = kv.first;
@@ -1183,6 +2366,232 @@ void MPIController::WinGet(TensorTableEntry& entry) {
   entry.callback(Status::OK());
 }
 
+void MPIController::WinPutOrAccumulateShared(const TensorTableEntry& entry,
+                                             WindowManager& win_manager,
+                                             char* target, double weight,
+                                             bool accumulate) {
+  DataType dtype = entry.tensor->dtype();
+  int64_t num_elements = entry.tensor->shape().num_elements();
+  const void* data = entry.tensor->data();
+  if (accumulate) {
+    // Sees what the target has written into the memory, e.g. the reset of
+    // win_update.
+    MPI_Win_sync(*(win_manager.GetSharedWin()));
+    WeightedSum(dtype, target, target, 1.0, {data}, {weight}, num_elements);
+  } else if (weight == 1.0) {
+    std::memcpy(target, data, entry.tensor->size());
+  } else {
+    WeightedSum(dtype, target, data, weight, {}, {}, num_elements);
+  }
+  // Makes the stores visible to the target before the version tells it.
+  MPI_Win_sync(*(win_manager.GetSharedWin()));
+}
+
+void MPIController::WinPutOrAccumulateBatched(
+    TensorTableEntry& entry, WindowManager& win_manager,
+    const std::vector<std::pair<int, double>>& dst_weights, bool accumulate) {
+  const char* op_name = accumulate ? "MPI_Raccumulate" : "MPI_Rput";
+  int num_elements = entry.tensor->shape().num_elements();
+  MPI_Datatype data_type = mpi_ctx_.GetMPIDataType(entry.tensor);
+  int element_size = mpi_ctx_.GetMPITypeSize(entry.tensor->dtype());
+  MPI_Win mpi_win = *(win_manager.GetNeighborWin());
+  Timeline* timeline_ptr;
+  Status timeline_status = GetBluefogTimeline(timeline_ptr);
+
+  // Holding the mutexes of several targets at the same time cannot deadlock
+  // as long as they are acquired in ascending rank order, like win_sync does.
+  std::vector<int> target_ranks;
+  for (auto& kv : dst_weights) {
+    if (kv.first != mpi_ctx_.rank_) target_ranks.push_back(kv.first);
+  }
+  std::sort(target_ranks.begin(), target_ranks.end());
+  if (entry.require_mutex) {
+    timeline_ptr->ActivityStart(entry.tensor_name, "Aquire_Mutex");
+    WinMutexAcquire(entry.tensor_name, target_ranks, /*is_sync=*/false);
+    timeline_ptr->ActivityEnd(entry.tensor_name);
+  }
+
+  // The neighbor tensors of all the ranks share one window, and win_sync
+  // locks it at self from another thread. So it locks the targets only
+  // instead of MPI_Win_lock_all, which would include self.
+  timeline_ptr->ActivityStart(entry.tensor_name, "COMMUNICATE");
+  for (int target_rank : target_ranks) {
+    MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
+  }
+  std::vector<MPI_Request> requests;
+  // Every distinct weight is scaled into a buffer of its own, so the
+  // transfers to all the targets stay in flight together.
+  std::vector<double> weights;
+  std::vector<const void*> weighted_data;
+  std::vector<std::shared_ptr<Tensor>> weighted_tensors;
+  for (auto& kv : dst_weights) {
+    int target_rank = kv.first;
+    double weight = kv.second;
+    if (target_rank == mpi_ctx_.rank_) continue;
+    char* shared_target = win_manager.GetSharedTargetPtr(target_rank);
+    if (shared_target != nullptr) {
+      WinPutOrAccumulateShared(entry, win_manager, shared_target, weight,
+                               accumulate);
+      continue;
+    }
+    size_t weight_index =
+        std::find(weights.begin(), weights.end(), weight) - weights.begin();
+    if (weight_index == weights.size()) {
+      if (win_batched_weighted_buffers_.size() <= weight_index) {
+        win_batched_weighted_buffers_.resize(weight_index + 1);
+      }
+      weighted_tensors.emplace_back();
+      weighted_data.push_back(WeightedWinData(
+          entry, weight, win_batched_weighted_buffers_[weight_index],
+          weighted_tensors.back()));
+      weights.push_back(weight);
+    }
+    const void* sendbuf = weighted_data[weight_index];
+    MPI_Aint target_base = win_manager.GetTargetDisp(target_rank);
+    for (int target_disp = 0; target_disp < num_elements;
+         target_disp += MAX_WIN_SENT) {
+      int sent_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+      const void* sendbuf_start =
+          static_cast<const char*>(sendbuf) + target_disp * element_size;
+      MPI_Request request;
+      int ret_code;
+      if (accumulate) {
+        ret_code = MPI_Raccumulate(
+            sendbuf_start, sent_size, data_type, target_rank,
+            target_base + target_disp * element_size, sent_size, data_type,
+            MPI_SUM, mpi_win, &request);
+      } else {
+        ret_code = MPI_Rput(sendbuf_start, sent_size, data_type, target_rank,
+                            target_base + target_disp * element_size,
+                            sent_size, data_type, mpi_win, &request);
+      }
+      if (ret_code != MPI_SUCCESS) {
+        if (entry.require_mutex)
+          WinMutexRelease(entry.tensor_name, target_ranks, /*is_sync=*/false);
+        throw std::runtime_error(std::string(op_name) +
+                                 " failed, see MPI output for details.");
+      }
+      requests.push_back(request);
+    }
+  }
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  // Completes all the transfers at the targets, which are in flight together.
+  MPI_Win_flush_all(mpi_win);
+  for (int target_rank : target_ranks) {
+    MPI_Win_unlock(target_rank, mpi_win);
+  }
+  timeline_ptr->ActivityEnd(entry.tensor_name);
+
+  WinVersionPutUpdate(entry.tensor_name, target_ranks);
+
+  if (entry.win_ops_with_associated_p) {
+    std::shared_ptr<MPI_Win> weight_win = win_manager.GetPWin();
+    double* p_memory = win_manager.GetUnderlyingPMemory();
+    std::vector<double> weighted_ps;
+    weighted_ps.reserve(dst_weights.size());
+    for (int target_rank : target_ranks) {
+      MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK,
+                   *weight_win);
+    }
+    for (auto& kv : dst_weights) {
+      if (kv.first == mpi_ctx_.rank_) continue;
+      // Unlike data window, weight window is just a raw "world size" vector.
+      weighted_ps.push_back((*(p_memory + mpi_ctx_.rank_)) * kv.second);
+      int ret_code;
+      if (accumulate) {
+        ret_code = MPI_Accumulate(&weighted_ps.back(), 1, MPI_DOUBLE, kv.first,
+                                  mpi_ctx_.rank_, 1, MPI_DOUBLE, MPI_SUM,
+                                  *weight_win);
+      } else {
+        ret_code = MPI_Put(&weighted_ps.back(), 1, MPI_DOUBLE, kv.first,
+                           mpi_ctx_.rank_, 1, MPI_DOUBLE, *weight_win);
+      }
+      if (ret_code != MPI_SUCCESS) {
+        throw std::runtime_error(
+            std::string(accumulate ? "MPI_Accumulate" : "MPI_Put") +
+            " failed, see MPI output for details.");
+      }
+    }
+    MPI_Win_flush_all(*weight_win);
+    for (int target_rank : target_ranks) {
+      MPI_Win_unlock(target_rank, *weight_win);
+    }
+  }
+
+  if (entry.require_mutex) {
+    WinMutexRelease(entry.tensor_name, target_ranks, /*is_sync=*/false);
+  }
+
+  BFLOG(TRACE, mpi_ctx_.rank_)
+      << op_name << " for " << entry.tensor_name << " is done.";
+
+  timeline_ptr->ActivityStart(entry.tensor_name, "CALLBACK");
+  entry.callback(Status::OK());
+  timeline_ptr->ActivityEnd(entry.tensor_name);
+}
+
+void MPIController::WinGetBatched(TensorTableEntry& entry,
+                                  WindowManager& win_manager) {
+  MPI_Win mpi_win = *(win_manager.GetGlobalWin());
+  Timeline* timeline_ptr;
+  Status timeline_status = GetBluefogTimeline(timeline_ptr);
+
+  // Acquired in ascending rank order, see WinPutOrAccumulateBatched.
+  std::vector<int> src_ranks;
+  for (auto& kv : entry.src_weights) {
+    if (kv.first != mpi_ctx_.rank_) src_ranks.push_back(kv.first);
+  }
+  std::sort(src_ranks.begin(), src_ranks.end());
+  if (entry.require_mutex) {
+    timeline_ptr->ActivityStart(entry.tensor_name, "Aquire_Mutex");
+    WinMutexAcquire(entry.tensor_name, src_ranks, /*is_sync=*/false);
+    timeline_ptr->ActivityEnd(entry.tensor_name);
+  }
+
+  // Locks the sources only, see WinPutOrAccumulateBatched.
+  timeline_ptr->ActivityStart(entry.tensor_name, "COMMUNICATE");
+  for (int target_rank : src_ranks) {
+    MPI_Win_lock(MPI_LOCK_SHARED, target_rank, MPI_MODE_NOCHECK, mpi_win);
+  }
+  std::vector<MPI_Request> requests;
+  for (int target_rank : src_ranks) {
+    auto tensor = win_manager.GetAssociateTensorByRank(target_rank);
+    char* recvbuf = (char*)tensor->data();
+    int num_elements = tensor->shape().num_elements();
+    int element_size = mpi_ctx_.GetMPITypeSize(tensor->dtype());
+    MPI_Datatype data_type = mpi_ctx_.GetMPIDataType(tensor);
+    for (int target_disp = 0; target_disp < num_elements;
+         target_disp += MAX_WIN_SENT) {
+      int recv_size = std::min(MAX_WIN_SENT, num_elements - target_disp);
+      MPI_Request request;
+      int ret_code = MPI_Rget(recvbuf + target_disp * element_size, recv_size,
+                              data_type, target_rank, target_disp, recv_size,
+                              data_type, mpi_win, &request);
+      if (ret_code != MPI_SUCCESS) {
+        if (entry.require_mutex)
+          WinMutexRelease(entry.tensor_name, src_ranks, /*is_sync=*/false);
+        throw std::runtime_error("MPI_Rget failed, see MPI output for details.");
+      }
+      requests.push_back(request);
+    }
+  }
+  // The data of MPI_Rget is available once the request completes.
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  for (int target_rank : src_ranks) {
+    MPI_Win_unlock(target_rank, mpi_win);
+  }
+  timeline_ptr->ActivityEnd(entry.tensor_name);
+
+  WinVersionGetUpdate(entry.tensor_name, src_ranks);
+
+  if (entry.require_mutex) {
+    WinMutexRelease(entry.tensor_name, src_ranks, /*is_sync=*/false);
+  }
+
+  BFLOG(TRACE, mpi_ctx_.rank_) << "Win_get for " << entry.tensor_name << " is done.";
+  entry.callback(Status::OK());
+}
+
 void MPIController::Barrier(TensorTableEntry& entry) {
   int ret_code = MPI_Barrier(mpi_ctx_.GetMPICommunicator(Communicator::GLOBAL));
   if (ret_code != MPI_SUCCESS) {
@@ -1205,11 +2614,8 @@ Status MPIController::WinLock(const std::string& name) {
   int target_rank = mpi_ctx_.rank_;
   MPI_Win_lock(MPI_LOCK_EXCLUSIVE, target_rank, MPI_MODE_NOCHECK, mpi_win);
 
-  for (const int& rank : mpi_ctx_.neighbor_in_ranks_) {
-    auto mpi_win_ptr = win_mananger->GetWinByRank(rank);
-    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, target_rank, MPI_MODE_NOCHECK,
-                 *mpi_win_ptr);
-  }
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, target_rank, MPI_MODE_NOCHECK,
+               *(win_mananger->GetNeighborWin()));
 
   return Status::OK();
 }
@@ -1228,10 +2634,7 @@ Status MPIController::WinUnlock(const std::string& name) {
   int target_rank = mpi_ctx_.rank_;
   MPI_Win_unlock(target_rank, mpi_win);
 
-  for (const int& rank : mpi_ctx_.neighbor_in_ranks_) {
-    auto mpi_win_ptr = win_mananger->GetWinByRank(rank);
-    MPI_Win_unlock(target_rank, *mpi_win_ptr);
-  }
+  MPI_Win_unlock(target_rank, *(win_mananger->GetNeighborWin()));
 
   return Status::OK();
 }
@@ -1345,7 +2748,8 @@ Status MPIController::WinVersionPutUpdate(const std::string& name,
   return Status::OK();
 }
 
-Status MPIController::VersionWinClear(const std::string& name) {
+Status MPIController::VersionWinClear(const std::string& name,
+                                      const std::vector<int>& versions) {
   BFLOG(TRACE, mpi_ctx_.rank_) << "Win Version for " << name << " is released.";
 
   auto it = mpi_ctx_.named_win_map.find(name);
@@ -1364,7 +2768,13 @@ Status MPIController::VersionWinClear(const std::string& name) {
 
   MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpi_ctx_.rank_, MPI_MODE_NOCHECK,
                *version_win);
-  it->second->resetVersionWinMem();
+  MPI_Win_sync(*version_win);
+  // Only the versions read before are taken off. Resetting them to 0 would
+  // drop the ones written after they were read.
+  const std::vector<int> consumed =
+      versions.empty() ? it->second->GetVersionMemoryCopy() : versions;
+  it->second->UpdateMissedSyncs(consumed);
+  it->second->ConsumeVersionWinMem(consumed);
   MPI_Win_sync(*version_win);
   MPI_Win_unlock(mpi_ctx_.rank_, *version_win);
 
@@ -1392,6 +2802,91 @@ Status MPIController::GetWindowVersionValue(const std::string& name,
   return Status::OK();
 }
 
+Status MPIController::GetWinSharedNeighborBuffer(const std::string& name,
+                                                 const int rank,
+                                                 void** buffer) {
+  auto it = mpi_ctx_.named_win_map.find(name);
+  if (it == mpi_ctx_.named_win_map.end()) {
+    return Status::InvalidArgument(std::string("Cannot find ") + name +
+                                   " in registered win name.");
+  }
+  *buffer = it->second->GetSharedNeighborBuffer(rank);
+  return Status::OK();
+}
+
+Status MPIController::WinWaitVersion(
+    const std::string& name, const std::unordered_map<int, int>& min_versions,
+    int max_staleness, double timeout_seconds, std::vector<int>& versions) {
+  auto it = mpi_ctx_.named_win_map.find(name);
+  if (it == mpi_ctx_.named_win_map.end()) {
+    return Status::PreconditionError(
+        "Cannot wait Version Win for " + name +
+        ". It may not be created or has "
+        "been destroyed or wrong name for associated window.");
+  }
+  std::shared_ptr<WindowManager> win_manager = it->second;
+  std::shared_ptr<MPI_Win> version_win = win_manager->GetVersionWin();
+  if (!version_win) {
+    return Status::PreconditionError("Cannot wait Version Win for " + name +
+                                     ". The data window for that name is found"
+                                     "but version window is not.");
+  }
+
+  std::unordered_map<int, int> required = min_versions;
+  if (max_staleness >= 0) {
+    for (int rank : mpi_ctx_.neighbor_in_ranks_) {
+      if (win_manager->GetMissedSyncs(rank) >= max_staleness) {
+        required[rank] = std::max(required[rank], 1);
+      }
+    }
+  }
+
+  // The versions are only written by the neighbors, so waiting for them only
+  // reads the local memory. The sleep doubles up to a cap, which keeps the
+  // latency low when the neighbors are about to write, and the CPU mostly idle
+  // when they are not.
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration<double>(timeout_seconds);
+  int sleep_us = 1;
+  while (true) {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, mpi_ctx_.rank_, MPI_MODE_NOCHECK,
+                 *version_win);
+    MPI_Win_sync(*version_win);
+    versions = win_manager->GetVersionMemoryCopy();
+    MPI_Win_unlock(mpi_ctx_.rank_, *version_win);
+
+    bool satisfied = true;
+    for (auto& kv : required) {
+      if (versions[kv.first] < kv.second) {
+        satisfied = false;
+        break;
+      }
+    }
+    if (satisfied) {
+      return Status::OK();
+    }
+    if (timeout_seconds >= 0 && std::chrono::steady_clock::now() >= deadline) {
+      return Status::Aborted("Timed out waiting for the versions of " + name +
+                             ".");
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    sleep_us = std::min(sleep_us * 2, MAX_WIN_VERSION_WAIT_SLEEP_US);
+  }
+}
+
+void MPIController::MemcpyWithDevice(void* dst, const void* src, size_t count,
+                                     int device) {
+#if HAVE_CUDA
+  if (device != CPU_DEVICE_ID) {
+    CUDACHECK(cudaMemcpy(dst, src, count, cudaMemcpyDeviceToDevice));
+  } else {
+#endif
+    std::memcpy(dst, src, count);
+#if HAVE_CUDA
+  }
+#endif
+}
+
 void MPIController::MemcpyInFusionBuffer(
     const std::vector<TensorTableEntry>& entries, void*& buffer_data,
     size_t& buffer_len) {
@@ -1529,73 +3024,184 @@ void MPIController::MemcpyEntryOutFusionBufferForNeighbors(
   }
 }
 
-// Extracted from book "Using Advanced MPI" Section 4.5
+// The mutexes are queue locks (MCS locks) following the book "Using Advanced
+// MPI" Section 4.5. A process waiting for a mutex appends itself to the queue
+// of the mutex and spins on a flag in its own memory, which the holder
+// clears when it releases the mutex. So the waiters do not send any remote
+// atomics while waiting, and get the mutex in the order they asked for it.
+// See MUTEX_WIN_INTS_PER_RANK for the layout of the mutex window.
+namespace {
+
+// Serializes the epochs on the mutex windows. The background thread and the
+// thread calling win_sync may access the same target at the same time, which
+// is not allowed within one process.
+std::mutex mutex_win_epoch_mutex;
+
+// Mutexes held by this process: (window, host rank, slot rank). There is one
+// queue node per process for every mutex, so the threads of the process take
+// turns here before one of them joins the queue, e.g. bf.win_mutex and a
+// win_put with require_mutex in the background thread.
+std::set<std::tuple<MPI_Win, int, int>> held_mutexes;
+std::mutex held_mutexes_mutex;
+std::condition_variable held_mutexes_cv;
+
+int MutexWinSize(MPI_Win mutex_win) {
+  MPI_Group group;
+  int size = 0;
+  MPI_Win_get_group(mutex_win, &group);
+  MPI_Group_size(group, &size);
+  MPI_Group_free(&group);
+  return size;
+}
+
+// Applies op with value to the int at disp of the target rank atomically and
+// returns the previous value.
+int MutexWinFetchAndOp(MPI_Win mutex_win, int value, int target_rank, int disp,
+                       MPI_Op op) {
+  std::lock_guard<std::mutex> guard(mutex_win_epoch_mutex);
+  int old_value = 0;
+  MPI_Win_lock(MPI_LOCK_SHARED, target_rank, 0, mutex_win);
+  MPI_Fetch_and_op(&value, &old_value, MPI_INT, target_rank, disp, op,
+                   mutex_win);
+  MPI_Win_unlock(target_rank, mutex_win);
+  return old_value;
+}
+
+int MutexWinCompareAndSwap(MPI_Win mutex_win, int value, int compare,
+                           int target_rank, int disp) {
+  std::lock_guard<std::mutex> guard(mutex_win_epoch_mutex);
+  int old_value = 0;
+  MPI_Win_lock(MPI_LOCK_SHARED, target_rank, 0, mutex_win);
+  MPI_Compare_and_swap(&value, &compare, &old_value, MPI_INT, target_rank,
+                       disp, mutex_win);
+  MPI_Win_unlock(target_rank, mutex_win);
+  return old_value;
+}
+
+// The int at disp of the memory of this rank in the mutex window, which can be
+// read with plain loads in the unified memory model. nullptr otherwise, and
+// then it is read with MPI_Fetch_and_op.
+volatile int* MutexWinLocalInt(MPI_Win mutex_win, int disp) {
+  int* model = nullptr;
+  int flag = 0;
+  MPI_Win_get_attr(mutex_win, MPI_WIN_MODEL, &model, &flag);
+  if (!flag || *model != MPI_WIN_UNIFIED) {
+    return nullptr;
+  }
+  void* base = nullptr;
+  MPI_Win_get_attr(mutex_win, MPI_WIN_BASE, &base, &flag);
+  if (!flag) {
+    return nullptr;
+  }
+  return static_cast<volatile int*>(base) + disp;
+}
+
+// Waits until the int at disp of this rank is not equal to value, and returns
+// it. The other ranks write it with MPI_REPLACE.
+int MutexWinWaitWhile(MPI_Win mutex_win, int self_rank, int disp, int value) {
+  volatile int* local = MutexWinLocalInt(mutex_win, disp);
+  int current;
+  while ((current = local != nullptr
+                        ? *local
+                        : MutexWinFetchAndOp(mutex_win, 0, self_rank, disp,
+                                             MPI_NO_OP)) == value) {
+    std::this_thread::sleep_for(std::chrono::microseconds(1));
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return current;
+}
+
+// Displacement of the "next" of the queue node of the rank for the mutex of
+// the slot rank hosted by the host rank. Its "blocked" follows size ints later.
+int MutexNodeDisp(int size, int rank, int host_rank, int slot_rank) {
+  return rank == host_rank ? size + slot_rank : 3 * size + host_rank;
+}
+
+void MutexAcquire(MPI_Win mutex_win, int size, int self_rank, int host_rank,
+                  int slot_rank) {
+  {
+    auto key = std::make_tuple(mutex_win, host_rank, slot_rank);
+    std::unique_lock<std::mutex> lock(held_mutexes_mutex);
+    held_mutexes_cv.wait(lock,
+                         [&key]() { return held_mutexes.count(key) == 0; });
+    held_mutexes.insert(key);
+  }
+  int node = MutexNodeDisp(size, self_rank, host_rank, slot_rank);
+  MutexWinFetchAndOp(mutex_win, -1, self_rank, node, MPI_REPLACE);
+  MutexWinFetchAndOp(mutex_win, 1, self_rank, node + size, MPI_REPLACE);
+  int predecessor = MutexWinFetchAndOp(mutex_win, self_rank, host_rank,
+                                       /*tail=*/slot_rank, MPI_REPLACE);
+  if (predecessor != -1) {
+    MutexWinFetchAndOp(
+        mutex_win, self_rank, predecessor,
+        MutexNodeDisp(size, predecessor, host_rank, slot_rank), MPI_REPLACE);
+    MutexWinWaitWhile(mutex_win, self_rank, node + size, /*value=*/1);
+  }
+}
+
+void MutexRelease(MPI_Win mutex_win, int size, int self_rank, int host_rank,
+                  int slot_rank) {
+  auto key = std::make_tuple(mutex_win, host_rank, slot_rank);
+  {
+    std::lock_guard<std::mutex> guard(held_mutexes_mutex);
+    if (held_mutexes.count(key) == 0) {
+      BFLOG(WARNING, self_rank)
+          << "Release the mutex of rank " << slot_rank << " at rank "
+          << host_rank << ", which is not acquired.";
+      return;
+    }
+  }
+  int node = MutexNodeDisp(size, self_rank, host_rank, slot_rank);
+  int next = MutexWinFetchAndOp(mutex_win, 0, self_rank, node, MPI_NO_OP);
+  if (next == -1 && MutexWinCompareAndSwap(mutex_win, -1, self_rank, host_rank,
+                                           /*tail=*/slot_rank) != self_rank) {
+    // Another process is appending itself after this one.
+    next = MutexWinWaitWhile(mutex_win, self_rank, node, /*value=*/-1);
+  }
+  if (next != -1) {
+    MutexWinFetchAndOp(mutex_win, 0, next,
+                       MutexNodeDisp(size, next, host_rank, slot_rank) + size,
+                       MPI_REPLACE);
+  }
+  {
+    std::lock_guard<std::mutex> guard(held_mutexes_mutex);
+    held_mutexes.erase(key);
+  }
+  held_mutexes_cv.notify_all();
+}
+
+}  // namespace
+
 Status MPIWinMutexAcquireImpl(std::shared_ptr<MPI_Win> mutex_win,
                               const std::vector<int>& acquire_ranks,
                               int self_rank, bool is_sync) {
-  // TODO(ybc) Try better implementation than Spin Lock.
-  // Recall that we build N windows across all N processes.
-  // The spin value is stored in the rank i for i-th window.
-  // Other process will got to acquire it.
-  int one = 1;
-  int minus_one = -1;
-  int oldval = 0;
-
-  if (is_sync) {  // Lock for self mutex
-    MPI_Win_lock(MPI_LOCK_SHARED, self_rank, 0, *mutex_win);
-    for (int rank : acquire_ranks) {
-      do {
-        MPI_Fetch_and_op(&one, &oldval, MPI_INT, self_rank,
-                         /*target_disp=*/rank, MPI_SUM, *mutex_win);
-        MPI_Win_flush(self_rank, *mutex_win);
-        if (oldval == 0) break;
-        MPI_Accumulate(&minus_one, 1, MPI_INT, self_rank, /*target_disp=*/rank,
-                       1, MPI_INT, MPI_SUM, *mutex_win);
-        MPI_Win_flush(self_rank, *mutex_win);
-        std::this_thread::sleep_for(std::chrono::microseconds(1));
-      } while (1);
-    }
-    MPI_Win_unlock(self_rank, *mutex_win);
-  } else {  // Lock for remote mutex
-    for (int rank : acquire_ranks) {
-      MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, *mutex_win);
-      do {
-        MPI_Fetch_and_op(&one, &oldval, MPI_INT, rank,
-                         /*target_disp=*/self_rank, MPI_SUM, *mutex_win);
-        MPI_Win_flush(rank, *mutex_win);
-        if (oldval == 0) break;
-        MPI_Accumulate(&minus_one, 1, MPI_INT, rank,
-                       /*target_disp=*/self_rank, 1, MPI_INT, MPI_SUM,
-                       *mutex_win);
-        MPI_Win_flush(rank, *mutex_win);
-        std::this_thread::sleep_for(std::chrono::microseconds(1));
-      } while (1);
-      MPI_Win_unlock(rank, *mutex_win);
+  // The mutex of the slot rank s at the host rank h protects the neighbor
+  // tensor of s at h. Win_sync acquires the mutexes at self, and the others
+  // acquire the mutexes of self at the remote ranks.
+  int size = MutexWinSize(*mutex_win);
+  for (int rank : acquire_ranks) {
+    if (is_sync) {
+      MutexAcquire(*mutex_win, size, self_rank, /*host_rank=*/self_rank,
+                   /*slot_rank=*/rank);
+    } else {
+      MutexAcquire(*mutex_win, size, self_rank, /*host_rank=*/rank,
+                   /*slot_rank=*/self_rank);
     }
   }
-
   return Status::OK();
 }
 
 Status MPIWinMutexReleaseImpl(std::shared_ptr<MPI_Win> mutex_win,
                               const std::vector<int>& release_ranks,
                               int self_rank, bool is_sync) {
-  int minus_one = -1;
-  // TODO(ybc) Notice the following accumulate may cause the value to be
-  // negative, i.e. more release ops is called than acquire.
-  if (is_sync) {
-    MPI_Win_lock(MPI_LOCK_SHARED, self_rank, 0, *mutex_win);
-    for (int rank : release_ranks) {
-      MPI_Accumulate(&minus_one, 1, MPI_INT, self_rank, /*target_disp=*/rank, 1,
-                     MPI_INT, MPI_SUM, *mutex_win);
-    }
-    MPI_Win_unlock(self_rank, *mutex_win);
-  } else {
-    for (int rank : release_ranks) {
-      MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, *mutex_win);
-      MPI_Accumulate(&minus_one, 1, MPI_INT, rank, /*target_disp=*/self_rank, 1,
-                     MPI_INT, MPI_SUM, *mutex_win);
-      MPI_Win_unlock(rank, *mutex_win);
+  int size = MutexWinSize(*mutex_win);
+  for (int rank : release_ranks) {
+    if (is_sync) {
+      MutexRelease(*mutex_win, size, self_rank, /*host_rank=*/self_rank,
+                   /*slot_rank=*/rank);
+    } else {
+      MutexRelease(*mutex_win, size, self_rank, /*host_rank=*/rank,
+                   /*slot_rank=*/self_rank);
     }
   }
   return Status::OK();
@@ -67,6 +67,9 @@ class MPIController {
   void PairGossip(TensorTableEntry& entry);
 
   void Allreduce(std::vector<TensorTableEntry>& entries);
+  void Allgather(std::vector<TensorTableEntry>& entries);
+  void Broadcast(std::vector<TensorTableEntry>& entries);
+  void NeighborAllgather(std::vector<TensorTableEntry>& entries);
   void NeighborAllreduce(std::vector<TensorTableEntry>& entries);
 
   void WinCreate(TensorTableEntry& entry);
@@ -87,7 +90,13 @@ class MPIController {
   int LoadTopologyWeights(double& self_weight,
                           const std::unordered_map<int, double>*& neighbor_weights);
 
-  Status WinSync(const std::string& name, int device, bool with_associated_p);
+  // Frees the error feedback of the compressed neighbor_allreduce.
+  void ClearCompressionResiduals();
+
+  // versions are the ones read by WinWaitVersion before, or empty to read
+  // them here.
+  Status WinSync(const std::string& name, int device, bool with_associated_p,
+                 const std::vector<int>& versions);
   Status WinFence(const std::string& name);
   Status WinLock(const std::string& name);
   Status WinUnlock(const std::string& name);
@@ -100,15 +109,101 @@ class MPIController {
                          const std::vector<int>& release_ranks, bool is_sync);
   Status WinVersionPutUpdate(const std::string& name, const std::vector<int>& ranks);
   Status WinVersionGetUpdate(const std::string& name, const std::vector<int>& ranks);
-  Status VersionWinClear(const std::string& name);
+  Status VersionWinClear(const std::string& name,
+                         const std::vector<int>& versions);
   Status GetWindowVersionValue(const std::string& name, std::vector<int>& versions);
+  // Blocks until every rank in min_versions has a version of at least the
+  // value, and every in-neighbor which has missed max_staleness win_sync in a
+  // row (if max_staleness >= 0) has a new version. Returns Aborted after
+  // timeout_seconds if it is not negative. versions gets the last versions
+  // read either way.
+  Status WinWaitVersion(const std::string& name,
+                        const std::unordered_map<int, int>& min_versions,
+                        int max_staleness, double timeout_seconds,
+                        std::vector<int>& versions);
 
   Status GetWinAssociatedPByNameAndRank(const std::string& name, const int rank,
                                         double* weight);
+  // Buffer in the shared memory for the tensor receiving from the rank, or
+  // nullptr if the rank writes it through RMA.
+  Status GetWinSharedNeighborBuffer(const std::string& name, const int rank,
+                                    void** buffer);
   Status SetWinAssociatedPByNameAndRank(const std::string& name, const int rank,
                                         double weight);
 
+  // Whether BLUEFOG_HIERARCHICAL_SHARED_MEMORY is set.
+  bool HierarchicalSharedMemoryEnabled() const;
+
  protected:
+  // Fused allreduce in chunks, see BLUEFOG_FUSION_CHUNK_SIZE.
+  void AllreduceWithPipeline(std::vector<TensorTableEntry>& entries);
+
+  // Neighbor_allreduce that folds each received chunk into the output as soon
+  // as it arrives, see BLUEFOG_NEIGHBOR_ALLREDUCE_STREAMING.
+  void NeighborAllreduceStreaming(TensorTableEntry& entry);
+
+  // Neighbor_allreduce that sends the compressed tensor and decompresses the
+  // received ones into the output. Returns the error message of the receives.
+  std::string NeighborAllreduceCompressed(TensorTableEntry& entry);
+
+  // Hierarchical neighbor_allreduce through the node-shared memory, see
+  // BLUEFOG_HIERARCHICAL_SHARED_MEMORY. local_sum and neighbor_data are set to
+  // the local sum and the tensors of the machine neighbors in the shared
+  // memory, which stay valid until the next call. Returns the error message of
+  // the receives.
+  std::string HierarchicalNeighborAllreduceShared(const TensorTableEntry& entry,
+                                                  const void* sendbuf,
+                                                  int64_t num_elements,
+                                                  const char*& local_sum,
+                                                  const char*& neighbor_data);
+
+  // Reduces count elements of the local sum and the tensors of the machine
+  // neighbors, which are stride bytes apart, into output with the weights of
+  // the entry.
+  void ReduceHierarchicalSharedNeighbors(const TensorTableEntry& entry,
+                                         void* output, const char* local_sum,
+                                         const char* neighbor_data,
+                                         int64_t stride, int64_t count);
+
+  // Whether the hierarchical neighbor_allreduce of the entry goes through the
+  // node-shared memory.
+  bool UseHierarchicalSharedMemory(const TensorTableEntry& entry);
+
+  // Data of the tensor of win_put or win_accumulate multiplied by the weight.
+  // CPU tensors are scaled into weighted_buffer, which the caller keeps until
+  // the transfers from it complete. The others fall back to
+  // Tensor::data_weight, which allocates weighted_tensor to hold the result.
+  const void* WeightedWinData(const TensorTableEntry& entry, double weight,
+                              std::vector<char>& weighted_buffer,
+                              std::shared_ptr<Tensor>& weighted_tensor);
+
+  // Win_put (or win_accumulate) to a target on the same node, which writes
+  // the tensor times the weight into the shared memory of the target at once.
+  void WinPutOrAccumulateShared(const TensorTableEntry& entry,
+                                WindowManager& win_manager, char* target,
+                                double weight, bool accumulate);
+
+  // Win_put (or win_accumulate) and win_get with the transfers to all the
+  // targets in flight together, see BLUEFOG_WIN_BATCHED_RMA.
+  void WinPutOrAccumulateBatched(
+      TensorTableEntry& entry, WindowManager& win_manager,
+      const std::vector<std::pair<int, double>>& dst_weights, bool accumulate);
+  void WinGetBatched(TensorTableEntry& entry, WindowManager& win_manager);
+
+  // Win_put and win_accumulate of a window created with compression, called
+  // with the window of the target rank locked.
+  void WinPutCompressed(TensorTableEntry& entry, WindowManager& win_manager,
+                        MPI_Win mpi_win, int target_rank, double weight);
+  void WinAccumulateCompressed(TensorTableEntry& entry,
+                               WindowManager& win_manager, MPI_Win mpi_win,
+                               int target_rank, double weight);
+
+  // Shared by the fused allgather and neighbor_allgather.
+  void AllgathervWithFusion(std::vector<TensorTableEntry>& entries,
+                            Communicator comm_type);
+
+  void MemcpyWithDevice(void* dst, const void* src, size_t count, int device);
+
   void MemcpyInFusionBuffer(const std::vector<TensorTableEntry>& entries,
                             void*& buffer_data, size_t& buffer_len);
 
@@ -139,16 +234,43 @@ class MPIController {
 
   // flag indicating whether MPI multi-threading is supported.
   bool mpi_threads_supported_ = false;
+
+  // Chunks received by the streaming neighbor_allreduce are staged here.
+  std::vector<char> streaming_staging_buffer_;
+
+  // The compressed tensor sent followed by the compressed tensors received.
+  std::vector<char> compression_buffer_;
+  // Error of the compression fed back into the next tensor of the same name.
+  std::unordered_map<std::string, std::vector<float>> compression_residuals_;
+  // The payload decompressed again to update the residual.
+  std::vector<float> compression_scratch_;
+
+  // Weighted tensor of win_put and win_accumulate to one destination after
+  // another, reused by every destination instead of allocating a new tensor
+  // for each.
+  std::vector<char> win_weighted_buffer_;
+  // Weighted tensors of the batched win_put and win_accumulate, one for every
+  // distinct weight in flight.
+  std::vector<std::vector<char>> win_batched_weighted_buffers_;
+
+  // Scratch of the compressed win_put and win_accumulate. The RMA calls using
+  // them complete before the next target.
+  std::vector<float> win_topk_delta_;
+  std::vector<uint32_t> win_topk_indices_;
+  std::vector<float> win_topk_values_;
+  std::vector<int> win_topk_displacements_;
+  std::vector<char> win_compressed_payload_;
 };
 
 // Our distributed mutex definition is different from the parallel computation
-// concept. For a world size is N application, N mutex is created. Each
-// process associates with one mutex. For window memory, we create independent
+// concept. For a world size is N application, N mutex is created at each
+// process, one for every sender. For window memory, we create independent
 // local copies for each neighbor processes, so there is no conflict between
 // the writing process from the neighbors (like win_put and win_accumulate).
 // However, Win_sync (i.e update setup) will read it, which conflicted with
 // other writting process. When WinMutexAcquire is called, we typically lock
-// for all out-neighbors.
+// for all out-neighbors. The mutexes are queue locks, so the waiters spin on
+// their own memory and get the mutex in turn.
 Status MPIWinMutexAcquireImpl(std::shared_ptr<MPI_Win> mutex_win,
                               const std::vector<int>& acquire_ranks,
                               int self_rank, bool is_sync);
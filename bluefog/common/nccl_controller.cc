@@ -58,6 +58,10 @@ ncclDataType_t GetNCCLDataType(const DataType bf_data_type) {
       return ncclInt64;
     case DataType::BLUEFOG_FLOAT16:
       return ncclFloat16;
+#if NCCL_VERSION_CODE >= NCCL_VERSION(2, 10, 0)
+    case DataType::BLUEFOG_BFLOAT16:
+      return ncclBfloat16;
+#endif
     case DataType::BLUEFOG_FLOAT32:
       return ncclFloat32;
     case DataType::BLUEFOG_FLOAT64:
@@ -162,13 +162,11 @@ bool NCCLWindowManager::InitializeMutexWin() {
   if (!mutex_win_) {
      mutex_win_  = std::make_shared<MPI_Win>();
   }
-  // We only need one value for self mutex.
-  mutex_mem_.resize(global_size);
-  std::fill_n(mutex_mem_.data(), global_size, 0);
+  InitializeMutexWinMemory(mutex_mem_, global_size);
 
   int element_size = 0;
   MPI_Type_size(MPI_INT, &element_size);
-  int win_size = global_size * element_size;
+  int win_size = mutex_mem_.size() * element_size;
   MPI_Win_create((void *)mutex_mem_.data(), win_size, element_size, MPI_INFO_NULL, MPI_COMM_WORLD,
                  mutex_win_.get());
   return true;
@@ -16,6 +16,7 @@
 
 #include "operations.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
@@ -28,6 +29,11 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "common.h"
 #include "global_state.h"
 #include "logging.h"
@@ -41,7 +47,20 @@
 #define COORDINATE_RANK 0
 #define BLUEFOG_TIMELINE "BLUEFOG_TIMELINE"
 #define BLUEFOG_CYCLE_TIME "BLUEFOG_CYCLE_TIME"
+#define BLUEFOG_EVENT_DRIVEN "BLUEFOG_EVENT_DRIVEN"
 #define BLUEFOG_FUSION_THRESHOLD "BLUEFOG_FUSION_THRESHOLD"
+#define BLUEFOG_FUSION_REORDER_WINDOW "BLUEFOG_FUSION_REORDER_WINDOW"
+#define BLUEFOG_RESPONSE_CACHE_CAPACITY "BLUEFOG_RESPONSE_CACHE_CAPACITY"
+#define BLUEFOG_NEGOTIATION "BLUEFOG_NEGOTIATION"
+#define BLUEFOG_PIPELINE_EXECUTION "BLUEFOG_PIPELINE_EXECUTION"
+#define BLUEFOG_AUTOTUNE "BLUEFOG_AUTOTUNE"
+#define BLUEFOG_AUTOTUNE_LOG "BLUEFOG_AUTOTUNE_LOG"
+#define BLUEFOG_AUTOTUNE_CYCLES_PER_SAMPLE "BLUEFOG_AUTOTUNE_CYCLES_PER_SAMPLE"
+#define BLUEFOG_AUTOTUNE_WARMUP_SAMPLES "BLUEFOG_AUTOTUNE_WARMUP_SAMPLES"
+#define BLUEFOG_NEIGHBOR_ALLREDUCE_STREAMING "BLUEFOG_NEIGHBOR_ALLREDUCE_STREAMING"
+#define BLUEFOG_WIN_PROGRESS_THREAD "BLUEFOG_WIN_PROGRESS_THREAD"
+#define BLUEFOG_WIN_PROGRESS_INTERVAL "BLUEFOG_WIN_PROGRESS_INTERVAL"
+#define BLUEFOG_WIN_PROGRESS_CPU "BLUEFOG_WIN_PROGRESS_CPU"
 
 // Stall-check warning time
 #define STALL_WARNING_TIME std::chrono::seconds(60)
@@ -67,6 +86,14 @@ static bool global_background_thread_suspend = false;
 
 const auto SUSPEND_BACKGROUND_WAITTING_DURATION = std::chrono::microseconds(10);
 
+// Initial waiting time of the background thread in event-driven mode. It is
+// doubled for every idle cycle up to the cycle time.
+const auto MIN_IDLE_BACKOFF_DURATION = std::chrono::microseconds(10);
+
+// Tag of the point-to-point messages used in tree-based negotiation. It is the
+// smallest upper bound of tag guaranteed by MPI standard.
+const int TREE_NEGOTIATION_TAG = 32767;
+
 // Table for storing Tensor metadata on rank zero. This is used for error
 // checking, stall checking and size calculations, as well as determining
 // when a reduction is ready to be done (when all nodes are ready to do it).
@@ -347,9 +374,17 @@ Response ConstructResponse(MessageTable* message_table, std::string name) {
 
   std::vector<int32_t> devices;
   if (!error) {
-    devices.resize(requests.size());
-    for (auto& request : requests) {
-      devices[request.request_rank()] = request.device();
+    if ((int)requests.size() == mpi_context.size_) {
+      devices.resize(requests.size());
+      for (auto& request : requests) {
+        devices[request.request_rank()] = request.device();
+      }
+    } else {
+      // Under tree-based negotiation, only the requests with different
+      // signatures are kept.
+      for (auto& request : requests) {
+        devices.push_back(request.device());
+      }
     }
   }
 
@@ -409,6 +444,13 @@ void CheckForStalledTensors(BluefogGlobalState& state) {
         preamble = true;
       }
       std::cerr << tensor_name;
+      if (state.tree_negotiation) {
+        // Only the number of ready ranks is known under tree-based negotiation.
+        std::cerr << " [ready ranks: "
+                  << state.subtree_request_counts[tensor_name] << "/"
+                  << mpi_context.size_ << "]" << std::endl;
+        continue;
+      }
       std::cerr << " [missing ranks:";
       std::unordered_set<int32_t> ready_ranks;
       bool missing_preamble = false;
@@ -436,6 +478,12 @@ void CheckForStalledTensors(BluefogGlobalState& state) {
 
 bool RunLoopOnce(BluefogGlobalState& state);
 
+void SyncTunedParameters(BluefogGlobalState& state, bool force = false);
+
+void ExecutionThreadLoop(BluefogGlobalState& state);
+
+void WinProgressThreadLoop(BluefogGlobalState& state);
+
 void BackgroundThreadLoop(BluefogGlobalState& state) {
   auto mpi_ctx_manager = MPIContextManager();
   mpi_context.Initialize(std::vector<int>{}, mpi_ctx_manager);
@@ -463,6 +511,14 @@ void BackgroundThreadLoop(BluefogGlobalState& state) {
     state.cycle_time_ms = std::strtof(bluefog_cycle_time, nullptr);
   }
 
+  // Wake up the background thread on new requests instead of fixed cycle.
+  char* bluefog_event_driven = std::getenv(BLUEFOG_EVENT_DRIVEN);
+  if (bluefog_event_driven != nullptr && *bluefog_event_driven == '1') {
+    state.event_driven = true;
+    state.idle_backoff = MIN_IDLE_BACKOFF_DURATION;
+    BFLOG(DEBUG, mpi_context.rank_) << "Background thread is event-driven";
+  }
+
   // Override Tensor Fusion threshold, if it's set.
   auto bluefog_fusion_threshold = std::getenv(BLUEFOG_FUSION_THRESHOLD);
   if (bluefog_fusion_threshold != nullptr) {
@@ -470,11 +526,105 @@ void BackgroundThreadLoop(BluefogGlobalState& state) {
         std::strtol(bluefog_fusion_threshold, nullptr, 10);
   }
 
+  auto bluefog_fusion_reorder_window = std::getenv(BLUEFOG_FUSION_REORDER_WINDOW);
+  if (bluefog_fusion_reorder_window != nullptr) {
+    state.fusion_reorder_window = std::max(
+        1, (int)std::strtol(bluefog_fusion_reorder_window, nullptr, 10));
+  }
+
+  auto bluefog_streaming = std::getenv(BLUEFOG_NEIGHBOR_ALLREDUCE_STREAMING);
+  if (bluefog_streaming != nullptr && *bluefog_streaming == '1') {
+    state.neighbor_allreduce_streaming = true;
+  }
+
+  // Tune the fusion threshold and cycle time online, if it's set. The values
+  // above are used as the starting point.
+  auto bluefog_autotune_log = std::getenv(BLUEFOG_AUTOTUNE_LOG);
+  state.parameter_manager.Initialize(
+      mpi_context.rank_, state.tensor_fusion_threshold, state.cycle_time_ms,
+      bluefog_autotune_log != nullptr ? bluefog_autotune_log : "");
+  auto bluefog_autotune_cycles = std::getenv(BLUEFOG_AUTOTUNE_CYCLES_PER_SAMPLE);
+  if (bluefog_autotune_cycles != nullptr) {
+    state.parameter_manager.SetCyclesPerSample(
+        std::strtol(bluefog_autotune_cycles, nullptr, 10));
+  }
+  auto bluefog_autotune_warmup = std::getenv(BLUEFOG_AUTOTUNE_WARMUP_SAMPLES);
+  if (bluefog_autotune_warmup != nullptr) {
+    state.parameter_manager.SetWarmupSamples(
+        std::strtol(bluefog_autotune_warmup, nullptr, 10));
+  }
+  auto bluefog_autotune = std::getenv(BLUEFOG_AUTOTUNE);
+  if (bluefog_autotune != nullptr && *bluefog_autotune == '1') {
+    state.parameter_manager.SetAutoTuning(true);
+    SyncTunedParameters(state, /*force=*/true);
+  }
+
+  // Enable the response cache, if it's set.
+  auto bluefog_cache_capacity = std::getenv(BLUEFOG_RESPONSE_CACHE_CAPACITY);
+  if (bluefog_cache_capacity != nullptr) {
+    state.response_cache.set_capacity(
+        (uint32_t)std::strtol(bluefog_cache_capacity, nullptr, 10));
+  }
+
+  // Select the negotiation protocol, if it's set.
+  auto bluefog_negotiation = std::getenv(BLUEFOG_NEGOTIATION);
+  if (bluefog_negotiation != nullptr &&
+      std::string(bluefog_negotiation) == "tree") {
+    state.tree_negotiation = true;
+  }
+
   // Initialize the tensor count table. No tensors are available yet.
-  if (bluefog_global.controller->GetRank() == COORDINATE_RANK) {
+  if (bluefog_global.controller->GetRank() == COORDINATE_RANK ||
+      state.tree_negotiation) {
     state.message_table = std::unique_ptr<MessageTable>(new MessageTable());
   }
 
+  // Pipeline the negotiation and execution, if it's set. The execution thread
+  // communicates concurrently with the negotiation in background thread.
+  auto bluefog_pipeline_execution = std::getenv(BLUEFOG_PIPELINE_EXECUTION);
+  if (bluefog_pipeline_execution != nullptr &&
+      *bluefog_pipeline_execution == '1') {
+    if (state.controller->IsMpiThreadsSupported()) {
+      state.pipeline_execution = true;
+      state.execution_thread =
+          std::thread(ExecutionThreadLoop, std::ref(state));
+    } else {
+      BFLOG(WARNING, mpi_context.rank_)
+          << "BLUEFOG_PIPELINE_EXECUTION requires MPI_THREAD_MULTIPLE support. "
+          << "Set BLUEFOG_MPI_THREAD_LEVEL=3 to enable it.";
+    }
+  }
+
+  // Progress the one-sided ops targeting this process in another thread, if
+  // it's set.
+  auto bluefog_win_progress = std::getenv(BLUEFOG_WIN_PROGRESS_THREAD);
+  if (bluefog_win_progress != nullptr && *bluefog_win_progress == '1') {
+    if (state.controller->IsMpiThreadsSupported()) {
+      auto bluefog_win_progress_interval =
+          std::getenv(BLUEFOG_WIN_PROGRESS_INTERVAL);
+      if (bluefog_win_progress_interval != nullptr) {
+        state.win_progress_interval_us = std::max(
+            0, (int)std::strtol(bluefog_win_progress_interval, nullptr, 10));
+      }
+      auto bluefog_win_progress_cpu = std::getenv(BLUEFOG_WIN_PROGRESS_CPU);
+      if (bluefog_win_progress_cpu != nullptr) {
+        state.win_progress_cpu =
+            std::strtol(bluefog_win_progress_cpu, nullptr, 10);
+      }
+      // Collective, which is fine since the environment variables are the
+      // same on every rank.
+      MPI_Comm_dup(mpi_context.GetMPICommunicator(Communicator::GLOBAL),
+                   &state.win_progress_comm);
+      state.win_progress = true;
+      state.win_progress_thread =
+          std::thread(WinProgressThreadLoop, std::ref(state));
+    } else {
+      BFLOG(WARNING, mpi_context.rank_)
+          << "BLUEFOG_WIN_PROGRESS_THREAD requires MPI_THREAD_MULTIPLE support. "
+          << "Set BLUEFOG_MPI_THREAD_LEVEL=3 to enable it.";
+    }
+  }
+
   // Signal that initialization is completed.
   state.initialization_done = true;
   BFLOG(INFO, bluefog_global.controller->GetRank()) << "Bluefog Initialized";
@@ -488,6 +638,14 @@ void BackgroundThreadLoop(BluefogGlobalState& state) {
 
   // Signal that shutdown has been requested.
   state.shut_down = true;
+  if (state.pipeline_execution) {
+    state.execution_queue.Shutdown();
+    state.execution_thread.join();
+  }
+  if (state.win_progress) {
+    state.win_progress_thread.join();
+    MPI_Comm_free(&state.win_progress_comm);
+  }
   // Notify all outstanding operations that Bluefog has been shut down
   // and finalize tensor queue.
   std::vector<StatusCallback> callbacks;
@@ -495,6 +653,7 @@ void BackgroundThreadLoop(BluefogGlobalState& state) {
   for (auto& cb : callbacks) {
     cb(SHUT_DOWN_ERROR);
   }
+  state.controller->ClearCompressionResiduals();
 #if HAVE_NCCL
   // NCCL context has to be finalized before MPI since it relied on
   // several functions of MPI.
@@ -754,6 +913,13 @@ void PerformOperationWithFusion(std::vector<TensorTableEntry>& entries) {
   Vendor controller_vendor =
       DetermineController(first_entry.mpi_ops_type, first_entry.device);
 #if HAVE_NCCL
+  // NCCL controller only fuses allreduce and neighbor_allreduce.
+  if (controller_vendor == Vendor::NCCL &&
+      first_entry.mpi_ops_type != MPIOpsType::ALLREDUCE &&
+      first_entry.mpi_ops_type != MPIOpsType::NEIGHBOR_ALLREDUCE) {
+    PerformOperation(entries);
+    return;
+  }
   if (controller_vendor == Vendor::NCCL && !nccl_context.is_initialized) {
     bluefog_global.nccl_controller->Initialize();
     BFLOG(INFO, bluefog_global.controller->GetRank()) << "NCCL Initialized";
@@ -781,9 +947,7 @@ void PerformOperationWithFusion(std::vector<TensorTableEntry>& entries) {
     }
   }
 
-  // Only Allreduce and Neighbor_Allreduce are supported, mainly because
-  // other ops either no need to use fusion like win ops or not performance
-  // critical ops like allgather, broadcast, etc.
+  // Win ops and pair gossip are not fused since they are never negotiated.
   switch (first_entry.mpi_ops_type) {
     case MPIOpsType::ALLREDUCE:
       BFLOG(TRACE, bluefog_global.controller->GetRank())
@@ -815,13 +979,314 @@ void PerformOperationWithFusion(std::vector<TensorTableEntry>& entries) {
 #endif
       timeline.ActivityEndAll(entries);
       break;
+    case MPIOpsType::ALLGATHER:
+      BFLOG(TRACE, bluefog_global.controller->GetRank())
+          << "Processing fused " << first_entry.tensor_name << " and rest "
+          << std::to_string(entries.size()) << " tensors.";
+      timeline.ActivityStartAll(entries, "PROC_ALLGATHER");
+      bluefog_global.controller->Allgather(entries);
+      timeline.ActivityEndAll(entries);
+      break;
+    case MPIOpsType::BROADCAST:
+      BFLOG(TRACE, bluefog_global.controller->GetRank())
+          << "Processing fused " << first_entry.tensor_name << " and rest "
+          << std::to_string(entries.size()) << " tensors.";
+      timeline.ActivityStartAll(entries, "PROC_BROADCAST");
+      bluefog_global.controller->Broadcast(entries);
+      timeline.ActivityEndAll(entries);
+      break;
+    case MPIOpsType::NEIGHBOR_ALLGATHER:
+      BFLOG(TRACE, bluefog_global.controller->GetRank())
+          << "Processing fused " << first_entry.tensor_name << " and rest "
+          << std::to_string(entries.size()) << " tensors.";
+      timeline.ActivityStartAll(entries, "PROC_NEIGHBOR_ALLGATHER");
+      bluefog_global.controller->NeighborAllgather(entries);
+      timeline.ActivityEndAll(entries);
+      break;
     default:
       throw std::runtime_error(
-          "Only allreduce or neighbor_allreduce should be called within "
+          "Only allreduce, allgather, broadcast, neighbor_allreduce or "
+          "neighbor_allgather should be called within "
           "PerformOperationWithFusion");
   }
 }
 
+// Perform the entries, which are fused if there are more than one. When the
+// negotiation and execution are pipelined, they are handed over to the
+// execution thread instead.
+void DispatchOperation(BluefogGlobalState& state,
+                       std::vector<TensorTableEntry>&& entries) {
+  if (entries.empty()) {
+    return;
+  }
+  if (state.parameter_manager.IsAutoTuning()) {
+    for (auto& e : entries) {
+      if (e.tensor != nullptr) {
+        state.parameter_manager.AddBytes(e.tensor->size());
+      }
+    }
+  }
+  if (state.pipeline_execution) {
+    state.execution_queue.Push(std::move(entries));
+  } else if (entries.size() > 1) {
+    PerformOperationWithFusion(entries);
+  } else {
+    PerformOperation(entries);
+  }
+}
+
+// Many MPI implementations only progress a passive target operation when the
+// target enters the MPI library, so a process busy in computation stalls the
+// win_put and win_accumulate of all its neighbors. Probing for a message that
+// never comes is the cheapest call entering the progress engine. Nothing is
+// sent on the communicator probed, so it never matches a real message.
+void WinProgressThreadLoop(BluefogGlobalState& state) {
+#if defined(__linux__)
+  if (state.win_progress_cpu >= 0) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(state.win_progress_cpu, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) !=
+        0) {
+      BFLOG(WARNING, mpi_context.rank_)
+          << "Cannot pin the win progress thread to CPU "
+          << state.win_progress_cpu;
+    }
+  }
+#endif
+  BFLOG(DEBUG, mpi_context.rank_)
+      << "Win progress thread polls every " << state.win_progress_interval_us
+      << " us";
+  const auto interval =
+      std::chrono::microseconds(state.win_progress_interval_us);
+  while (!state.shut_down) {
+    int flag = 0;
+    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, state.win_progress_comm, &flag,
+               MPI_STATUS_IGNORE);
+    if (interval.count() > 0) {
+      std::this_thread::sleep_for(interval);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ExecutionThreadLoop(BluefogGlobalState& state) {
+  std::vector<TensorTableEntry> entries;
+  while (state.execution_queue.Pop(entries)) {
+    if (entries.size() > 1) {
+      PerformOperationWithFusion(entries);
+    } else {
+      PerformOperation(entries);
+    }
+    state.execution_queue.MarkDone();
+  }
+}
+
+void PerformOperationOfResponseList(BluefogGlobalState& state,
+                                    const ResponseList& response_list) {
+  for (auto& response : response_list.responses()) {
+    // The response list is identical on all ranks so that the cache keeps
+    // consistent across ranks.
+    state.response_cache.put(response);
+    std::vector<TensorTableEntry> nego_entries;
+    state.tensor_queue.GetTensorEntriesFromResponse(response, nego_entries);
+    DispatchOperation(state, std::move(nego_entries));
+  }
+}
+
+bool IsSameNeighborList(std::shared_ptr<std::vector<int>> n1,
+                        std::shared_ptr<std::vector<int>> n2) {
+  if (n1 == nullptr && n2 == nullptr) return true;
+  if (n1 == nullptr || n2 == nullptr) return false;
+  // The order matters as well.
+  return *n1 == *n2;
+}
+
+bool IsFusibleResponseType(Response::ResponseType response_type) {
+  return response_type == Response::ResponseType::ALLREDUCE ||
+         response_type == Response::ResponseType::ALLGATHER ||
+         response_type == Response::ResponseType::BROADCAST ||
+         response_type == Response::ResponseType::NEIGHBOR_ALLGATHER ||
+         response_type == Response::ResponseType::NEIGHBOR_ALLREDUCE;
+}
+
+// Whether the two single-tensor responses can be performed in one fused
+// operation, regardless of the fusion buffer size.
+bool IsFusionCompatible(const Response& response, const TensorTableEntry& entry,
+                        const Response& new_response,
+                        const TensorTableEntry& new_entry) {
+  if (response.response_type() != new_response.response_type() ||
+      response.devices() != new_response.devices() ||
+      entry.tensor->dtype() != new_entry.tensor->dtype() ||
+      entry.is_hierarchical != new_entry.is_hierarchical) {
+    return false;
+  }
+  if (response.response_type() == Response::ResponseType::NEIGHBOR_ALLREDUCE) {
+    return entry.dynamic_neighbors_enabled == new_entry.dynamic_neighbors_enabled &&
+           entry.streaming_reduce == new_entry.streaming_reduce &&
+           IsSameNeighborList(entry.send_neighbors, new_entry.send_neighbors) &&
+           IsSameNeighborList(entry.recv_neighbors, new_entry.recv_neighbors);
+  }
+  if (response.response_type() == Response::ResponseType::BROADCAST) {
+    return entry.root_rank == new_entry.root_rank;
+  }
+  return true;
+}
+
+// Number of elements the tensor takes in the fusion buffer.
+int64_t FusionBufferSize(const Response& response, const TensorTableEntry& entry) {
+  if (response.response_type() == Response::ResponseType::NEIGHBOR_ALLREDUCE) {
+    // The hierarchical neighbor_allreduce reduced in place receives into the
+    // shared memory instead.
+    if (entry.streaming_reduce) {
+      return entry.tensor->size();
+    }
+    // Recall that send_neighbors is empty or not determines we use partial
+    // neighbor allreduce or not.
+    int num_recv_neighbors = !entry.dynamic_neighbors_enabled
+                                 ? mpi_context.neighbor_indgree_
+                                 : entry.recv_neighbors->size();
+    // Unlike allreduce, the storage for neighbor_allreduce in fusion buffer
+    // is like [t_1, t_2 | t_1_n1, t_2_n1, t_1_n2, t_2_n2].
+    // Here t_1 and t_2  means self tensor 1 and 2 and _n1 and _n2 means the
+    // recieving tensors for neighbor 1 and 2;
+    return entry.tensor->size() * (1 + num_recv_neighbors);
+  }
+  // Similar for allgather and neighbor_allgather, assuming the tensors have the
+  // same size on all ranks. The actual size is checked when performing it.
+  if (response.response_type() == Response::ResponseType::ALLGATHER) {
+    return entry.tensor->size() * (1 + mpi_context.size_);
+  }
+  if (response.response_type() == Response::ResponseType::NEIGHBOR_ALLGATHER) {
+    return entry.tensor->size() * (1 + mpi_context.neighbor_indgree_);
+  }
+  return entry.tensor->size();
+}
+
+// Fuse the single-tensor responses into the response list. Responses are
+// bucketed by their compatibility so that interleaved streams, like tensors of
+// different dtypes, are still fused with their own kind. At most
+// fusion_reorder_window buckets are open at the same time; opening one more
+// closes the oldest bucket, which bounds how far a tensor can be reordered.
+// A bucket is added to the response list once it is closed. A response that
+// cannot be fused closes all the open buckets first, so it is never moved
+// ahead of the tensors before it, and a window of 1 keeps the original order.
+void PlanFusedResponses(BluefogGlobalState& state,
+                        std::deque<Response>& responses,
+                        ResponseList& response_list) {
+  struct FusionBucket {
+    Response response;
+    const TensorTableEntry* entry;
+    int64_t tensor_size;
+  };
+  std::deque<FusionBucket> open_buckets;
+
+  auto CloseBucket = [&response_list,
+                      &open_buckets](std::deque<FusionBucket>::iterator it) {
+    response_list.add_response(std::move(it->response));
+    open_buckets.erase(it);
+  };
+  auto AddUnfusedResponse = [&response_list, &open_buckets,
+                             &CloseBucket](Response&& response) {
+    while (!open_buckets.empty()) {
+      CloseBucket(open_buckets.begin());
+    }
+    response_list.add_response(std::move(response));
+  };
+
+  while (!responses.empty()) {
+    Response response = std::move(responses.front());
+    assert(response.tensor_names().size() == 1);
+    responses.pop_front();
+
+    if (!IsFusibleResponseType(response.response_type())) {
+      AddUnfusedResponse(std::move(response));
+      continue;
+    }
+
+    const TensorTableEntry& entry =
+        state.tensor_queue.GetTensorEntry(response.tensor_names()[0]);
+    // Streaming and compressed neighbor_allreduce have no room for the fusion
+    // buffer layout. The hierarchical one reduced in place only fuses inputs.
+    if ((entry.streaming_reduce && !entry.is_hierarchical) ||
+        entry.compression != CompressionType::NONE) {
+      AddUnfusedResponse(std::move(response));
+      continue;
+    }
+    int64_t tensor_size = FusionBufferSize(response, entry);
+
+    auto it = std::find_if(
+        open_buckets.begin(), open_buckets.end(),
+        [&response, &entry](const FusionBucket& bucket) {
+          return IsFusionCompatible(bucket.response, *bucket.entry, response,
+                                    entry);
+        });
+    if (it != open_buckets.end()) {
+      if (it->tensor_size + tensor_size <= state.tensor_fusion_threshold) {
+        // These tensors will fuse together well.
+        it->tensor_size += tensor_size;
+        it->response.add_tensor_name(response.tensor_names()[0]);
+        continue;
+      }
+      // The bucket is full. Later tensors of the same kind start a new one.
+      CloseBucket(it);
+    } else if ((int)open_buckets.size() >= state.fusion_reorder_window) {
+      CloseBucket(open_buckets.begin());
+    }
+    open_buckets.push_back(FusionBucket{std::move(response), &entry, tensor_size});
+  }
+
+  while (!open_buckets.empty()) {
+    CloseBucket(open_buckets.begin());
+  }
+}
+
+// Construct the responses for the tensors that all ranks are ready for, fuse
+// them if possible, then broadcast the response list to all ranks and perform.
+// Only called on the coordinator.
+void CoordinateResponses(BluefogGlobalState& state,
+                         const std::vector<std::string>& ready_to_reduce,
+                         bool& should_change_topo, bool& should_shut_down) {
+  // At this point, rank zero should have a fully updated tensor count
+  // table and should know all the tensors that need to be reduced or
+  // gathered, and everyone else should have sent all their information
+  // to rank zero. We can now do reductions and gathers; rank zero will
+  // choose which ones and in what order, and will notify the other ranks
+  // before doing each reduction.
+  std::deque<Response> responses;
+  for (auto& tensor_name : ready_to_reduce) {
+    Response response =
+        ConstructResponse(state.message_table.get(), tensor_name);
+    responses.push_back(std::move(response));
+  }
+
+  ResponseList response_list;
+  response_list.set_shutdown(should_shut_down);
+  response_list.set_change_topo(should_change_topo);
+
+  PlanFusedResponses(state, responses, response_list);
+
+  // Notify all nodes which tensors we'd like to reduce at this step.
+  std::string encoded_response;
+  ResponseList::SerializeToString(response_list, encoded_response);
+  int encoded_response_length = (int)encoded_response.length() + 1;
+  MPI_Bcast(&encoded_response_length, 1, MPI_INT, COORDINATE_RANK,
+            mpi_context.negotiation_comm);
+  MPI_Bcast((void*)encoded_response.c_str(), encoded_response_length, MPI_BYTE,
+            COORDINATE_RANK, mpi_context.negotiation_comm);
+  // Perform the collective operation. All nodes should end up performing
+  // the same operation.
+  PerformOperationOfResponseList(state, response_list);
+
+  // Check for stalled tensors.
+  if (std::chrono::steady_clock::now() - state.last_stall_check >
+      STALL_WARNING_TIME) {
+    CheckForStalledTensors(state);
+    state.last_stall_check = std::chrono::steady_clock::now();
+  }
+}
+
 void NegotiateOfRequestOfMaster(BluefogGlobalState& state,
                                 std::deque<Request>& message_queue_buffer,
                                 bool& should_change_topo,
@@ -848,7 +1313,7 @@ void NegotiateOfRequestOfMaster(BluefogGlobalState& state,
   auto recvcounts = new int[bluefog_size()];
   recvcounts[0] = 0;
   MPI_Gather(MPI_IN_PLACE, 1, MPI_INT, recvcounts, 1, MPI_INT, COORDINATE_RANK,
-             mpi_context.mpi_comm);
+             mpi_context.negotiation_comm);
 
   // 2. Compute displacements.
   auto displcmnts = new int[bluefog_size()];
@@ -865,7 +1330,7 @@ void NegotiateOfRequestOfMaster(BluefogGlobalState& state,
   // 3. Collect messages from every rank.
   auto buffer = new uint8_t[total_size];
   MPI_Gatherv(nullptr, 0, MPI_BYTE, buffer, recvcounts, displcmnts, MPI_BYTE,
-              COORDINATE_RANK, mpi_context.mpi_comm);
+              COORDINATE_RANK, mpi_context.negotiation_comm);
 
   // 4. Process messages.
   for (int i = 1; i < bluefog_size(); i++) {
@@ -893,141 +1358,32 @@ void NegotiateOfRequestOfMaster(BluefogGlobalState& state,
   delete[] displcmnts;
   delete[] buffer;
 
-  // At this point, rank zero should have a fully updated tensor count
-  // table and should know all the tensors that need to be reduced or
-  // gathered, and everyone else should have sent all their information
-  // to rank zero. We can now do reductions and gathers; rank zero will
-  // choose which ones and in what order, and will notify the other ranks
-  // before doing each reduction.
-  std::deque<Response> responses;
-  for (auto& tensor_name : ready_to_reduce) {
-    Response response =
-        ConstructResponse(state.message_table.get(), tensor_name);
-    responses.push_back(std::move(response));
-  }
+  CoordinateResponses(state, ready_to_reduce, should_change_topo,
+                      should_shut_down);
+}
 
+// Receive the response list broadcasted by the coordinator and perform.
+void ReceiveResponses(BluefogGlobalState& state, bool& should_change_topo,
+                      bool& should_shut_down) {
+  int msg_length;
+  MPI_Bcast(&msg_length, 1, MPI_INT, COORDINATE_RANK,
+            mpi_context.negotiation_comm);
+  auto buffer = new uint8_t[msg_length];
+  MPI_Bcast(buffer, msg_length, MPI_BYTE, COORDINATE_RANK,
+            mpi_context.negotiation_comm);
   ResponseList response_list;
-  response_list.set_shutdown(should_shut_down);
-  response_list.set_change_topo(should_change_topo);
-
-  while (!responses.empty()) {
-    Response response = responses.front();
-    assert(response.tensor_names().size() == 1);
-    responses.pop_front();
-
-    if (response.response_type() == Response::ResponseType::ALLREDUCE) {
-      // Attempt to add more responses to this fused response.
-      const TensorTableEntry& entry =
-          state.tensor_queue.GetTensorEntry(response.tensor_names()[0]);
-      int64_t tensor_size = entry.tensor->size();
-      while (!responses.empty()) {
-        Response new_response = responses.front();
-        assert(new_response.tensor_names().size() == 1);
-        const TensorTableEntry& new_entry =
-            state.tensor_queue.GetTensorEntry(new_response.tensor_names()[0]);
-        int64_t new_tensor_size = new_entry.tensor->size();
-        if (response.response_type() == new_response.response_type() &&
-            response.devices() == new_response.devices() &&
-            entry.tensor->dtype() == new_entry.tensor->dtype() &&
-            entry.is_hierarchical == new_entry.is_hierarchical &&
-            tensor_size + new_tensor_size <= state.tensor_fusion_threshold) {
-          // These tensors will fuse together well.
-          tensor_size += new_tensor_size;
-          response.add_tensor_name(new_response.tensor_names()[0]);
-          responses.pop_front();
-        } else {
-          // Don't try to fuse additional tensors since they are usually
-          // computed in order of requests and skipping tensors may mean
-          // that the batch will have to wait longer while skipped tensors
-          // could be reduced at that time.
-          break;
-        }
-      }
-    } else if (response.response_type() ==
-               Response::ResponseType::NEIGHBOR_ALLREDUCE) {
-      // Attempt to add more responses to this fused response.
-      const TensorTableEntry& entry =
-          state.tensor_queue.GetTensorEntry(response.tensor_names()[0]);
-      auto IsSameNeighborList =
-          [](std::shared_ptr<std::vector<int>> n1,
-             std::shared_ptr<std::vector<int>> n2) -> bool {
-        if (n1 == nullptr && n2 == nullptr) return true;
-        if (n1 == nullptr || n2 == nullptr) return false;
-        if (n1->size() != n2->size()) return false;
-        // The order matters as well.
-        for (int i = 0; i < n1->size(); i++) {
-          if (n1->at(i) != n2->at(i)) {
-            return false;
-          }
-        }
-        return true;
-      };
-      // Recall that send_neighbors is empty or not determines we use partial
-      // neighbor allreduce or not.
-      int num_recv_neighbors = !entry.dynamic_neighbors_enabled
-                                   ? mpi_context.neighbor_indgree_
-                                   : entry.recv_neighbors->size();
-      // Unlike allreduce, the storage for neighbor_allreduce in fusion buffer
-      // is like [t_1, t_2 | t_1_n1, t_2_n1, t_1_n2, t_2_n2].
-      // Here t_1 and t_2  means self tensor 1 and 2 and _n1 and _n2 means the
-      // recieving tensors for neighbor 1 and 2;
-      int64_t tensor_size = entry.tensor->size() * (1 + num_recv_neighbors);
-
-      while (!responses.empty()) {
-        Response new_response = responses.front();
-        assert(new_response.tensor_names().size() == 1);
-        const TensorTableEntry& new_entry =
-            state.tensor_queue.GetTensorEntry(new_response.tensor_names()[0]);
-        int64_t new_tensor_size =
-            new_entry.tensor->size() * (1 + num_recv_neighbors);
-        if (response.response_type() == new_response.response_type() &&
-            response.devices() == new_response.devices() &&
-            entry.tensor->dtype() == new_entry.tensor->dtype() &&
-            entry.dynamic_neighbors_enabled == new_entry.dynamic_neighbors_enabled &&
-            entry.is_hierarchical == new_entry.is_hierarchical &&
-            IsSameNeighborList(entry.send_neighbors,
-                               new_entry.send_neighbors) &&
-            IsSameNeighborList(entry.recv_neighbors,
-                               new_entry.recv_neighbors) &&
-            tensor_size + new_tensor_size <= state.tensor_fusion_threshold) {
-          // These tensors will fuse together well.
-          tensor_size += new_tensor_size;
-          response.add_tensor_name(new_response.tensor_names()[0]);
-          responses.pop_front();
-        } else {
-          break;
-        }
-      }
-    }
-
-    response_list.add_response(response);
-  }
+  ResponseList::ParseFromBytes(response_list, buffer);
+  delete[] buffer;
 
-  // Notify all nodes which tensors we'd like to reduce at this step.
-  std::string encoded_response;
-  ResponseList::SerializeToString(response_list, encoded_response);
-  int encoded_response_length = (int)encoded_response.length() + 1;
-  MPI_Bcast(&encoded_response_length, 1, MPI_INT, COORDINATE_RANK,
-            mpi_context.mpi_comm);
-  MPI_Bcast((void*)encoded_response.c_str(), encoded_response_length, MPI_BYTE,
-            COORDINATE_RANK, mpi_context.mpi_comm);
   // Perform the collective operation. All nodes should end up performing
   // the same operation.
-  for (auto& response : response_list.responses()) {
-    std::vector<TensorTableEntry> nego_entries;
-    state.tensor_queue.GetTensorEntriesFromResponse(response, nego_entries);
-    if (nego_entries.size() > 1) {
-      PerformOperationWithFusion(nego_entries);
-    } else {
-      PerformOperation(nego_entries);
-    }
-  }
+  PerformOperationOfResponseList(state, response_list);
 
-  // Check for stalled tensors.
-  if (std::chrono::steady_clock::now() - state.last_stall_check >
-      STALL_WARNING_TIME) {
-    CheckForStalledTensors(state);
-    state.last_stall_check = std::chrono::steady_clock::now();
+  if (response_list.shutdown()) {
+    should_shut_down = true;
+  }
+  if (response_list.change_topo()) {
+    should_change_topo = true;
   }
 }
 
@@ -1046,44 +1402,165 @@ void NegotiateOfRequestOfSlave(BluefogGlobalState& state,
   RequestList::SerializeToString(message_list, encoded_message);
   int encoded_message_length = (int)encoded_message.length() + 1;
   MPI_Gather(&encoded_message_length, 1, MPI_INT, nullptr, 1, MPI_INT,
-             COORDINATE_RANK, mpi_context.mpi_comm);
+             COORDINATE_RANK, mpi_context.negotiation_comm);
   MPI_Gatherv((void*)encoded_message.c_str(), encoded_message_length, MPI_BYTE,
               nullptr, nullptr, nullptr, MPI_BYTE, COORDINATE_RANK,
-              mpi_context.mpi_comm);
+              mpi_context.negotiation_comm);
 
-  int msg_length;
-  MPI_Bcast(&msg_length, 1, MPI_INT, COORDINATE_RANK, mpi_context.mpi_comm);
-  auto buffer = new uint8_t[msg_length];
-  MPI_Bcast(buffer, msg_length, MPI_BYTE, COORDINATE_RANK,
-            mpi_context.mpi_comm);
-  ResponseList response_list;
-  ResponseList::ParseFromBytes(response_list, buffer);
-  delete[] buffer;
+  ReceiveResponses(state, should_change_topo, should_shut_down);
+}
 
-  // Perform the collective operation. All nodes should end up performing
-  // the same operation.
-  for (auto& response : response_list.responses()) {
-    std::vector<TensorTableEntry> nego_entries;
-    state.tensor_queue.GetTensorEntriesFromResponse(response, nego_entries);
-    if (nego_entries.size() > 1) {
-      PerformOperationWithFusion(nego_entries);
-    } else {
-      PerformOperation(nego_entries);
+// Number of ranks in the subtree rooted at rank. The binomial tree is rooted
+// at rank 0 and the parent of rank is the one clearing its lowest set bit.
+int TreeSubtreeSize(int rank, int size) {
+  if (rank == 0) return size;
+  return std::min(rank & (-rank), size - rank);
+}
+
+std::vector<int> TreeChildren(int rank, int size) {
+  std::vector<int> children;
+  for (int mask = 1; (rank & mask) == 0; mask <<= 1) {
+    int child = rank | mask;
+    if (child >= size) break;
+    children.push_back(child);
+  }
+  return children;
+}
+
+bool IsSameRequestSignature(const Request& r1, const Request& r2) {
+  return r1.request_type() == r2.request_type() &&
+         r1.tensor_type() == r2.tensor_type() &&
+         r1.device() == r2.device() && r1.root_rank() == r2.root_rank() &&
+         r1.is_hierarchical() == r2.is_hierarchical() &&
+         r1.tensor_shape() == r2.tensor_shape();
+}
+
+// Store the request that represents count ranks of the subtree. Requests with
+// the same signature are only kept once. Return whether all ranks in the
+// subtree have requested that tensor.
+bool IncrementSubtreeTensorCount(BluefogGlobalState& state, const Request& msg,
+                                 int count, int subtree_size) {
+  const std::string& name = msg.tensor_name();
+  auto table_iter = state.message_table->find(name);
+  if (table_iter == state.message_table->end()) {
+    std::vector<Request> messages = {msg};
+    auto now = std::chrono::steady_clock::now();
+    state.message_table->emplace(name,
+                                 std::make_tuple(std::move(messages), now));
+    state.subtree_request_counts[name] = count;
+    return count == subtree_size;
+  }
+
+  std::vector<Request>& messages = std::get<0>(table_iter->second);
+  if (std::none_of(messages.begin(), messages.end(),
+                   [&msg](const Request& m) {
+                     return IsSameRequestSignature(m, msg);
+                   })) {
+    messages.push_back(msg);
+  }
+  int& total_count = state.subtree_request_counts[name];
+  total_count += count;
+  return count > 0 && total_count == subtree_size;
+}
+
+// Tree-based negotiation. Each rank receives the requests from its children,
+// then forwards a tensor to its parent only once all ranks of its subtree have
+// requested it. Hence, each tensor is represented by a few requests no matter
+// how many ranks are there, and the coordinator only receives messages from
+// O(log(size)) children. The response list is still broadcasted by the
+// coordinator so it is the same as the one of the default negotiation.
+void NegotiateOfRequestByTree(BluefogGlobalState& state,
+                              std::deque<Request>& message_queue_buffer,
+                              bool& should_change_topo,
+                              bool& should_shut_down) {
+  const int rank = mpi_context.rank_;
+  const int size = mpi_context.size_;
+  const int subtree_size = TreeSubtreeSize(rank, size);
+  std::vector<std::string> ready_to_reduce;
+  bool subtree_shut_down = state.shut_down || should_shut_down;
+  bool subtree_change_topo = should_change_topo;
+
+  while (!message_queue_buffer.empty()) {
+    Request& message = message_queue_buffer.front();
+    if (IncrementSubtreeTensorCount(state, message, 1, subtree_size)) {
+      ready_to_reduce.push_back(message.tensor_name());
     }
+    message_queue_buffer.pop_front();
   }
 
-  if (response_list.shutdown()) {
-    should_shut_down = true;
+  for (int child : TreeChildren(rank, size)) {
+    MPI_Status status;
+    MPI_Probe(child, TREE_NEGOTIATION_TAG, mpi_context.negotiation_comm,
+              &status);
+    int msg_length;
+    MPI_Get_count(&status, MPI_BYTE, &msg_length);
+    auto buffer = new uint8_t[msg_length];
+    MPI_Recv(buffer, msg_length, MPI_BYTE, child, TREE_NEGOTIATION_TAG,
+             mpi_context.negotiation_comm, MPI_STATUS_IGNORE);
+    RequestList received_message_list;
+    RequestList::ParseFromBytes(received_message_list, buffer);
+    delete[] buffer;
+
+    // The first request of a tensor stands for the whole subtree of the
+    // child, and the rest ones are only kept for error checking.
+    const int child_subtree_size = TreeSubtreeSize(child, size);
+    std::unordered_set<std::string> counted_names;
+    for (auto& received_message : received_message_list.requests()) {
+      auto& received_name = received_message.tensor_name();
+      int count =
+          counted_names.insert(received_name).second ? child_subtree_size : 0;
+      if (IncrementSubtreeTensorCount(state, received_message, count,
+                                      subtree_size)) {
+        ready_to_reduce.push_back(received_name);
+      }
+    }
+    if (received_message_list.shutdown()) {
+      subtree_shut_down = true;
+    }
+    if (received_message_list.change_topo()) {
+      subtree_change_topo = true;
+    }
   }
-  if (response_list.change_topo()) {
-    should_change_topo = true;
+
+  if (rank == COORDINATE_RANK) {
+    should_shut_down = subtree_shut_down;
+    should_change_topo = subtree_change_topo;
+    for (auto& tensor_name : ready_to_reduce) {
+      state.subtree_request_counts.erase(tensor_name);
+    }
+    CoordinateResponses(state, ready_to_reduce, should_change_topo,
+                        should_shut_down);
+    return;
+  }
+
+  RequestList message_list;
+  message_list.set_shutdown(subtree_shut_down);
+  message_list.set_change_topo(subtree_change_topo);
+  for (auto& tensor_name : ready_to_reduce) {
+    auto table_iter = state.message_table->find(tensor_name);
+    for (auto& message : std::get<0>(table_iter->second)) {
+      message_list.add_request(message);
+    }
+    state.message_table->erase(table_iter);
+    state.subtree_request_counts.erase(tensor_name);
   }
+  std::string encoded_message;
+  RequestList::SerializeToString(message_list, encoded_message);
+  int encoded_message_length = (int)encoded_message.length() + 1;
+  MPI_Send((void*)encoded_message.c_str(), encoded_message_length, MPI_BYTE,
+           rank & (rank - 1), TREE_NEGOTIATION_TAG,
+           mpi_context.negotiation_comm);
+
+  ReceiveResponses(state, should_change_topo, should_shut_down);
 }
 
 void NegotiationOfRequest(BluefogGlobalState& state,
                           std::deque<Request>& message_queue_buffer,
                           bool& should_change_topo, bool& should_shut_down) {
-  if (bluefog_rank() == COORDINATE_RANK) {
+  if (state.tree_negotiation) {
+    NegotiateOfRequestByTree(state, message_queue_buffer, should_change_topo,
+                             should_shut_down);
+  } else if (bluefog_rank() == COORDINATE_RANK) {
     NegotiateOfRequestOfMaster(state, message_queue_buffer, should_change_topo,
                                should_shut_down);
   } else {
@@ -1092,27 +1569,224 @@ void NegotiationOfRequest(BluefogGlobalState& state,
   }
 }
 
+// Negotiation with the response cache. Every rank marks the bits of cached
+// tensors that it is ready for. One MPI_Allreduce with bitwise and over the bit
+// vectors tells which cached tensors are ready on all ranks, which are performed
+// directly. The full negotiation through the coordinator only happens when some
+// rank has uncached requests, or wants to shut down or change the topology.
+//
+// The bit vector is laid out as [flag word | hit bits | valid bits]. The flag is
+// set if the rank has nothing for the coordinator. A valid bit is cleared if the
+// rank finds the cached signature mismatched, then all ranks drop that entry.
+void NegotiationOfRequestWithCache(BluefogGlobalState& state,
+                                   std::deque<Request>& message_queue_buffer,
+                                   bool& should_change_topo,
+                                   bool& should_shut_down) {
+  auto& cache = state.response_cache;
+  const uint32_t num_bits = cache.num_bits();
+  const int num_words = (num_bits + 63) / 64;
+  std::vector<uint64_t> bit_vector(1 + 2 * num_words, 0);
+  uint64_t* hit_bits = bit_vector.data() + 1;
+  uint64_t* valid_bits = hit_bits + num_words;
+  std::fill(valid_bits, valid_bits + num_words, ~0ull);
+
+  std::deque<Request> uncached_message_queue;
+  std::deque<Request> hit_message_queue;
+  auto CheckCache = [&](Request& message) {
+    auto cache_state = cache.cached(message);
+    if (cache_state == ResponseCache::HIT) {
+      uint32_t bit = cache.peek_cache_bit(message.tensor_name());
+      hit_bits[bit / 64] |= 1ull << (bit % 64);
+      hit_message_queue.push_back(std::move(message));
+    } else {
+      if (cache_state == ResponseCache::INVALID) {
+        uint32_t bit = cache.peek_cache_bit(message.tensor_name());
+        valid_bits[bit / 64] &= ~(1ull << (bit % 64));
+      }
+      cache.record_request(message);
+      uncached_message_queue.push_back(std::move(message));
+    }
+  };
+  // Cached requests from previous cycles are checked again since the entry may
+  // be evicted or invalidated in the meantime.
+  for (auto& message : state.cached_message_queue) {
+    CheckCache(message);
+  }
+  for (auto& message : message_queue_buffer) {
+    CheckCache(message);
+  }
+  message_queue_buffer.clear();
+
+  if (uncached_message_queue.empty() && !should_shut_down &&
+      !should_change_topo) {
+    bit_vector[0] = 1;
+  }
+  int ret_code = MPI_Allreduce(MPI_IN_PLACE, bit_vector.data(),
+                               (int)bit_vector.size(), MPI_UINT64_T, MPI_BAND,
+                               mpi_context.negotiation_comm);
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error(
+        "MPI_Allreduce failed in response cache negotiation, see MPI output "
+        "for details.");
+  }
+
+  // Drop the entries that some rank found invalid.
+  for (uint32_t bit = 0; bit < num_bits; bit++) {
+    if (!(valid_bits[bit / 64] & (1ull << (bit % 64)))) {
+      cache.erase(bit);
+    }
+  }
+
+  // Perform the cached tensors that all ranks are ready for. Tensors fused
+  // together by coordinator before are fused again, except the dynamic
+  // neighbor_allreduce since its neighbors may change every time.
+  std::map<uint64_t, Response> fused_responses;
+  std::vector<uint64_t> group_order;
+  std::unordered_set<std::string> agreed_names;
+  for (uint32_t bit = 0; bit < num_bits; bit++) {
+    if (!(hit_bits[bit / 64] & (1ull << (bit % 64)))) {
+      continue;
+    }
+    const Response& response = cache.get_response(bit);
+    const std::string& name = response.tensor_names()[0];
+    agreed_names.insert(name);
+    uint64_t group = cache.get_group(bit);
+    auto it = fused_responses.find(group);
+    bool fusible = IsFusibleResponseType(response.response_type());
+    if (fusible && response.response_type() == Response::NEIGHBOR_ALLREDUCE) {
+      const TensorTableEntry& entry = state.tensor_queue.GetTensorEntry(name);
+      fusible = !entry.dynamic_neighbors_enabled && !entry.streaming_reduce &&
+                entry.compression == CompressionType::NONE;
+    }
+    if (it != fused_responses.end() && fusible) {
+      it->second.add_tensor_name(name);
+    } else {
+      // Non-fusible response uses its own bit as a unique key.
+      uint64_t key = fusible ? group : (1ull << 63) | bit;
+      fused_responses.emplace(key, response);
+      group_order.push_back(key);
+    }
+  }
+  hit_message_queue.erase(
+      std::remove_if(hit_message_queue.begin(), hit_message_queue.end(),
+                     [&](const Request& message) {
+                       return agreed_names.count(message.tensor_name()) > 0;
+                     }),
+      hit_message_queue.end());
+  state.cached_message_queue = std::move(hit_message_queue);
+
+  ResponseList cached_response_list;
+  for (auto key : group_order) {
+    cached_response_list.add_response(fused_responses[key]);
+  }
+  for (auto& response : cached_response_list.responses()) {
+    std::vector<TensorTableEntry> cached_entries;
+    state.tensor_queue.GetTensorEntriesFromResponse(response, cached_entries);
+    DispatchOperation(state, std::move(cached_entries));
+  }
+
+  if (bit_vector[0] == 0) {
+    NegotiationOfRequest(state, uncached_message_queue, should_change_topo,
+                         should_shut_down);
+    // The fusion decision of cached responses relies on the topology.
+    if (should_change_topo) {
+      cache.clear();
+    }
+  } else {
+    assert(uncached_message_queue.empty());
+  }
+}
+
+// Apply the parameters chosen by the autotuning on the coordinator to all
+// ranks. All ranks count the cycles in the same way so that they broadcast at
+// the same cycle.
+void SyncTunedParameters(BluefogGlobalState& state, bool force) {
+  auto& parameter_manager = state.parameter_manager;
+  if (global_skip_negotiate_stage && parameter_manager.IsAutoTuning()) {
+    // Ranks are no longer running the cycles in step without negotiation.
+    BFLOG(WARNING, mpi_context.rank_)
+        << "Autotuning is stopped since the negotiation stage is skipped.";
+    parameter_manager.SetAutoTuning(false);
+    return;
+  }
+  if (!parameter_manager.NextCycle() && !force) {
+    return;
+  }
+  if (mpi_context.rank_ == COORDINATE_RANK && !force) {
+    parameter_manager.Update();
+  }
+  ParameterManager::Params params = parameter_manager.GetParams();
+  int ret_code = MPI_Bcast(&params, sizeof(params), MPI_BYTE, COORDINATE_RANK,
+                           mpi_context.negotiation_comm);
+  if (ret_code != MPI_SUCCESS) {
+    throw std::runtime_error(
+        "MPI_Bcast failed in autotuning, see MPI output for details.");
+  }
+  parameter_manager.SetParams(params);
+
+  state.cycle_time_ms = params.cycle_time_ms;
+  if (params.tensor_fusion_threshold != state.tensor_fusion_threshold) {
+    // The fused entries handed over before are performed with the fusion
+    // buffer of old size.
+    if (state.pipeline_execution) {
+      state.execution_queue.WaitUntilIdle();
+    }
+    // Cached fusion groups could be larger than the smaller fusion buffer.
+    if (params.tensor_fusion_threshold < state.tensor_fusion_threshold) {
+      state.response_cache.clear();
+    }
+    state.tensor_fusion_threshold = params.tensor_fusion_threshold;
+  }
+}
+
 bool RunLoopOnce(BluefogGlobalState& state) {
   // The coordinator sends a SHUTDOWN message to trigger shutdown.
   bool should_shut_down = state.shut_down;
   bool should_change_topo = state.setting_topology;
 
-  // This delay determines thread frequency and MPI message latency
-  auto sleep_duration =
-      state.last_cycle_start +
-      std::chrono::microseconds(long(state.cycle_time_ms * 1000.)) -
-      std::chrono::steady_clock::now();
-  if (sleep_duration > std::chrono::steady_clock::duration::zero()) {
-    std::this_thread::sleep_for(sleep_duration);
+  auto cycle_duration =
+      std::chrono::microseconds(long(state.cycle_time_ms * 1000.));
+  if (state.event_driven) {
+    // Wait until a new request arrives. The waiting time never exceeds the
+    // cycle time so that the negotiation with other ranks still goes on.
+    state.tensor_queue.WaitForMessages(
+        std::min(state.idle_backoff, cycle_duration));
+  } else {
+    // This delay determines thread frequency and MPI message latency
+    auto sleep_duration = state.last_cycle_start + cycle_duration -
+                          std::chrono::steady_clock::now();
+    if (sleep_duration > std::chrono::steady_clock::duration::zero()) {
+      std::this_thread::sleep_for(sleep_duration);
+    }
   }
   state.last_cycle_start = std::chrono::steady_clock::now();
   if (global_background_thread_suspend) {
     BFLOG(ERROR) << "Suspending";
     std::this_thread::sleep_for(std::chrono::seconds(3));
   }
+  if (state.parameter_manager.IsAutoTuning()) {
+    SyncTunedParameters(state);
+  }
 
   std::deque<Request> message_queue_buffer;
   state.tensor_queue.PopMessagesFromQueue(message_queue_buffer);
+  if (global_skip_negotiate_stage && !state.cached_message_queue.empty()) {
+    // Requests waiting on the response cache no longer need to negotiate.
+    message_queue_buffer.insert(message_queue_buffer.begin(),
+                                state.cached_message_queue.begin(),
+                                state.cached_message_queue.end());
+    state.cached_message_queue.clear();
+  }
+
+  if (state.event_driven) {
+    // Poll quickly again only when new work arrives. Pending entries waiting
+    // for slow ranks keep backing off, see the negotiation below.
+    if (!message_queue_buffer.empty()) {
+      state.idle_backoff = MIN_IDLE_BACKOFF_DURATION;
+    } else {
+      state.idle_backoff = std::min(state.idle_backoff * 2, cycle_duration);
+    }
+  }
 
   std::vector<TensorTableEntry> entries;
   auto IsRequestConvertToEntryDirectly = [](const Request& request) -> bool {
@@ -1137,21 +1811,42 @@ bool RunLoopOnce(BluefogGlobalState& state) {
                      IsRequestConvertToEntryDirectly),
       message_queue_buffer.end());
 
-  PerformOperation(entries);
+  if (state.pipeline_execution) {
+    // Keep the order with the negotiated entries performed before.
+    for (auto& entry : entries) {
+      DispatchOperation(state, std::vector<TensorTableEntry>{entry});
+    }
+  } else {
+    PerformOperation(entries);
+  }
 
   // For the rest requests, they needs to coordinate and neogiate.
   // Collect all tensors that are ready to be reduced. Record them in the
   // tensor count table (rank zero) or send them to rank zero to be
   // recorded (everyone else).
+  const size_t pending_entries = state.tensor_queue.PendingEntriesSize();
   if (global_skip_negotiate_stage) {
     // Pass don't do anything.
+  } else if (state.response_cache.capacity() > 0) {
+    NegotiationOfRequestWithCache(state, message_queue_buffer,
+                                  should_change_topo, should_shut_down);
   } else {
     NegotiationOfRequest(state, message_queue_buffer, should_change_topo,
                          should_shut_down);
   }
+  // The other ranks got ready for some of the pending entries, which are
+  // performed now, so more of them are likely to follow soon.
+  if (state.event_driven &&
+      state.tensor_queue.PendingEntriesSize() < pending_entries) {
+    state.idle_backoff = MIN_IDLE_BACKOFF_DURATION;
+  }
   // Seperate the setting topology and negotiate communnication.
   // TODO(ybc) Use conditional variable and mutex to re-implement this.
   if (should_change_topo) {
+    // The topology can only be changed after all ongoing operations finish.
+    if (state.pipeline_execution) {
+      state.execution_queue.WaitUntilIdle();
+    }
     bluefog_global.ready_to_setting_topology = true;
     while (!bluefog_global.setting_topology_done) {
       std::this_thread::sleep_for(SUSPEND_BACKGROUND_WAITTING_DURATION);
@@ -1201,6 +1896,7 @@ void bluefog_init() { InitializeBluefogOnce(); }
 void bluefog_shutdown() {
   if (bluefog_global.background_thread.joinable()) {
     bluefog_global.shut_down = true;
+    bluefog_global.tensor_queue.WakeUp();
     bluefog_global.background_thread.join();
     // Reset the initialization flag to allow restarting with bluefog_init(...)
     //bluefog_global.initialize_flag.clear();
@@ -1277,14 +1973,15 @@ int bluefog_set_topology(int indegree, const int* sources, int outdegree,
   }
 #endif
   bluefog_global.setting_topology = true;
+  bluefog_global.tensor_queue.WakeUp();
   while (!bluefog_global.ready_to_setting_topology.load()) {
     std::this_thread::sleep_for(SUSPEND_BACKGROUND_WAITTING_DURATION);
   }
-  bluefog_global.tensor_queue.LockTensorQueue();
+  // The ops enqueued from now on are not taken by the background thread until
+  // the topology is set.
   if (bluefog_global.tensor_queue.size() > 0) {
     BFLOG(ERROR)
         << "Cannot set the topology because there are unfinished MPI ops.";
-    bluefog_global.tensor_queue.UnlockTensorQueue();
     return -1;
   }
 
@@ -1296,7 +1993,6 @@ int bluefog_set_topology(int indegree, const int* sources, int outdegree,
     bluefog_global.nccl_controller->InitPeerCommunicators();
   }
 #endif
-  bluefog_global.tensor_queue.UnlockTensorQueue();
 
   bluefog_global.setting_topology = false;
   bluefog_global.setting_topology_done = true;
@@ -1385,6 +2081,20 @@ int bluefog_get_skip_negotiate_stage() {
   return GetSkipNegotiateStageState();
 }
 
+int bluefog_neighbor_allreduce_streaming() {
+  if (!bluefog_global.initialization_done) {
+    return -1;
+  }
+  return bluefog_global.neighbor_allreduce_streaming;
+}
+
+int bluefog_hierarchical_shared_memory() {
+  if (!bluefog_global.initialization_done) {
+    return -1;
+  }
+  return bluefog_global.controller->HierarchicalSharedMemoryEnabled();
+}
+
 int bluefog_suspend() {
   global_background_thread_suspend = true;
   return 1;
@@ -1445,6 +2155,7 @@ Status EnqueueTensorBroadcast(std::shared_ptr<Tensor> tensor,
   message.set_request_rank(bluefog_global.controller->GetRank());
   message.set_tensor_name(name);
   message.set_tensor_type(tensor->dtype());
+  message.set_root_rank(root_rank);
   message.set_device(device);
   message.set_request_type(Request::BROADCAST);
   for (int i = 0; i < tensor->shape().dims(); i++) {
@@ -1548,6 +2259,10 @@ Status EnqueueTensorNeighborAllreduce(std::shared_ptr<Tensor> tensor,
                                       bool dynamic_neighbors_enabled,
                                       bool is_hierarchical,
                                       bool enable_topo_check,
+                                      bool streaming_reduce, double self_weight,
+                                      const std::unordered_map<int, double>& neighbor_weights,
+                                      CompressionType compression,
+                                      double compression_ratio,
                                       const std::string& name, const int device,
                                       StatusCallback callback) {
   Request message;
@@ -1572,6 +2287,13 @@ Status EnqueueTensorNeighborAllreduce(std::shared_ptr<Tensor> tensor,
   e.dynamic_neighbors_enabled = dynamic_neighbors_enabled;
   e.is_hierarchical = is_hierarchical;
   e.enable_topo_check = enable_topo_check;
+  e.streaming_reduce = streaming_reduce;
+  e.compression = compression;
+  e.compression_ratio = compression_ratio;
+  if (streaming_reduce) {
+    e.self_weight = self_weight;
+    e.src_weights = neighbor_weights;
+  }
   e.device = device;
   e.callback = callback;
   e.mpi_ops_type = MPIOpsType::NEIGHBOR_ALLREDUCE;
@@ -1629,7 +2351,8 @@ Status EnqueueTensorPairGossip(std::shared_ptr<Tensor> tensor,
 Status EnqueueTensorWindowCreate(
     std::shared_ptr<Tensor> tensor,
     std::vector<std::shared_ptr<Tensor>> neighbor_tensors,
-    const std::string& name, const int device, StatusCallback callback) {
+    const std::string& name, const int device, CompressionType compression,
+    double compression_ratio, StatusCallback callback) {
   Request message;
   message.set_request_rank(bluefog_global.controller->GetRank());
   message.set_tensor_name("win_create." + name);  // Add prefix to diff win_ops on same window.
@@ -1647,6 +2370,8 @@ Status EnqueueTensorWindowCreate(
   e.mpi_ops_type = MPIOpsType::WIN_CREATE;
   e.tensor = tensor;
   e.neighbor_tensors = neighbor_tensors;
+  e.compression = compression;
+  e.compression_ratio = compression_ratio;
 
   if (bluefog_global.shut_down) {
     return SHUT_DOWN_ERROR;
@@ -1789,7 +2514,8 @@ Status ExecuteBarrier(StatusCallback callback) {
   return Status::OK();
 }
 
-Status WindowSync(const std::string& name, int device) {
+Status WindowSync(const std::string& name, int device,
+                  const std::vector<int>& versions) {
   if (bluefog_global.shut_down) {
     return SHUT_DOWN_ERROR;
   }
@@ -1805,8 +2531,8 @@ Status WindowSync(const std::string& name, int device) {
   }
 #endif
   if (vendor == Vendor::MPI) {
-    status = bluefog_global.controller->WinSync(name, device,
-                                                global_with_associated_p_state);
+    status = bluefog_global.controller->WinSync(
+        name, device, global_with_associated_p_state, versions);
   }
 
   if (!status.ok()) {
@@ -1970,6 +2696,33 @@ Status GetWindowVersion(const std::string& name, std::vector<int>& versions) {
   return status;
 }
 
+Status GetWindowSharedBuffer(const std::string& name, int rank,
+                             void** buffer) {
+  if (bluefog_global.shut_down) {
+    return SHUT_DOWN_ERROR;
+  }
+  if (global_background_thread_suspend) {
+    return SUSPEND_ERROR;
+  }
+  return bluefog_global.controller->GetWinSharedNeighborBuffer(name, rank,
+                                                               buffer);
+}
+
+Status WaitWindowVersion(const std::string& name,
+                         const std::unordered_map<int, int>& min_versions,
+                         int max_staleness, double timeout_seconds,
+                         std::vector<int>& versions) {
+  if (bluefog_global.shut_down) {
+    return SHUT_DOWN_ERROR;
+  }
+  if (global_background_thread_suspend) {
+    return SUSPEND_ERROR;
+  }
+
+  return bluefog_global.controller->WinWaitVersion(
+      name, min_versions, max_staleness, timeout_seconds, versions);
+}
+
 // TODO(ybc) Add NCCL version for this as well.
 Status GetWinAssociatedPByNameAndRank(const std::string& name,
                                            const int rank, double* weight) {
@@ -2017,6 +2770,7 @@ void SetSkipNegotiateStageState(bool value) {
     // off negotiate stage. Otherwise, it may hang the processes. Use setting
     // topology flag to suspend the negotiate stage then skip it.
     bluefog_global.setting_topology = true;
+    bluefog_global.tensor_queue.WakeUp();
     while (!bluefog_global.ready_to_setting_topology.load()) {
       std::this_thread::sleep_for(SUSPEND_BACKGROUND_WAITTING_DURATION);
     }
@@ -106,6 +106,15 @@ void bluefog_set_skip_negotiate_stage(bool value);
 
 int bluefog_get_skip_negotiate_stage();
 
+// C interface to return flag indicating if the streaming neighbor_allreduce is
+// enabled. Returns -1 if Bluefog is not initialized.
+int bluefog_neighbor_allreduce_streaming();
+
+// C interface to return flag indicating if the hierarchical neighbor_allreduce
+// goes through the node-shared memory. Returns -1 if Bluefog is not
+// initialized.
+int bluefog_hierarchical_shared_memory();
+
 int bluefog_suspend();
 
 int bluefog_resume();
@@ -147,6 +156,10 @@ Status EnqueueTensorNeighborAllreduce(std::shared_ptr<Tensor> tensor,
                                       bool dynamic_neighbors_enabled,
                                       bool is_hierarchical,
                                       bool enable_topo_check,
+                                      bool streaming_reduce, double self_weight,
+                                      const std::unordered_map<int, double>& neighbor_weights,
+                                      CompressionType compression,
+                                      double compression_ratio,
                                       const std::string& name, const int device,
                                       StatusCallback callback);
 
@@ -159,7 +172,8 @@ Status EnqueueTensorPairGossip(std::shared_ptr<Tensor> tensor,
 Status EnqueueTensorWindowCreate(
     std::shared_ptr<Tensor> tensor,
     std::vector<std::shared_ptr<Tensor>> neighbor_tensors,
-    const std::string& name, int device, StatusCallback callback);
+    const std::string& name, int device, CompressionType compression,
+    double compression_ratio, StatusCallback callback);
 
 Status EnqueueTensorWindowFree(const std::string& name, int device,
                                StatusCallback callback);
@@ -186,7 +200,10 @@ Status EnqueueTensorWindowGet(const std::string& name,
 
 Status ExecuteBarrier(StatusCallback callback);
 
-Status WindowSync(const std::string& name, int device);
+// versions are the ones returned by WaitWindowVersion before, which are
+// taken off the version memory. If empty, the current versions are.
+Status WindowSync(const std::string& name, int device,
+                  const std::vector<int>& versions);
 
 Status WindowMutexAcquire(const std::string& name,
                           const std::vector<int>& acquire_ranks, int device,
@@ -205,6 +222,14 @@ Status SetWinAssociatedPByNameAndRank(const std::string& name, const int rank,
 Status GetWindowVersion(const std::string& name,
                         std::vector<int>& versions);
 
+Status GetWindowSharedBuffer(const std::string& name, int rank,
+                             void** buffer);
+
+Status WaitWindowVersion(const std::string& name,
+                         const std::unordered_map<int, int>& min_versions,
+                         int max_staleness, double timeout_seconds,
+                         std::vector<int>& versions);
+
 void SetWinOpsWithAssociatedPState(bool value);
 
 bool GetWinOpsWithAssociatedPState();
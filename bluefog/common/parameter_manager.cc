@@ -0,0 +1,169 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include "parameter_manager.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "logging.h"
+
+namespace bluefog {
+namespace common {
+
+void ParameterManager::Initialize(int rank, int64_t tensor_fusion_threshold,
+                                  double cycle_time_ms,
+                                  const std::string& log_file) {
+  rank_ = rank;
+  params_.tensor_fusion_threshold = tensor_fusion_threshold;
+  params_.cycle_time_ms = cycle_time_ms;
+  best_threshold_ = tensor_fusion_threshold;
+  best_cycle_time_ms_ = cycle_time_ms;
+
+  const int64_t MB = 1024 * 1024;
+  threshold_grid_ = {1 * MB, 2 * MB, 4 * MB, 8 * MB, 16 * MB, 32 * MB, 64 * MB};
+  cycle_time_grid_ = {0.1, 0.25, 0.5, 1.0, 2.5, 5.0};
+
+  if (rank_ == 0 && !log_file.empty()) {
+    log_file_.open(log_file, std::ios::out | std::ios::trunc);
+    log_file_ << "fusion_threshold,cycle_time_ms,bytes_per_second" << std::endl;
+  }
+}
+
+void ParameterManager::SetAutoTuning(bool active) {
+  params_.active = active ? 1 : 0;
+  if (!active) {
+    return;
+  }
+  dimension_ = 0;
+  candidate_ = 0;
+  scores_.assign(threshold_grid_.size(), 0.0);
+  SetCandidate();
+  sample_count_ = 0;
+  sample_scores_.clear();
+  sample_bytes_ = 0;
+  sample_start_ = std::chrono::steady_clock::now();
+}
+
+void ParameterManager::SetCyclesPerSample(int cycles_per_sample) {
+  cycles_per_sample_ = std::max(1, cycles_per_sample);
+}
+
+void ParameterManager::SetWarmupSamples(int warmup_samples) {
+  warmup_samples_ = std::max(0, warmup_samples);
+}
+
+void ParameterManager::SetSamplesPerCandidate(int samples_per_candidate) {
+  samples_per_candidate_ = std::max(1, samples_per_candidate);
+}
+
+bool ParameterManager::NextCycle() {
+  if (!IsAutoTuning()) {
+    return false;
+  }
+  if (++cycle_count_ < cycles_per_sample_) {
+    return false;
+  }
+  cycle_count_ = 0;
+  return true;
+}
+
+void ParameterManager::Update() {
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - sample_start_).count();
+  int64_t bytes = sample_bytes_;
+  sample_bytes_ = 0;
+  sample_start_ = now;
+  // Nothing is performed while idle, which says nothing about the candidate.
+  if (bytes == 0 || elapsed <= 0) {
+    return;
+  }
+  if (++sample_count_ <= warmup_samples_) {
+    return;
+  }
+  sample_scores_.push_back(bytes / elapsed);
+  if ((int)sample_scores_.size() < samples_per_candidate_) {
+    return;
+  }
+
+  double score =
+      std::accumulate(sample_scores_.begin(), sample_scores_.end(), 0.0) /
+      sample_scores_.size();
+  LogCandidate(score);
+  scores_[candidate_] = score;
+  sample_count_ = 0;
+  sample_scores_.clear();
+
+  if (++candidate_ < scores_.size()) {
+    SetCandidate();
+    return;
+  }
+  size_t best = std::max_element(scores_.begin(), scores_.end()) - scores_.begin();
+  if (dimension_ == 0) {
+    best_threshold_ = threshold_grid_[best];
+    dimension_ = 1;
+    candidate_ = 0;
+    scores_.assign(cycle_time_grid_.size(), 0.0);
+    SetCandidate();
+  } else {
+    best_cycle_time_ms_ = cycle_time_grid_[best];
+    Finish();
+  }
+}
+
+void ParameterManager::SetParams(const Params& params) {
+  params_ = params;
+  if (rank_ != 0) {
+    sample_bytes_ = 0;
+  }
+}
+
+void ParameterManager::SetCandidate() {
+  if (dimension_ == 0) {
+    params_.tensor_fusion_threshold = threshold_grid_[candidate_];
+    params_.cycle_time_ms = best_cycle_time_ms_;
+  } else {
+    params_.tensor_fusion_threshold = best_threshold_;
+    params_.cycle_time_ms = cycle_time_grid_[candidate_];
+  }
+}
+
+void ParameterManager::LogCandidate(double score) {
+  BFLOG(DEBUG, rank_) << "Autotuning candidate: fusion threshold "
+                      << params_.tensor_fusion_threshold << " bytes, cycle time "
+                      << params_.cycle_time_ms << " ms, " << score
+                      << " bytes/sec.";
+  if (log_file_.is_open()) {
+    log_file_ << params_.tensor_fusion_threshold << ","
+              << params_.cycle_time_ms << "," << score << std::endl;
+  }
+}
+
+void ParameterManager::Finish() {
+  params_.tensor_fusion_threshold = best_threshold_;
+  params_.cycle_time_ms = best_cycle_time_ms_;
+  params_.active = 0;
+  BFLOG(INFO, rank_) << "Autotuning finished. Set BLUEFOG_FUSION_THRESHOLD="
+                     << best_threshold_ << " and BLUEFOG_CYCLE_TIME="
+                     << best_cycle_time_ms_ << " to use the same setting.";
+  if (log_file_.is_open()) {
+    log_file_ << "# BLUEFOG_FUSION_THRESHOLD=" << best_threshold_
+              << " BLUEFOG_CYCLE_TIME=" << best_cycle_time_ms_ << std::endl;
+    log_file_.close();
+  }
+}
+
+}  // namespace common
+}  // namespace bluefog
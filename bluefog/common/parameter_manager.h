@@ -0,0 +1,107 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#ifndef BLUEFOG_COMMON_PARAMETER_MANAGER_H
+#define BLUEFOG_COMMON_PARAMETER_MANAGER_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace bluefog {
+namespace common {
+
+// Tune the fusion threshold and the cycle time online by measuring the
+// throughput, i.e. the bytes performed per second, of each candidate.
+//
+// The search is a coordinate search over fixed grids: the fusion threshold is
+// tuned first with the initial cycle time, then the cycle time is tuned with
+// the best fusion threshold. Only the coordinator makes the decision, which is
+// then broadcasted to all ranks every `cycles_per_sample` cycles.
+class ParameterManager {
+ public:
+  // Plain struct broadcasted as bytes.
+  struct Params {
+    int64_t tensor_fusion_threshold;
+    double cycle_time_ms;
+    // 0 once the tuning is finished.
+    int32_t active;
+  };
+
+  ParameterManager() = default;
+  ParameterManager(const ParameterManager&) = delete;
+
+  void Initialize(int rank, int64_t tensor_fusion_threshold,
+                  double cycle_time_ms, const std::string& log_file);
+
+  void SetAutoTuning(bool active);
+  inline bool IsAutoTuning() const { return params_.active != 0; }
+
+  void SetCyclesPerSample(int cycles_per_sample);
+  void SetWarmupSamples(int warmup_samples);
+  void SetSamplesPerCandidate(int samples_per_candidate);
+
+  // Record the bytes performed in the current cycle.
+  inline void AddBytes(int64_t bytes) { sample_bytes_ += bytes; }
+
+  // Count the cycle. Returns true if the parameters should be synchronized in
+  // this cycle. It must be called by all ranks in every cycle.
+  bool NextCycle();
+
+  // Finish the current sample and move to the next candidate if it is done.
+  // Only called by the coordinator.
+  void Update();
+
+  inline const Params& GetParams() const { return params_; }
+  void SetParams(const Params& params);
+
+ private:
+  void SetCandidate();
+  void LogCandidate(double score);
+  void Finish();
+
+  int rank_ = 0;
+  Params params_{0, 0.0, 0};
+
+  int cycles_per_sample_ = 100;
+  int warmup_samples_ = 1;
+  int samples_per_candidate_ = 3;
+  int cycle_count_ = 0;
+
+  // Candidates of the dimension under tuning and their scores.
+  std::vector<int64_t> threshold_grid_;
+  std::vector<double> cycle_time_grid_;
+  // 0 for tuning the fusion threshold and 1 for tuning the cycle time.
+  int dimension_ = 0;
+  size_t candidate_ = 0;
+  std::vector<double> scores_;
+  int64_t best_threshold_ = 0;
+  double best_cycle_time_ms_ = 0.0;
+
+  // Samples of the current candidate.
+  int sample_count_ = 0;
+  std::vector<double> sample_scores_;
+  int64_t sample_bytes_ = 0;
+  std::chrono::steady_clock::time_point sample_start_;
+
+  std::ofstream log_file_;
+};
+
+}  // namespace common
+}  // namespace bluefog
+
+#endif  // BLUEFOG_COMMON_PARAMETER_MANAGER_H
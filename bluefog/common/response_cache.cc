@@ -0,0 +1,148 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include "response_cache.h"
+
+#include <assert.h>
+
+namespace bluefog {
+namespace common {
+
+bool ResponseCache::IsCacheableType(Request::RequestType type) {
+  // Win create and free change the state of windows so that they always go
+  // through the coordinator.
+  return type == Request::ALLREDUCE || type == Request::ALLGATHER ||
+         type == Request::BROADCAST || type == Request::NEIGHBOR_ALLREDUCE ||
+         type == Request::NEIGHBOR_ALLGATHER;
+}
+
+void ResponseCache::set_capacity(uint32_t capacity) {
+  clear();
+  capacity_ = capacity;
+}
+
+ResponseCache::CacheState ResponseCache::cached(const Request& request) const {
+  auto it = name_to_bit_.find(request.tensor_name());
+  if (it == name_to_bit_.end()) {
+    return CacheState::MISS;
+  }
+  const Request& cached_request = entries_[it->second].request;
+  if (cached_request.request_type() == request.request_type() &&
+      cached_request.tensor_type() == request.tensor_type() &&
+      cached_request.device() == request.device() &&
+      cached_request.root_rank() == request.root_rank() &&
+      cached_request.is_hierarchical() == request.is_hierarchical() &&
+      cached_request.tensor_shape() == request.tensor_shape()) {
+    return CacheState::HIT;
+  }
+  return CacheState::INVALID;
+}
+
+uint32_t ResponseCache::peek_cache_bit(const std::string& tensor_name) const {
+  auto it = name_to_bit_.find(tensor_name);
+  assert(it != name_to_bit_.end());
+  return it->second;
+}
+
+void ResponseCache::record_request(const Request& request) {
+  if (capacity_ == 0 || !IsCacheableType(request.request_type())) {
+    return;
+  }
+  negotiating_requests_[request.tensor_name()] = request;
+}
+
+void ResponseCache::put(const Response& response) {
+  if (capacity_ == 0 || response.response_type() == Response::ERROR) {
+    for (auto& name : response.tensor_names()) {
+      negotiating_requests_.erase(name);
+    }
+    return;
+  }
+
+  uint64_t group = next_group_++;
+  for (size_t i = 0; i < response.tensor_names().size(); i++) {
+    const std::string& name = response.tensor_names()[i];
+    auto req_it = negotiating_requests_.find(name);
+    if (req_it == negotiating_requests_.end()) {
+      continue;
+    }
+
+    uint32_t bit;
+    auto name_it = name_to_bit_.find(name);
+    if (name_it != name_to_bit_.end()) {
+      bit = name_it->second;
+      lru_.erase(entries_[bit].lru_iter);
+    } else if (!free_bits_.empty()) {
+      bit = *free_bits_.begin();
+      free_bits_.erase(free_bits_.begin());
+    } else if (entries_.size() < capacity_) {
+      bit = (uint32_t)entries_.size();
+      entries_.emplace_back();
+    } else {
+      // Evict the least recently used one.
+      bit = lru_.back();
+      erase(bit);
+      free_bits_.erase(bit);
+    }
+
+    Response single_response;
+    single_response.set_response_type(response.response_type());
+    single_response.add_tensor_name(name);
+    single_response.set_devices(response.devices());
+
+    CacheEntry& entry = entries_[bit];
+    entry.active = true;
+    entry.request = std::move(req_it->second);
+    entry.response = std::move(single_response);
+    entry.group = group;
+    lru_.push_front(bit);
+    entry.lru_iter = lru_.begin();
+    name_to_bit_[name] = bit;
+    negotiating_requests_.erase(req_it);
+  }
+}
+
+const Response& ResponseCache::get_response(uint32_t bit) {
+  CacheEntry& entry = entries_[bit];
+  assert(entry.active);
+  lru_.splice(lru_.begin(), lru_, entry.lru_iter);
+  return entry.response;
+}
+
+uint64_t ResponseCache::get_group(uint32_t bit) const {
+  return entries_[bit].group;
+}
+
+void ResponseCache::erase(uint32_t bit) {
+  CacheEntry& entry = entries_[bit];
+  if (!entry.active) {
+    return;
+  }
+  name_to_bit_.erase(entry.request.tensor_name());
+  lru_.erase(entry.lru_iter);
+  entry.active = false;
+  free_bits_.insert(bit);
+}
+
+void ResponseCache::clear() {
+  entries_.clear();
+  name_to_bit_.clear();
+  free_bits_.clear();
+  lru_.clear();
+  negotiating_requests_.clear();
+}
+
+}  // namespace common
+}  // namespace bluefog
@@ -0,0 +1,105 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#ifndef BLUEFOG_COMMON_RESPONSE_CACHE_H
+#define BLUEFOG_COMMON_RESPONSE_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+
+namespace bluefog {
+namespace common {
+
+// Cache of the responses constructed by the coordinator, keyed by tensor name.
+//
+// Each cached response occupies one bit position. Since the cache is updated
+// only with the information that is identical on all ranks (the broadcasted
+// response list and the agreed bit vector), every rank assigns the same bit to
+// the same tensor. A request that hits the cache can be announced through its
+// bit only, instead of going through the gather and broadcast to the
+// coordinator.
+class ResponseCache {
+ public:
+  enum CacheState { MISS = 0, HIT = 1, INVALID = 2 };
+
+  ResponseCache() = default;
+  ResponseCache(const ResponseCache&) = delete;
+
+  void set_capacity(uint32_t capacity);
+  inline uint32_t capacity() const { return capacity_; }
+
+  // Number of bit positions currently used. Always the same on all ranks.
+  inline uint32_t num_bits() const { return (uint32_t)entries_.size(); }
+
+  // HIT if the cached response is built from the request with the same
+  // signature, INVALID if the signature is different, MISS otherwise.
+  CacheState cached(const Request& request) const;
+
+  uint32_t peek_cache_bit(const std::string& tensor_name) const;
+
+  // Remember the request that is sent to the coordinator, which is used as
+  // the signature once the response of it comes back.
+  void record_request(const Request& request);
+
+  // Cache the (possibly fused) response received from the coordinator.
+  // Tensors fused in the same response belong to the same group.
+  void put(const Response& response);
+
+  // Get the single-tensor response at the bit position and mark it as most
+  // recently used.
+  const Response& get_response(uint32_t bit);
+
+  uint64_t get_group(uint32_t bit) const;
+
+  void erase(uint32_t bit);
+
+  void clear();
+
+ private:
+  struct CacheEntry {
+    bool active = false;
+    Request request;
+    Response response;
+    uint64_t group = 0;
+    std::list<uint32_t>::iterator lru_iter;
+  };
+
+  static bool IsCacheableType(Request::RequestType type);
+
+  uint32_t capacity_ = 0;
+
+  // Indexed by the bit position.
+  std::vector<CacheEntry> entries_;
+  std::unordered_map<std::string, uint32_t> name_to_bit_;
+  // Released positions which are reused from the lowest one.
+  std::set<uint32_t> free_bits_;
+  // Most recently used bit is at the front.
+  std::list<uint32_t> lru_;
+  uint64_t next_group_ = 0;
+
+  // Requests which are under negotiation through the coordinator.
+  std::unordered_map<std::string, Request> negotiating_requests_;
+};
+
+}  // namespace common
+}  // namespace bluefog
+
+#endif  // BLUEFOG_COMMON_RESPONSE_CACHE_H
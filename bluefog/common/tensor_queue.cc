@@ -18,31 +18,205 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <thread>
+
 namespace bluefog {
 namespace common {
 
+// Large enough to hold the submissions of all the parameters of a model in
+// one step. The producers wait until there is space once it is full.
+#define SUBMISSION_RING_CAPACITY 4096
+
+// A producer finding the ring full yields this many times, and then sleeps
+// with the sleeping time doubled every time up to the maximum.
+#define SUBMISSION_MAX_YIELDS 64
+const auto MAX_SUBMISSION_BACKOFF = std::chrono::microseconds(100);
+
+SubmissionRing::SubmissionRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_.reset(new Slot[size]);
+  for (size_t i = 0; i < size; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+  enqueue_pos_.store(0, std::memory_order_relaxed);
+  dequeue_pos_.store(0, std::memory_order_relaxed);
+}
+
+bool SubmissionRing::TryPush(TensorSubmission&& submission) {
+  Slot* slot;
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    slot = &slots_[pos & mask_];
+    size_t seq = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      // The slot is free. Claim it by moving the enqueue position forward.
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The consumer has not read the slot of the previous round yet.
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->submission = std::move(submission);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool SubmissionRing::TryPop(TensorSubmission& submission) {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  Slot* slot = &slots_[pos & mask_];
+  if (slot->sequence.load(std::memory_order_acquire) != pos + 1) {
+    return false;
+  }
+  submission = std::move(slot->submission);
+  // Release the tensors held by the slot before handing it back.
+  slot->submission = TensorSubmission();
+  slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+  return true;
+}
+
+bool SubmissionRing::Empty() const {
+  size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  return slots_[pos & mask_].sequence.load(std::memory_order_acquire) !=
+         pos + 1;
+}
+
+size_t SubmissionRing::ApproxSize() const {
+  size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+  size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+  return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+TensorQueue::TensorQueue() : submission_ring_(SUBMISSION_RING_CAPACITY) {}
+
+TensorQueue::NameShard& TensorQueue::GetNameShard(const std::string& name) {
+  return name_shards_[std::hash<std::string>()(name) % NUM_NAME_SHARDS];
+}
+
+void TensorQueue::Submit(TensorSubmission&& submission) {
+  int yields = 0;
+  auto backoff = std::chrono::microseconds(1);
+  while (!submission_ring_.TryPush(std::move(submission))) {
+    if (yields < SUBMISSION_MAX_YIELDS) {
+      yields++;
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min(backoff * 2, MAX_SUBMISSION_BACKOFF);
+    }
+  }
+  // Pairs with the fence in WaitForMessages: either the producer sees the
+  // consumer waiting, or the consumer sees the new submission.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (consumer_waiting_.load(std::memory_order_relaxed)) {
+    { std::lock_guard<std::mutex> guard(wait_mutex_); }
+    message_cond_.notify_one();
+  }
+}
+
+int32_t TensorQueue::AcquireTensorId(const std::string& name) {
+  int32_t tensor_id;
+  if (!free_tensor_ids_.empty()) {
+    tensor_id = free_tensor_ids_.back();
+    free_tensor_ids_.pop_back();
+  } else {
+    tensor_id = (int32_t)tensor_table_.size();
+    tensor_table_.emplace_back();
+    tensor_id_in_use_.push_back(false);
+  }
+  tensor_id_in_use_[tensor_id] = true;
+  tensor_ids_[name] = tensor_id;
+  return tensor_id;
+}
+
+TensorTableEntry TensorQueue::ReleaseTensorId(int32_t tensor_id,
+                                              const std::string& name) {
+  assert(tensor_id_in_use_[tensor_id]);
+  TensorTableEntry e = std::move(tensor_table_[tensor_id]);
+  tensor_table_[tensor_id] = TensorTableEntry();
+  tensor_id_in_use_[tensor_id] = false;
+  free_tensor_ids_.push_back(tensor_id);
+  {
+    NameShard& shard = GetNameShard(name);
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    auto name_iter = shard.names_in_flight.find(name);
+    if (name_iter != shard.names_in_flight.end() && --name_iter->second == 0) {
+      shard.names_in_flight.erase(name_iter);
+    }
+  }
+  // Win ops may reuse the message name before the previous one is finished, in
+  // which case the name has been pointed to the newer id already.
+  auto iter = tensor_ids_.find(name);
+  if (iter != tensor_ids_.end() && iter->second == tensor_id) {
+    tensor_ids_.erase(iter);
+  }
+  return e;
+}
+
 // Add a TensorTableEntry as well as its message to the queue.
 Status TensorQueue::AddToTensorQueue(TensorTableEntry& e, Request& message) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  if (tensor_table_.find(e.tensor_name) != tensor_table_.end()) {
-    return DUPLICATE_NAME_ERROR;
-  }
   const std::string& name = message.tensor_name();
-  tensor_table_.emplace(name, std::move(e));
-  message_queue_.push(message);
+  if (e.tensor_name == name) {
+    NameShard& shard = GetNameShard(name);
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    if (shard.names_in_flight.find(name) != shard.names_in_flight.end()) {
+      return DUPLICATE_NAME_ERROR;
+    }
+    shard.names_in_flight[name]++;
+  } else {
+    // Win ops: the entry is named after the window and the message is not.
+    {
+      NameShard& shard = GetNameShard(e.tensor_name);
+      std::lock_guard<std::mutex> guard(shard.mutex);
+      if (shard.names_in_flight.find(e.tensor_name) !=
+          shard.names_in_flight.end()) {
+        return DUPLICATE_NAME_ERROR;
+      }
+    }
+    NameShard& shard = GetNameShard(name);
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    shard.names_in_flight[name]++;
+  }
+  TensorSubmission submission;
+  submission.entry = std::move(e);
+  submission.message = message;
+  submission.has_entry = true;
+  Submit(std::move(submission));
   return Status::OK();
 }
 
 // Put callbacks for each tensor in the callback buffer and clear tensor queue
 void TensorQueue::FinalizeTensorQueue(
     std::vector<StatusCallback>& callbacks_buffer) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  for (auto& e : tensor_table_) {
-    callbacks_buffer.emplace_back(e.second.callback);
+  TensorSubmission submission;
+  while (submission_ring_.TryPop(submission)) {
+    if (submission.has_entry) {
+      callbacks_buffer.emplace_back(submission.entry.callback);
+    }
+  }
+  for (size_t i = 0; i < tensor_table_.size(); i++) {
+    if (tensor_id_in_use_[i]) {
+      callbacks_buffer.emplace_back(tensor_table_[i].callback);
+    }
   }
   tensor_table_.clear();
-  while (!message_queue_.empty()) {
-    message_queue_.pop();
+  tensor_id_in_use_.clear();
+  free_tensor_ids_.clear();
+  tensor_ids_.clear();
+  for (int i = 0; i < NUM_NAME_SHARDS; i++) {
+    std::lock_guard<std::mutex> guard(name_shards_[i].mutex);
+    name_shards_[i].names_in_flight.clear();
   }
 }
 
@@ -53,31 +227,25 @@ void TensorQueue::GetTensorEntriesFromResponse(
   // Reserve to save re-allocation costs, as we know the size before.
   // entries may not be empty due to win_ops is processed at first.
   entries.reserve(entries.size() + response.tensor_names().size());
-  {
-    // Lock on the tensor table.
-    std::lock_guard<std::mutex> guard(mutex_);
-    for (auto& name : response.tensor_names()) {
-      auto iter = tensor_table_.find(name);
-      assert(iter != tensor_table_.end());
-
-      assert(response.response_type() == Response::ALLREDUCE ||
-             response.response_type() == Response::ALLGATHER ||
-             response.response_type() == Response::BROADCAST ||
-             response.response_type() == Response::NEIGHBOR_ALLGATHER ||
-             response.response_type() == Response::NEIGHBOR_ALLREDUCE ||
-             response.response_type() == Response::WIN_CREATE ||
-             response.response_type() == Response::WIN_FREE ||
-             response.response_type() == Response::ERROR);
-
-      if (response.response_type() == Response::ERROR) {
-        auto& e = iter->second;
-        e.callback(Status::PreconditionError(response.error_message()));
-      } else {
-        entries.push_back(std::move(iter->second));
-      }
+  for (auto& name : response.tensor_names()) {
+    auto iter = tensor_ids_.find(name);
+    assert(iter != tensor_ids_.end());
 
-      // Clear the tensor table of this tensor.
-      tensor_table_.erase(iter);
+    assert(response.response_type() == Response::ALLREDUCE ||
+           response.response_type() == Response::ALLGATHER ||
+           response.response_type() == Response::BROADCAST ||
+           response.response_type() == Response::NEIGHBOR_ALLGATHER ||
+           response.response_type() == Response::NEIGHBOR_ALLREDUCE ||
+           response.response_type() == Response::WIN_CREATE ||
+           response.response_type() == Response::WIN_FREE ||
+           response.response_type() == Response::ERROR);
+
+    // Clear the tensor table of this tensor.
+    TensorTableEntry e = ReleaseTensorId(iter->second, name);
+    if (response.response_type() == Response::ERROR) {
+      e.callback(Status::PreconditionError(response.error_message()));
+    } else {
+      entries.push_back(std::move(e));
     }
   }
 }
@@ -85,43 +253,101 @@ void TensorQueue::GetTensorEntriesFromResponse(
 // It should be used for no-coordinate request operator only.
 TensorTableEntry TensorQueue::GetTensorEntriesFromRequestDirectly(
     const Request& request) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  const std::string& name = request.tensor_name();
-
-  auto iter = tensor_table_.find(name);
-  assert(iter != tensor_table_.end());
-
-  TensorTableEntry e = iter->second;
-  // Clear the tensor table of this tensor.
-  tensor_table_.erase(iter);
-  return e;
+  // The request is generated locally so it carries the tensor id already.
+  return ReleaseTensorId(request.tensor_id(), request.tensor_name());
 }
 
 // Get tensor entry given a tensor name
 const TensorTableEntry& TensorQueue::GetTensorEntry(
     const std::string& tensor_name) const {
-  // Lock on the tensor table.
-  std::lock_guard<std::mutex> guard(mutex_);
-  auto& iter = tensor_table_.at(tensor_name);
-
-  return iter;
+  return tensor_table_[tensor_ids_.at(tensor_name)];
 }
 
-// Pop out all the messages from the queue
+// Pop out all the messages from the queue and move the submitted entries into
+// the tensor table.
 void TensorQueue::PopMessagesFromQueue(
     std::deque<Request>& message_queue_buffer) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  while (!message_queue_.empty()) {
-    Request message = message_queue_.front();
-    message_queue_.pop();
-    message_queue_buffer.push_back(std::move(message));
+  TensorSubmission submission;
+  while (submission_ring_.TryPop(submission)) {
+    if (submission.has_entry) {
+      int32_t tensor_id = AcquireTensorId(submission.message.tensor_name());
+      tensor_table_[tensor_id] = std::move(submission.entry);
+      submission.message.set_tensor_id(tensor_id);
+    }
+    message_queue_buffer.push_back(std::move(submission.message));
   }
 }
 
 // Push a message to massage queue
 void TensorQueue::PushMessageToQueue(Request& message) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  message_queue_.push(std::move(message));
+  TensorSubmission submission;
+  submission.message = std::move(message);
+  Submit(std::move(submission));
+}
+
+bool TensorQueue::WaitForMessages(std::chrono::microseconds timeout) {
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  consumer_waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  message_cond_.wait_for(lock, timeout, [this] {
+    return !submission_ring_.Empty() || wake_up_requested_;
+  });
+  consumer_waiting_.store(false, std::memory_order_relaxed);
+  wake_up_requested_ = false;
+  return !submission_ring_.Empty();
+}
+
+void TensorQueue::WakeUp() {
+  {
+    std::lock_guard<std::mutex> guard(wait_mutex_);
+    wake_up_requested_ = true;
+  }
+  message_cond_.notify_one();
+}
+
+size_t TensorQueue::PendingEntriesSize() const {
+  return tensor_table_.size() - free_tensor_ids_.size();
+}
+
+void ExecutionQueue::Push(std::vector<TensorTableEntry>&& entries) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    queue_.push_back(std::move(entries));
+  }
+  cond_.notify_all();
+}
+
+bool ExecutionQueue::Pop(std::vector<TensorTableEntry>& entries) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return !queue_.empty() || shut_down_; });
+  if (queue_.empty()) {
+    return false;
+  }
+  entries = std::move(queue_.front());
+  queue_.pop_front();
+  num_in_progress_++;
+  return true;
+}
+
+void ExecutionQueue::MarkDone() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    num_in_progress_--;
+  }
+  cond_.notify_all();
+}
+
+void ExecutionQueue::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return queue_.empty() && num_in_progress_ == 0; });
+}
+
+void ExecutionQueue::Shutdown() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    shut_down_ = true;
+  }
+  cond_.notify_all();
 }
 
 Status FusionBufferManager::InitializeBuffer(
@@ -154,5 +380,9 @@ std::shared_ptr<PersistentBuffer> FusionBufferManager::GetBuffer(int device) {
   return tensor_fusion_buffers_[device].first;
 }
 
+int64_t FusionBufferManager::GetBufferSize(int device) {
+  return tensor_fusion_buffers_[device].second;
+}
+
 }  // namespace common
 }  // namespace bluefog
\ No newline at end of file
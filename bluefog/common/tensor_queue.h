@@ -17,7 +17,12 @@
 #ifndef BLUEFOG_COMMON_TENSOR_QUEUE_H
 #define BLUEFOG_COMMON_TENSOR_QUEUE_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <queue>
 
@@ -27,10 +32,61 @@
 namespace bluefog {
 namespace common {
 
+// A tensor table entry and its message submitted by the framework threads.
+struct TensorSubmission {
+  TensorTableEntry entry;
+  Request message;
+  // False if only the message is pushed.
+  bool has_entry = false;
+};
+
+// Bounded lock-free ring buffer with multiple producers and a single consumer.
+// Each slot carries a sequence number telling whether it is ready to be
+// written by the producers or to be read by the consumer.
+class SubmissionRing {
+ public:
+  // Capacity is rounded up to a power of two.
+  explicit SubmissionRing(size_t capacity);
+  SubmissionRing(const SubmissionRing&) = delete;
+
+  // Returns false if the ring is full. Safe to be called by any thread.
+  bool TryPush(TensorSubmission&& submission);
+
+  // Returns false if the ring is empty. Only the consumer thread may call it.
+  bool TryPop(TensorSubmission& submission);
+
+  // Whether there is a submission ready to be popped out.
+  bool Empty() const;
+
+  // Approximated number of submissions in the ring.
+  size_t ApproxSize() const;
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    TensorSubmission submission;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  // Keep the positions on separate cache lines since producers and consumer
+  // update them concurrently.
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
+// The framework threads submit the tensors through a lock-free ring so that
+// enqueueing never waits for the background thread, unless the ring is full.
+// The tensor table is owned by the background thread: except
+// AddToTensorQueue, PushMessageToQueue, WakeUp and size, all methods must be
+// called from the background thread.
 class TensorQueue {
  public:
-  TensorQueue() = default;
+  TensorQueue();
   TensorQueue(const TensorQueue&) = delete;
+
+  // Returns DUPLICATE_NAME_ERROR if a tensor of the same name is still being
+  // processed.
   Status AddToTensorQueue(TensorTableEntry& e, Request& message);
 
   void FinalizeTensorQueue(std::vector<StatusCallback>& callbacks_buffer);
@@ -46,23 +102,96 @@ class TensorQueue {
 
   void PushMessageToQueue(Request& message);
 
-  // Used when setting Topology, which require the tensor queue should be empty always.
-  inline void LockTensorQueue() { mutex_.lock(); }
-  inline void UnlockTensorQueue() { mutex_.unlock(); }
-  inline size_t size() { return message_queue_.size(); }
+  // Block the caller until a new message is pushed, WakeUp() is called, or the
+  // timeout expires. Returns immediately if the message queue is not empty.
+  // Returns true if there are messages waiting in the queue.
+  bool WaitForMessages(std::chrono::microseconds timeout);
+
+  // Wake up the thread blocking in WaitForMessages, if any.
+  void WakeUp();
+
+  // Number of entries that are waiting to be processed, including the ones
+  // already popped out from message queue but still under negotiation.
+  size_t PendingEntriesSize() const;
+
+  // Number of submitted messages not taken by the background thread yet.
+  inline size_t size() const { return submission_ring_.ApproxSize(); }
 
  protected:
-  // Tensors waiting to be processed.
+  void Submit(TensorSubmission&& submission);
+
+  // Assign an id to the tensor. Ids of finished tensors are reused so that
+  // tensor_table_ is only as large as the number of tensors in flight.
+  int32_t AcquireTensorId(const std::string& name);
+  TensorTableEntry ReleaseTensorId(int32_t tensor_id, const std::string& name);
+
+  // Tensors waiting to be processed, indexed by tensor id. A deque is used so
+  // that the references returned by GetTensorEntry stay valid when it grows.
+  std::deque<TensorTableEntry> tensor_table_;
+  std::vector<bool> tensor_id_in_use_;
+  std::vector<int32_t> free_tensor_ids_;
+
+  // Only used to look up the tensors by the names coming from other ranks,
+  // which are the names in the responses. The ids stop at the tensor queue:
+  // the negotiation is keyed by name on the coordinator, and the repeated
+  // tensors skip it through the response cache instead.
   // Key is based upon the message name since tensor_name in table entry for win ops
   // is for window and we need to add "win_put."/"win_create." before it in message.
-  std::unordered_map<std::string, TensorTableEntry> tensor_table_;
+  std::unordered_map<std::string, int32_t> tensor_ids_;
+
+  // Tensors and MPI requests submitted but not taken by the background thread.
+  SubmissionRing submission_ring_;
+
+  // Number of the tensors of each message name submitted and not finished yet,
+  // checked by the framework threads for duplicated names. Win ops may reuse a
+  // message name before the previous one is finished, hence the count. The
+  // names are spread over shards by hash, so the threads enqueueing different
+  // names rarely take the same mutex.
+  struct alignas(64) NameShard {
+    std::mutex mutex;
+    std::unordered_map<std::string, int> names_in_flight;
+  };
+  static constexpr int NUM_NAME_SHARDS = 64;
+  NameShard& GetNameShard(const std::string& name);
+  NameShard name_shards_[NUM_NAME_SHARDS];
+
+  // Used to wake up the background thread when new message arrived. The
+  // producers only take the mutex when the background thread is waiting.
+  std::mutex wait_mutex_;
+  std::condition_variable message_cond_;
+  std::atomic<bool> consumer_waiting_{false};
+  bool wake_up_requested_ = false;
+};
+
+// Queue of negotiated entries waiting to be performed by the execution thread
+// when the negotiation and execution are pipelined. Each element is performed
+// as one operation, which is fused if it contains more than one entry.
+class ExecutionQueue {
+ public:
+  ExecutionQueue() = default;
+  ExecutionQueue(const ExecutionQueue&) = delete;
 
-  // Queue of MPI requests waiting to be sent to the coordinator node.
-  std::queue<Request> message_queue_;
+  void Push(std::vector<TensorTableEntry>&& entries);
 
-  // A mutex that needs to be used whenever operations on message queue are
-  // done.
-  mutable std::mutex mutex_;
+  // Block until there are entries to perform. Returns false once the queue
+  // is shut down and all entries are popped out.
+  bool Pop(std::vector<TensorTableEntry>& entries);
+
+  // Called by the execution thread after the popped entries are performed.
+  void MarkDone();
+
+  // Block until all pushed entries are performed.
+  void WaitUntilIdle();
+
+  void Shutdown();
+
+ private:
+  std::deque<std::vector<TensorTableEntry>> queue_;
+  // Number of elements popped out but not performed yet.
+  int num_in_progress_ = 0;
+  bool shut_down_ = false;
+  std::mutex mutex_;
+  std::condition_variable cond_;
 };
 
 // Encapsulates the process of creating and destroying fusion buffers as the requested
@@ -85,6 +214,9 @@ class FusionBufferManager {
   // Returns the buffer associated with the given device and framework, or null.
   std::shared_ptr<PersistentBuffer> GetBuffer(int device);
 
+  // Returns the size in bytes of the buffer associated with the given device.
+  int64_t GetBufferSize(int device);
+
  private:
   // Memory buffers for Tensor Fusion.  They are keyed by device ID.
   std::unordered_map<int, std::pair<std::shared_ptr<PersistentBuffer>, int64_t>>
@@ -0,0 +1,210 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#include "weighted_sum.h"
+
+#include <stdexcept>
+
+// The SIMD kernels are compiled with the target attribute and selected at
+// runtime, so the library does not require -mavx2 to build or run.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLUEFOG_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define BLUEFOG_X86_SIMD 0
+#endif
+
+namespace bluefog {
+namespace common {
+
+namespace {
+
+enum class SimdLevel { SCALAR, AVX2, AVX512 };
+
+SimdLevel GetSimdLevel() {
+  static const SimdLevel level = []() {
+#if BLUEFOG_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+  }();
+  return level;
+}
+
+// Every element of dst is written only after all the inputs of the same
+// element are read, which makes dst free to alias the inputs.
+template <typename T>
+void WeightedSumScalar(T* dst, const T* self, T self_weight,
+                       const T* const* srcs, const T* weights, int num_srcs,
+                       int64_t begin, int64_t end) {
+  for (int64_t j = begin; j < end; ++j) {
+    T acc = self_weight * self[j];
+    for (int i = 0; i < num_srcs; ++i) {
+      acc += weights[i] * srcs[i][j];
+    }
+    dst[j] = acc;
+  }
+}
+
+#if BLUEFOG_X86_SIMD
+// Two vectors are accumulated at the same time to hide the latency of fma.
+__attribute__((target("avx2,fma"))) void WeightedSumAvx2(
+    float* dst, const float* self, float self_weight, const float* const* srcs,
+    const float* weights, int num_srcs, int64_t count) {
+  const __m256 sw = _mm256_set1_ps(self_weight);
+  int64_t j = 0;
+  for (; j + 16 <= count; j += 16) {
+    __m256 acc0 = _mm256_mul_ps(sw, _mm256_loadu_ps(self + j));
+    __m256 acc1 = _mm256_mul_ps(sw, _mm256_loadu_ps(self + j + 8));
+    for (int i = 0; i < num_srcs; ++i) {
+      const __m256 w = _mm256_set1_ps(weights[i]);
+      acc0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(srcs[i] + j), acc0);
+      acc1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(srcs[i] + j + 8), acc1);
+    }
+    _mm256_storeu_ps(dst + j, acc0);
+    _mm256_storeu_ps(dst + j + 8, acc1);
+  }
+  WeightedSumScalar(dst, self, self_weight, srcs, weights, num_srcs, j, count);
+}
+
+__attribute__((target("avx2,fma"))) void WeightedSumAvx2(
+    double* dst, const double* self, double self_weight,
+    const double* const* srcs, const double* weights, int num_srcs,
+    int64_t count) {
+  const __m256d sw = _mm256_set1_pd(self_weight);
+  int64_t j = 0;
+  for (; j + 8 <= count; j += 8) {
+    __m256d acc0 = _mm256_mul_pd(sw, _mm256_loadu_pd(self + j));
+    __m256d acc1 = _mm256_mul_pd(sw, _mm256_loadu_pd(self + j + 4));
+    for (int i = 0; i < num_srcs; ++i) {
+      const __m256d w = _mm256_set1_pd(weights[i]);
+      acc0 = _mm256_fmadd_pd(w, _mm256_loadu_pd(srcs[i] + j), acc0);
+      acc1 = _mm256_fmadd_pd(w, _mm256_loadu_pd(srcs[i] + j + 4), acc1);
+    }
+    _mm256_storeu_pd(dst + j, acc0);
+    _mm256_storeu_pd(dst + j + 4, acc1);
+  }
+  WeightedSumScalar(dst, self, self_weight, srcs, weights, num_srcs, j, count);
+}
+
+__attribute__((target("avx512f"))) void WeightedSumAvx512(
+    float* dst, const float* self, float self_weight, const float* const* srcs,
+    const float* weights, int num_srcs, int64_t count) {
+  const __m512 sw = _mm512_set1_ps(self_weight);
+  int64_t j = 0;
+  for (; j + 32 <= count; j += 32) {
+    __m512 acc0 = _mm512_mul_ps(sw, _mm512_loadu_ps(self + j));
+    __m512 acc1 = _mm512_mul_ps(sw, _mm512_loadu_ps(self + j + 16));
+    for (int i = 0; i < num_srcs; ++i) {
+      const __m512 w = _mm512_set1_ps(weights[i]);
+      acc0 = _mm512_fmadd_ps(w, _mm512_loadu_ps(srcs[i] + j), acc0);
+      acc1 = _mm512_fmadd_ps(w, _mm512_loadu_ps(srcs[i] + j + 16), acc1);
+    }
+    _mm512_storeu_ps(dst + j, acc0);
+    _mm512_storeu_ps(dst + j + 16, acc1);
+  }
+  WeightedSumScalar(dst, self, self_weight, srcs, weights, num_srcs, j, count);
+}
+
+__attribute__((target("avx512f"))) void WeightedSumAvx512(
+    double* dst, const double* self, double self_weight,
+    const double* const* srcs, const double* weights, int num_srcs,
+    int64_t count) {
+  const __m512d sw = _mm512_set1_pd(self_weight);
+  int64_t j = 0;
+  for (; j + 16 <= count; j += 16) {
+    __m512d acc0 = _mm512_mul_pd(sw, _mm512_loadu_pd(self + j));
+    __m512d acc1 = _mm512_mul_pd(sw, _mm512_loadu_pd(self + j + 8));
+    for (int i = 0; i < num_srcs; ++i) {
+      const __m512d w = _mm512_set1_pd(weights[i]);
+      acc0 = _mm512_fmadd_pd(w, _mm512_loadu_pd(srcs[i] + j), acc0);
+      acc1 = _mm512_fmadd_pd(w, _mm512_loadu_pd(srcs[i] + j + 8), acc1);
+    }
+    _mm512_storeu_pd(dst + j, acc0);
+    _mm512_storeu_pd(dst + j + 8, acc1);
+  }
+  WeightedSumScalar(dst, self, self_weight, srcs, weights, num_srcs, j, count);
+}
+#endif
+
+template <typename T>
+void WeightedSumImpl(void* dst, const void* self, double self_weight,
+                     const std::vector<const void*>& srcs,
+                     const std::vector<double>& weights, int64_t count) {
+  const int num_srcs = srcs.size();
+  std::vector<const T*> typed_srcs(num_srcs);
+  std::vector<T> typed_weights(num_srcs);
+  for (int i = 0; i < num_srcs; ++i) {
+    typed_srcs[i] = static_cast<const T*>(srcs[i]);
+    typed_weights[i] = static_cast<T>(weights[i]);
+  }
+  T* typed_dst = static_cast<T*>(dst);
+  const T* typed_self = static_cast<const T*>(self);
+  const T typed_self_weight = static_cast<T>(self_weight);
+
+  switch (GetSimdLevel()) {
+#if BLUEFOG_X86_SIMD
+    case SimdLevel::AVX512:
+      WeightedSumAvx512(typed_dst, typed_self, typed_self_weight,
+                        typed_srcs.data(), typed_weights.data(), num_srcs,
+                        count);
+      return;
+    case SimdLevel::AVX2:
+      WeightedSumAvx2(typed_dst, typed_self, typed_self_weight,
+                      typed_srcs.data(), typed_weights.data(), num_srcs, count);
+      return;
+#endif
+    default:
+      WeightedSumScalar(typed_dst, typed_self, typed_self_weight,
+                        typed_srcs.data(), typed_weights.data(), num_srcs, 0,
+                        count);
+  }
+}
+
+}  // namespace
+
+bool WeightedSumSupported(DataType dtype) {
+  return dtype == DataType::BLUEFOG_FLOAT32 ||
+         dtype == DataType::BLUEFOG_FLOAT64;
+}
+
+void WeightedSum(DataType dtype, void* dst, const void* self,
+                 double self_weight, const std::vector<const void*>& srcs,
+                 const std::vector<double>& weights, int64_t count) {
+  if (srcs.size() != weights.size()) {
+    throw std::invalid_argument(
+        "WeightedSum expects one weight for every source.");
+  }
+  switch (dtype) {
+    case DataType::BLUEFOG_FLOAT32:
+      WeightedSumImpl<float>(dst, self, self_weight, srcs, weights, count);
+      break;
+    case DataType::BLUEFOG_FLOAT64:
+      WeightedSumImpl<double>(dst, self, self_weight, srcs, weights, count);
+      break;
+    default:
+      throw std::invalid_argument("WeightedSum does not support " +
+                                  DataType_Name(dtype) + ".");
+  }
+}
+
+}  // namespace common
+}  // namespace bluefog
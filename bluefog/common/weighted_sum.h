@@ -0,0 +1,42 @@
+// Copyright 2020 Bluefog Team. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ==============================================================================
+
+#ifndef BLUEFOG_COMMON_WEIGHTED_SUM_H
+#define BLUEFOG_COMMON_WEIGHTED_SUM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+namespace bluefog {
+namespace common {
+
+// Whether WeightedSum supports the dtype. Only float32 and float64 are
+// supported now.
+bool WeightedSumSupported(DataType dtype);
+
+// Computes dst = self_weight * self + sum_i weights[i] * srcs[i] over count
+// elements of dtype on CPU, reading every input once. It is vectorized with
+// AVX-512 or AVX2 if the CPU supports them, and falls back to the scalar loop
+// otherwise. dst may be the same buffer as self or any of srcs.
+void WeightedSum(DataType dtype, void* dst, const void* self,
+                 double self_weight, const std::vector<const void*>& srcs,
+                 const std::vector<double>& weights, int64_t count);
+
+}  // namespace common
+}  // namespace bluefog
+
+#endif  // BLUEFOG_COMMON_WEIGHTED_SUM_H
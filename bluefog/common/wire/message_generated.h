@@ -34,11 +34,12 @@ enum DataType {
   DataType_BLUEFOG_FLOAT64 = 8,
   DataType_BLUEFOG_BOOL = 9,
   DataType_BLUEFOG_BYTE = 10,
+  DataType_BLUEFOG_BFLOAT16 = 11,
   DataType_MIN = DataType_BLUEFOG_UINT8,
-  DataType_MAX = DataType_BLUEFOG_BYTE
+  DataType_MAX = DataType_BLUEFOG_BFLOAT16
 };
 
-inline const DataType (&EnumValuesDataType())[11] {
+inline const DataType (&EnumValuesDataType())[12] {
   static const DataType values[] = {
     DataType_BLUEFOG_UINT8,
     DataType_BLUEFOG_INT8,
@@ -50,13 +51,14 @@ inline const DataType (&EnumValuesDataType())[11] {
     DataType_BLUEFOG_FLOAT32,
     DataType_BLUEFOG_FLOAT64,
     DataType_BLUEFOG_BOOL,
-    DataType_BLUEFOG_BYTE
+    DataType_BLUEFOG_BYTE,
+    DataType_BLUEFOG_BFLOAT16
   };
   return values;
 }
 
 inline const char * const *EnumNamesDataType() {
-  static const char * const names[12] = {
+  static const char * const names[13] = {
     "BLUEFOG_UINT8",
     "BLUEFOG_INT8",
     "BLUEFOG_UINT16",
@@ -68,13 +70,14 @@ inline const char * const *EnumNamesDataType() {
     "BLUEFOG_FLOAT64",
     "BLUEFOG_BOOL",
     "BLUEFOG_BYTE",
+    "BLUEFOG_BFLOAT16",
     nullptr
   };
   return names;
 }
 
 inline const char *EnumNameDataType(DataType e) {
-  if (flatbuffers::IsOutRange(e, DataType_BLUEFOG_UINT8, DataType_BLUEFOG_BYTE)) return "";
+  if (flatbuffers::IsOutRange(e, DataType_BLUEFOG_UINT8, DataType_BLUEFOG_BFLOAT16)) return "";
   const size_t index = static_cast<size_t>(e);
   return EnumNamesDataType()[index];
 }
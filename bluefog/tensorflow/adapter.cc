@@ -105,6 +105,8 @@ const common::DataType TFTensor::dtype() const {
       return common::DataType::BLUEFOG_INT64;
     case ::tensorflow::DT_HALF:
       return common::DataType::BLUEFOG_FLOAT16;
+    case ::tensorflow::DT_BFLOAT16:
+      return common::DataType::BLUEFOG_BFLOAT16;
     case ::tensorflow::DT_FLOAT:
       return common::DataType::BLUEFOG_FLOAT32;
     case ::tensorflow::DT_DOUBLE:
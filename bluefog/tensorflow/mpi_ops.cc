@@ -82,7 +82,7 @@ REGISTER_KERNEL_BUILDER(
 #endif
 
 REGISTER_OP("BluefogAllreduce")
-    .Attr("T: {int32, int64, float32, float64}")
+    .Attr("T: {int32, int64, float32, float64, bfloat16}")
     .Input("tensor: T")
     .Output("sum: T")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
@@ -153,7 +153,7 @@ REGISTER_KERNEL_BUILDER(
 #endif
 
 REGISTER_OP("BluefogBroadcast")
-    .Attr("T: {int32, int64, float32, float64, bool}")
+    .Attr("T: {int32, int64, float32, float64, bfloat16, bool}")
     .Attr("root_rank: int")
     .Input("tensor: T")
     .Output("output: T")
@@ -210,7 +210,7 @@ REGISTER_KERNEL_BUILDER(
 #endif
 
 REGISTER_OP("BluefogAllgather")
-    .Attr("T: {int32, int64, float32, float64, bool}")
+    .Attr("T: {int32, int64, float32, float64, bfloat16, bool}")
     .Input("tensor: T")
     .Output("output: T")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
@@ -63,9 +63,12 @@ from bluefog.torch.mpi_ops import win_update, win_update_then_collect
 from bluefog.torch.mpi_ops import win_put_nonblocking, win_put
 from bluefog.torch.mpi_ops import win_get_nonblocking, win_get
 from bluefog.torch.mpi_ops import win_accumulate_nonblocking, win_accumulate
+from bluefog.torch.mpi_ops import win_create_group, win_put_group, win_accumulate_group
+from bluefog.torch.mpi_ops import win_update_group
 from bluefog.torch.mpi_ops import win_wait, win_poll
 from bluefog.torch.mpi_ops import win_mutex
 from bluefog.torch.mpi_ops import get_win_version, get_current_created_window_names
+from bluefog.torch.mpi_ops import get_win_neighbor_tensor
 
 from bluefog.torch.mpi_ops import win_associated_p
 from bluefog.torch.mpi_ops import turn_on_win_ops_with_associated_p
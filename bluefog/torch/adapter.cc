@@ -25,6 +25,7 @@
 
 #include "../common/cuda_util.h"
 #include "../common/logging.h"
+#include "../common/weighted_sum.h"
 #include "adapter.h"
 
 #if HAVE_CUDA
@@ -57,6 +58,8 @@ const DataType TorchTensor::dtype() const {
       return DataType::BLUEFOG_INT64;
     case ::torch::kHalf:
       return DataType::BLUEFOG_FLOAT16;
+    case ::torch::kBFloat16:
+      return DataType::BLUEFOG_BFLOAT16;
     case ::torch::kFloat:
       return DataType::BLUEFOG_FLOAT32;
     case ::torch::kDouble:
@@ -113,6 +116,8 @@ std::shared_ptr<TorchTensor> TorchTensor::MakeCopy(int device) {
       return ::torch::kLong;
     case DataType::BLUEFOG_FLOAT16:
       return ::torch::kHalf;
+    case DataType::BLUEFOG_BFLOAT16:
+      return ::torch::kBFloat16;
     case DataType::BLUEFOG_FLOAT32:
       return ::torch::kFloat;
     case DataType::BLUEFOG_FLOAT64:
@@ -269,5 +274,31 @@ void ThrowIfError(Status status) {
   }
 }
 
+bool TryWeightedSum(::torch::Tensor dst, ::torch::Tensor self,
+                    double self_weight,
+                    const std::vector<::torch::Tensor>& srcs,
+                    const std::vector<double>& weights) {
+  auto IsSupported = [&dst](const ::torch::Tensor& t) {
+    return !t.is_cuda() && t.is_contiguous() &&
+           t.scalar_type() == dst.scalar_type() && t.numel() == dst.numel();
+  };
+  if (!IsSupported(dst) || !IsSupported(self) ||
+      !common::WeightedSumSupported(TorchTensor(dst).dtype())) {
+    return false;
+  }
+  std::vector<const void*> src_data;
+  src_data.reserve(srcs.size());
+  for (auto& src : srcs) {
+    if (!IsSupported(src)) {
+      return false;
+    }
+    src_data.push_back(src.data_ptr());
+  }
+  common::WeightedSum(TorchTensor(dst).dtype(), dst.data_ptr(),
+                      self.data_ptr(), self_weight, src_data, weights,
+                      dst.numel());
+  return true;
+}
+
 }  // namespace torch
 }  // namespace bluefog
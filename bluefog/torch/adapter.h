@@ -94,6 +94,14 @@ std::shared_ptr<common::ReadyEvent> RecordReadyEvent(int device);
 
 void ThrowIfError(common::Status status);
 
+// dst = self_weight * self + sum_i weights[i] * srcs[i] in one pass with the
+// native kernel. dst may be self or one of srcs. Returns false without touching
+// dst if the tensors are not contiguous float tensors on CPU of the same size.
+bool TryWeightedSum(::torch::Tensor dst, ::torch::Tensor self,
+                    double self_weight,
+                    const std::vector<::torch::Tensor>& srcs,
+                    const std::vector<double>& weights);
+
 }  // namespace torch
 }  // namespace bluefog
 
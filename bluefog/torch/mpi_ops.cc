@@ -82,6 +82,89 @@ void MaybeCopyBufferBack(::torch::Tensor tensor, ::torch::Tensor buffer) {
   if (IsCPUHalfTensor(tensor)) tensor.copy_(buffer.to(::torch::kFloat16));
 }
 
+// Reduce the neighbor tensors received in output, which are stacked along the
+// first dimension, with the tensor itself. The output is resized to the shape
+// of the tensor afterwards.
+void ReduceNeighborTensors(::torch::Tensor tensor, ::torch::Tensor output,
+                           double self_weight,
+                           const std::unordered_map<int, double>& neighbor_weights,
+                           const std::vector<int>& recv_neighbors,
+                           bool dynamic_neighbors_enabled, bool avg_computation,
+                           bool is_hierarchical) {
+  ::torch::Tensor output_buffer = MaybeCopyToTensorBuffer(output);
+  ::torch::Tensor tensor_buffer = MaybeCopyToTensorBuffer(tensor);
+
+  // 1) For a distributed graph topology, created with
+  // MPI_Dist_graph_create, the sequence of neighbors in the send and
+  // receive buffers at each process is defined as the sequence returned
+  // by MPI_Dist_graph_neighbors for destinations and sources,
+  // respectively. 2) MPI_Dist_graph_neighbors: If the communicator was
+  // created with MPI_Dist_graph_create_adjacent then the order of the
+  // values in sources and destinations is identical to the input that
+  // was used by the process with the same rank in comm_old in the
+  // creation call.
+  std::vector<int> recv_ranks;
+  if (!dynamic_neighbors_enabled) {
+    int indgree = 0;
+    int outdegree = 0;
+    int* sources_ptr = nullptr;
+    int* destinations_ptr = nullptr;
+    bluefog_load_topology(&indgree, sources_ptr, &outdegree, destinations_ptr);
+    recv_ranks.assign(sources_ptr, sources_ptr + indgree);
+  } else {
+    recv_ranks = recv_neighbors;
+  }
+  int recv_size = recv_ranks.size();
+
+  // if avg_computation is set to be False, sum computation will be taken place
+  // and then divided by the number of tensors.
+  std::vector<double> weights(recv_size, 1.0);
+  double divisor = 1.0;
+  if (avg_computation) {
+    for (int i = 0; i < recv_size; i++) {
+      auto it = neighbor_weights.find(recv_ranks[i]);
+      weights[i] = it != neighbor_weights.end() ? it->second : 0.0;
+    }
+  } else {
+    self_weight = 1.0;
+    divisor = recv_size + 1;
+  }
+  if (is_hierarchical) {
+    // Because there is ncclAllreduce just take sum.
+    divisor *= bluefog_local_size();
+  }
+
+  int first_dim = output_buffer.size(0) / recv_size;
+  std::vector<int64_t> shape_vector;
+  shape_vector.push_back(first_dim);
+  for (int idx = 1; idx < tensor_buffer.dim(); ++idx) {
+    shape_vector.push_back(tensor_buffer.size(idx));
+  }
+
+  std::vector<::torch::Tensor> neighbor_tensors;
+  std::vector<double> scaled_weights;
+  for (int i = 0; i < recv_size; i++) {
+    neighbor_tensors.push_back(
+        output_buffer.slice(0, i * first_dim, (i + 1) * first_dim));
+    scaled_weights.push_back(weights[i] / divisor);
+  }
+  // CPU float tensors are reduced in one pass over the memory.
+  if (!TryWeightedSum(neighbor_tensors[0], tensor_buffer, self_weight / divisor,
+                      neighbor_tensors, scaled_weights)) {
+    auto output_reduced = neighbor_tensors[0];
+    if (weights[0] != 1.0) output_reduced.mul_(weights[0]);
+    for (int i = 1; i < recv_size; i++) {
+      output_reduced.add_(neighbor_tensors[i], weights[i]);
+    }
+    output_buffer.resize_(shape_vector);
+    output_buffer.add_(tensor_buffer, self_weight);
+    if (divisor != 1.0) output_buffer.div_(divisor);
+  }
+  output_buffer.resize_(shape_vector);
+  output.resize_(shape_vector);
+  MaybeCopyBufferBack(output, output_buffer);
+}
+
 }  // namespace
 
 std::function<std::function<void(const Status&)>(std::function<void()>)>
@@ -318,7 +401,8 @@ int DoNeighborAllreduce(::torch::Tensor tensor, ::torch::Tensor output,
                         double self_weight, const std::unordered_map<int, double>& neighbor_weights,
                         const std::vector<int>& send_neighbors, bool dynamic_neighbors_enabled,
                         bool enable_topo_check, bool avg_computation, bool is_hierarchical,
-                        const std::string& name) {
+                        bool streaming_reduce, int compression,
+                        double compression_ratio, const std::string& name) {
   ThrowIfError(common::CheckInitialized());
 
   auto handle = handle_manager.AllocateHandle();
@@ -353,7 +437,9 @@ int DoNeighborAllreduce(::torch::Tensor tensor, ::torch::Tensor output,
     auto enqueue_result = EnqueueTensorNeighborAllreduce(
         bf_tensor, bf_output, bf_context, ready_event, bf_recv_neighbors,
         bf_send_neighbors, dynamic_neighbors_enabled, is_hierarchical,
-        enable_topo_check, op_name, CPU_DEVICE_ID,
+        enable_topo_check, /*streaming_reduce=*/false, self_weight,
+        neighbor_weights, static_cast<common::CompressionType>(compression),
+        compression_ratio, op_name, CPU_DEVICE_ID,
         callback_wrapper([self_weight, neighbor_weights, avg_computation,
                           cpu_output, tensor, recv_neighbors, send_neighbors,
                           dynamic_neighbors_enabled, is_hierarchical, output,
@@ -363,87 +449,19 @@ int DoNeighborAllreduce(::torch::Tensor tensor, ::torch::Tensor output,
           int recv_size = bluefog_neighbor_size();
           if (dynamic_neighbors_enabled) recv_size = recv_neighbors.size();
           if (recv_size > 0) {
-            ::torch::Tensor output_buffer = MaybeCopyToTensorBuffer(output);
-            ::torch::Tensor tensor_buffer = MaybeCopyToTensorBuffer(tensor);
-            
-            int first_dim = output_buffer.size(0) / recv_size;
-            std::vector<int64_t> shape_vector;
-            shape_vector.push_back(first_dim);
-            for (int idx = 1; idx < tensor_buffer.dim(); ++idx) {
-              shape_vector.push_back(tensor_buffer.size(idx));
-            }
-
-            // if avg_computation is set to be False, sum computation will be taken place.
-            if (avg_computation) {
-              // 1) For a distributed graph topology, created with
-              // MPI_Dist_graph_create, the sequence of neighbors in the send and
-              // receive buffers at each process is defined as the sequence returned
-              // by MPI_Dist_graph_neighbors for destinations and sources,
-              // respectively. 2) MPI_Dist_graph_neighbors: If the communicator was
-              // created with MPI_Dist_graph_create_adjacent then the order of the
-              // values in sources and destinations is identical to the input that
-              // was used by the process with the same rank in comm_old in the
-              // creation call.
-              int indgree = 0;
-              int outdegree = 0;
-              int* sources_ptr = nullptr;
-              int* destinations_ptr = nullptr;
-              bluefog_load_topology(&indgree, sources_ptr, &outdegree,
-                                    destinations_ptr);
-
-              auto output_reduced = output_buffer.slice(0, 0, first_dim);
-              if (dynamic_neighbors_enabled) indgree = recv_neighbors.size();
-              for (int i = 0; i < indgree; i++) {
-                double weight = 0.0;
-                int recv_rank;
-                if (!dynamic_neighbors_enabled) recv_rank = *(sources_ptr+i);
-                else recv_rank = recv_neighbors[i];
-                auto it = neighbor_weights.find(recv_rank);
-                if (it != neighbor_weights.end()) {
-                  weight = it->second;
-                }
-
-                if (i == 0) {
-                  output_reduced.mul_(weight);
-                } else {
-                  output_reduced.add_(
-                      output_buffer.slice(0, i * first_dim, (i + 1) * first_dim), weight);
-                }
-              }
-              output_buffer.resize_(shape_vector);
-              output_buffer.add_(tensor_buffer, self_weight);
-              if (is_hierarchical){
-                // Because there is ncclAllreduce just take sum.
-                output_buffer.div_(bluefog_local_size());
-              }
-            } else {
-              int neighbor_size = !dynamic_neighbors_enabled
-                                  ? bluefog_neighbor_size()
-                                  : recv_neighbors.size();
-              if (neighbor_size > 1) {
-                auto output_reduced = output_buffer.slice(0, 0, first_dim);
-                for (int i = 1; i < neighbor_size; i++) {
-                  output_reduced.add_(
-                      output_buffer.slice(0, i * first_dim, (i + 1) * first_dim));
-                }
-                output_buffer.resize_(shape_vector);
-              }
-              // Include self data as well.
-              output_buffer.add_(tensor_buffer);
-              if (is_hierarchical){
-                // Because there is ncclAllreduce just take sum.
-                output_buffer.div_(bluefog_local_size() * (neighbor_size + 1));
-              } else {
-                output_buffer.div_(neighbor_size + 1);
-              }
-            }
-            output.resize_(shape_vector);
-            MaybeCopyBufferBack(output, output_buffer);
+            ReduceNeighborTensors(tensor, output, self_weight, neighbor_weights,
+                                  recv_neighbors, dynamic_neighbors_enabled,
+                                  avg_computation, is_hierarchical);
           }
         }));
 
     ThrowIfError(enqueue_result);
   } else {
+    if (compression != 0 && tensor.device().is_cuda()) {
+      ThrowIfError(Status::InvalidArgument(
+          "Compressed neighbor_allreduce of GPU tensors requires "
+          "BLUEFOG_OPS_ON_CPU=1."));
+    }
     auto bf_tensor = std::make_shared<TorchTensor>(tensor);
     auto bf_context = std::make_shared<TorchOpContext>(device, output);
     auto bf_output = std::make_shared<TorchTensor>(output);
@@ -454,81 +472,20 @@ int DoNeighborAllreduce(::torch::Tensor tensor, ::torch::Tensor output,
     auto enqueue_result = EnqueueTensorNeighborAllreduce(
         bf_tensor, bf_output, bf_context, ready_event, bf_recv_neighbors,
         bf_send_neighbors, dynamic_neighbors_enabled, is_hierarchical,
-        enable_topo_check, op_name, device,
+        enable_topo_check, streaming_reduce, self_weight, neighbor_weights,
+        static_cast<common::CompressionType>(compression), compression_ratio,
+        op_name, device,
         callback_wrapper([self_weight, neighbor_weights, avg_computation,
                           recv_neighbors, send_neighbors, dynamic_neighbors_enabled,
-                          is_hierarchical, tensor, output]() mutable {
+                          is_hierarchical, streaming_reduce, tensor, output]() mutable {
+          // The output is reduced already.
+          if (streaming_reduce) return;
           int recv_size = bluefog_neighbor_size();
           if (dynamic_neighbors_enabled) recv_size = recv_neighbors.size();
           if (recv_size > 0) {
-            ::torch::Tensor output_buffer = MaybeCopyToTensorBuffer(output);
-            ::torch::Tensor tensor_buffer = MaybeCopyToTensorBuffer(tensor);
-
-            int first_dim = output_buffer.size(0) / recv_size;
-            std::vector<int64_t> shape_vector;
-            shape_vector.push_back(first_dim);
-            for (int idx = 1; idx < tensor_buffer.dim(); ++idx) {
-              shape_vector.push_back(tensor_buffer.size(idx));
-            }
-            // if avg_computation is set to be True, average computation will be taken place.
-            if (avg_computation) {
-              int indgree = 0;
-              int outdegree = 0;
-              int* sources_ptr = nullptr;
-              int* destinations_ptr = nullptr;
-              auto output_reduced = output_buffer.slice(0, 0, first_dim);
-              if (!dynamic_neighbors_enabled) {
-                bluefog_load_topology(&indgree, sources_ptr, &outdegree,
-                                      destinations_ptr);
-              } else {
-                indgree = recv_neighbors.size();
-              }
-              for (int i = 0; i < indgree; i++) {
-                double weight = 0.0;
-                int recv_rank;
-                if (!dynamic_neighbors_enabled) recv_rank = *(sources_ptr+i);
-                else recv_rank = recv_neighbors[i];
-                auto it = neighbor_weights.find(recv_rank);
-                if (it != neighbor_weights.end()) {
-                  weight = it->second;
-                }
-
-                if (i == 0) {
-                  output_reduced.mul_(weight);
-                } else {
-                  output_reduced.add_(
-                      output_buffer.slice(0, i * first_dim, (i + 1) * first_dim), weight);
-                }
-              }
-              output_buffer.resize_(shape_vector);
-              output_buffer.add_(tensor_buffer, self_weight);
-              if (is_hierarchical){
-                // Because there is ncclAllreduce just take sum.
-                output_buffer.div_(bluefog_local_size());
-              }
-            } else {
-              int neighbor_size = !dynamic_neighbors_enabled
-                                  ? bluefog_neighbor_size()
-                                  : recv_neighbors.size();
-              if (neighbor_size > 1) {
-                auto output_reduced = output_buffer.slice(0, 0, first_dim);
-                for (int i = 1; i < neighbor_size; i++) {
-                  output_reduced.add_(
-                      output.slice(0, i * first_dim, (i + 1) * first_dim));
-                }
-              }
-              output_buffer.resize_(shape_vector);
-              // Include self data as well.
-              output_buffer.add_(tensor_buffer);
-              if (is_hierarchical){
-                // Because there is ncclAllreduce just take sum.
-                output_buffer.div_(bluefog_local_size() * (neighbor_size + 1));
-              } else {
-                output_buffer.div_(neighbor_size + 1);
-              }
-            }
-            output.resize_(shape_vector);
-            MaybeCopyBufferBack(output, output_buffer);
+            ReduceNeighborTensors(tensor, output, self_weight, neighbor_weights,
+                                  recv_neighbors, dynamic_neighbors_enabled,
+                                  avg_computation, is_hierarchical);
           } else {
             output.set_(tensor);
           }
@@ -638,12 +595,14 @@ PYBIND11_MODULE(mpi_lib, m) {
   m.def("bluefog_torch_allreduce_nonblocking_torch_IntTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_LongTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_HalfTensor", &DoAllreduce);
+  m.def("bluefog_torch_allreduce_nonblocking_torch_BFloat16Tensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_FloatTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_DoubleTensor", &DoAllreduce);
 #if HAVE_CUDA
   m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_IntTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_LongTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_HalfTensor", &DoAllreduce);
+  m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_BFloat16Tensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_FloatTensor", &DoAllreduce);
   m.def("bluefog_torch_allreduce_nonblocking_torch_cuda_DoubleTensor", &DoAllreduce);
 #endif
@@ -655,12 +614,14 @@ PYBIND11_MODULE(mpi_lib, m) {
   m.def("bluefog_torch_broadcast_nonblocking_torch_IntTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_LongTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_HalfTensor", &DoBroadcast);
+  m.def("bluefog_torch_broadcast_nonblocking_torch_BFloat16Tensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_FloatTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_DoubleTensor", &DoBroadcast);
 #if HAVE_CUDA
   m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_IntTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_LongTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_HalfTensor", &DoBroadcast);
+  m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_BFloat16Tensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_FloatTensor", &DoBroadcast);
   m.def("bluefog_torch_broadcast_nonblocking_torch_cuda_DoubleTensor", &DoBroadcast);
 #endif
@@ -672,12 +633,14 @@ PYBIND11_MODULE(mpi_lib, m) {
   m.def("bluefog_torch_allgather_nonblocking_torch_IntTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_LongTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_HalfTensor", &DoAllgather);
+  m.def("bluefog_torch_allgather_nonblocking_torch_BFloat16Tensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_FloatTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_DoubleTensor", &DoAllgather);
 #if HAVE_CUDA
   m.def("bluefog_torch_allgather_nonblocking_torch_cuda_IntTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_cuda_LongTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_cuda_HalfTensor", &DoAllgather);
+  m.def("bluefog_torch_allgather_nonblocking_torch_cuda_BFloat16Tensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_cuda_FloatTensor", &DoAllgather);
   m.def("bluefog_torch_allgather_nonblocking_torch_cuda_DoubleTensor", &DoAllgather);
 #endif
@@ -695,6 +658,8 @@ PYBIND11_MODULE(mpi_lib, m) {
         &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_HalfTensor",
         &DoNeighborAllgather);
+  m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_BFloat16Tensor",
+        &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_FloatTensor",
         &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_DoubleTensor",
@@ -706,6 +671,8 @@ PYBIND11_MODULE(mpi_lib, m) {
         &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_cuda_HalfTensor",
         &DoNeighborAllgather);
+  m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_cuda_BFloat16Tensor",
+        &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_cuda_FloatTensor",
         &DoNeighborAllgather);
   m.def("bluefog_torch_neighbor_allgather_nonblocking_torch_cuda_DoubleTensor",
@@ -715,6 +682,8 @@ PYBIND11_MODULE(mpi_lib, m) {
   // neighbor_allreduce
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_HalfTensor",
         &DoNeighborAllreduce);
+  m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_BFloat16Tensor",
+        &DoNeighborAllreduce);
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_FloatTensor",
         &DoNeighborAllreduce);
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_DoubleTensor",
@@ -722,6 +691,8 @@ PYBIND11_MODULE(mpi_lib, m) {
 #if HAVE_CUDA
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_cuda_HalfTensor",
         &DoNeighborAllreduce);
+  m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_cuda_BFloat16Tensor",
+        &DoNeighborAllreduce);
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_cuda_FloatTensor",
         &DoNeighborAllreduce);
   m.def("bluefog_torch_neighbor_allreduce_nonblocking_torch_cuda_DoubleTensor",
@@ -731,6 +702,8 @@ PYBIND11_MODULE(mpi_lib, m) {
   // Pair_gossip
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_HalfTensor",
         &DoPairGossip);
+  m.def("bluefog_torch_pair_gossip_nonblocking_torch_BFloat16Tensor",
+        &DoPairGossip);
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_FloatTensor",
         &DoPairGossip);
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_DoubleTensor",
@@ -738,6 +711,8 @@ PYBIND11_MODULE(mpi_lib, m) {
 #if HAVE_CUDA
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_cuda_HalfTensor",
         &DoPairGossip);
+  m.def("bluefog_torch_pair_gossip_nonblocking_torch_cuda_BFloat16Tensor",
+        &DoPairGossip);
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_cuda_FloatTensor",
         &DoPairGossip);
   m.def("bluefog_torch_pair_gossip_nonblocking_torch_cuda_DoubleTensor",
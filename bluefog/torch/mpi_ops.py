@@ -15,7 +15,7 @@
 # ==============================================================================
 
 from contextlib import contextmanager
-from typing import List, Dict, Optional
+from typing import List, Dict, Optional, Union
 
 import torch
 
@@ -70,6 +70,13 @@ _win_handle_map = {}
 # Added in WinCreate, removed in WinFree, and referred by sync.
 _win_map = {}
 
+# Schema: name -> compression of the window
+_win_compression_map = {}
+
+# Schema: name -> list of (tensor, offset) of the tensors in the window group
+# Added in win_create_group, removed in WinFree.
+_win_group_map = {}
+
 
 def _check_rank(rank_: int):
     assert isinstance(rank_, int), "Rank has to be an integer."
@@ -92,9 +99,10 @@ def _allreduce_function_factory(tensor):
 def _allreduce_nonblocking(tensor, output, average, is_hierarchical_local, name):
     function = _check_function(_allreduce_function_factory, tensor)
     if average:
-        assert isinstance(tensor, (torch.HalfTensor, torch.FloatTensor, torch.DoubleTensor,
+        assert isinstance(tensor, (torch.HalfTensor, torch.BFloat16Tensor,
+                                   torch.FloatTensor, torch.DoubleTensor,
                                    torch.cuda.FloatTensor, torch.cuda.DoubleTensor,
-                                   torch.cuda.HalfTensor)), \
+                                   torch.cuda.HalfTensor, torch.cuda.BFloat16Tensor)), \
             "If average is set in allreduce, only float or double tensor is allowed."
 
     handle = getattr(mpi_lib, function)(tensor, output, average, is_hierarchical_local,
@@ -430,8 +438,45 @@ def _neighbor_allreduce_function_factory(tensor):
     return 'bluefog_torch_neighbor_allreduce_nonblocking_' + tensor.type().replace('.', '_')
 
 
+def _neighbor_allreduce_streaming(tensor):
+    # Only the float tensors on CPU are reduced as the neighbor tensors arrive.
+    return (_basics.neighbor_allreduce_streaming() and not tensor.is_cuda and
+            tensor.dtype in (torch.float32, torch.float64))
+
+
+def _hierarchical_neighbor_allreduce_shared(tensor):
+    # Only the float tensors on CPU are reduced straight from the shared memory.
+    return (_basics.hierarchical_shared_memory() and not tensor.is_cuda and
+            tensor.dtype in (torch.float32, torch.float64))
+
+
+# Compressions of neighbor_allreduce and windows, mapped to CompressionType in common.h.
+_compressions = {None: 0, 'fp16': 1, 'int8': 2, 'topk': 3}
+
+
+def _check_compression(tensor, compression, compression_ratio):
+    if compression not in _compressions:
+        raise ValueError("Argument compression should be one of None, 'fp16', 'int8' and "
+                         "'topk'.")
+    if compression is None:
+        return
+    if tensor.dtype != torch.float32:
+        raise ValueError("Compression only supports float32 tensor.")
+    if compression == 'topk' and not 0.0 < compression_ratio <= 1.0:
+        raise ValueError("Argument compression_ratio should be in (0, 1].")
+
+
+def _check_neighbor_allreduce_compression(tensor, compression, compression_ratio, name):
+    _check_compression(tensor, compression, compression_ratio)
+    if compression == 'topk' and name is None:
+        raise ValueError("Argument name is required by topk compression, since the "
+                         "error feedback is kept for the tensor of the same name.")
+
+
 def _neighbor_allreduce_nonblocking(tensor, output, self_weight, neighbor_weights,
-                                    send_neighbors, enable_topo_check, name):
+                                    send_neighbors, enable_topo_check, name,
+                                    streaming_reduce=False, compression=None,
+                                    compression_ratio=0.0):
     function = _check_function(_neighbor_allreduce_function_factory, tensor)
     if send_neighbors is None:
         send_neighbors = []
@@ -483,7 +528,10 @@ def _neighbor_allreduce_nonblocking(tensor, output, self_weight, neighbor_weight
     handle = getattr(mpi_lib, function)(tensor, output, self_weight, neighbor_weights,
                                         send_neighbors, dynamic_neighbors_enabled,
                                         enable_topo_check, weighted_average_computation,
-                                        is_hierarchical, name.encode() if name is not None else "")
+                                        is_hierarchical, streaming_reduce,
+                                        _compressions[compression],
+                                        compression_ratio,
+                                        name.encode() if name is not None else "")
     _handle_map[handle] = (tensor, output)
     return handle
 
@@ -493,7 +541,9 @@ def neighbor_allreduce(tensor: torch.Tensor,
                        neighbor_weights: Optional[Dict[int, float]] = None,
                        send_neighbors: Optional[List[int]] = None,
                        enable_topo_check: bool = True,
-                       name: Optional[str] = None) -> torch.Tensor:
+                       name: Optional[str] = None,
+                       compression: Optional[str] = None,
+                       compression_ratio: float = 0.01) -> torch.Tensor:
     """
     A function that performs weighted averaging of the input tensor over the negihbors and itself
     in the Bluefog processes. The default behavior is (uniformly) average.
@@ -523,6 +573,15 @@ def neighbor_allreduce(tensor: torch.Tensor,
             sending and recieving neighbors match with each other. Disabling this check can boost
             the performance.
         name: A name of the reduction operation.
+        compression: Compression of the tensor sent to the neighbors, which is one of None,
+            'fp16' (cast to float16), 'int8' (stochastic quantization to int8 with a scale
+            per block of 256 values) and 'topk' (only the values of the largest magnitude
+            with error feedback). The received tensors are decompressed before averaging.
+            Only float32 tensors are supported, and all processes should use the same
+            compression for the same name.
+        compression_ratio: The fraction of the values sent by 'topk' compression. The
+            values not sent are added to the tensor of the same name next time, so 'topk'
+            requires the name.
 
     Returns:
         A tensor of the same shape and type as `tensor`,  across all processes.
@@ -534,7 +593,8 @@ def neighbor_allreduce(tensor: torch.Tensor,
         raise ValueError("Arguments self_weight and neighbor_weights have to be presented at "
                          "the same time")
     handle = neighbor_allreduce_nonblocking(tensor, self_weight, neighbor_weights,
-                                            send_neighbors, enable_topo_check, name)
+                                            send_neighbors, enable_topo_check, name,
+                                            compression, compression_ratio)
     return synchronize(handle)
 
 
@@ -543,7 +603,9 @@ def neighbor_allreduce_nonblocking(tensor: torch.Tensor,
                                    neighbor_weights: Optional[Dict[int, float]] = None,
                                    send_neighbors: Optional[List[int]] = None,
                                    enable_topo_check: bool = True,
-                                   name: Optional[str] = None) -> int:
+                                   name: Optional[str] = None,
+                                   compression: Optional[str] = None,
+                                   compression_ratio: float = 0.01) -> int:
     """
     A function that nonblockingly performs weighted averaging of the input tensor over the
     negihbors and itself in the Bluefog processes. The default behavior is (uniformly) average.
@@ -573,6 +635,15 @@ def neighbor_allreduce_nonblocking(tensor: torch.Tensor,
             sending and recieving neighbors match with each other. Disabling this check can boost
             the performance.
         name: A name of the neighbor_allreduce operation.
+        compression: Compression of the tensor sent to the neighbors, which is one of None,
+            'fp16' (cast to float16), 'int8' (stochastic quantization to int8 with a scale
+            per block of 256 values) and 'topk' (only the values of the largest magnitude
+            with error feedback). The received tensors are decompressed before averaging.
+            Only float32 tensors are supported, and all processes should use the same
+            compression for the same name.
+        compression_ratio: The fraction of the values sent by 'topk' compression. The
+            values not sent are added to the tensor of the same name next time, so 'topk'
+            requires the name.
 
     Returns:
         A handle to the neighbor_allreduce operation that can be used with `poll()` or
@@ -584,6 +655,14 @@ def neighbor_allreduce_nonblocking(tensor: torch.Tensor,
        (self_weight is not None and neighbor_weights is None):
         raise ValueError("Arguments self_weight and neighbor_weights have to be presented at "
                          "the same time")
+    _check_neighbor_allreduce_compression(tensor, compression, compression_ratio, name)
+    streaming_reduce = compression is None and _neighbor_allreduce_streaming(tensor)
+    if streaming_reduce:
+        # The neighbor tensors are reduced into the output as they arrive.
+        output = tensor.new(tensor.shape)
+        return _neighbor_allreduce_nonblocking(tensor, output, self_weight, neighbor_weights,
+                                               send_neighbors, enable_topo_check, name=name,
+                                               streaming_reduce=True)
     if send_neighbors is None:
         first_dim = tensor.shape[0] * len(in_neighbor_ranks())
     else:
@@ -591,7 +670,9 @@ def neighbor_allreduce_nonblocking(tensor: torch.Tensor,
     new_shape = torch.Size([first_dim] + list(tensor.shape[1:]))
     output = tensor.new(new_shape)  # Pre-allocate the memory for the output.
     return _neighbor_allreduce_nonblocking(tensor, output, self_weight, neighbor_weights,
-                                           send_neighbors, enable_topo_check, name=name)
+                                           send_neighbors, enable_topo_check, name=name,
+                                           compression=compression,
+                                           compression_ratio=compression_ratio)
 
 
 def hierarchical_neighbor_allreduce(tensor: torch.Tensor,
@@ -689,6 +770,12 @@ def hierarchical_neighbor_allreduce_nonblocking(tensor: torch.Tensor,
         raise ValueError("Arguments self_weight and neighbor_weights have to be presented at "
                          "the same time")
 
+    if _hierarchical_neighbor_allreduce_shared(tensor):
+        # The tensors of the neighbor machines are reduced into the output in the shared memory.
+        output = tensor.new(tensor.shape)
+        return _hierarchical_neighbor_allreduce_nonblocking(
+            tensor, output, self_weight, neighbor_machine_weights,
+            send_neighbor_machines, enable_topo_check, name=name, streaming_reduce=True)
     if send_neighbor_machines is None:
         first_dim = tensor.shape[0] * len(in_neighbor_machine_ranks())
     else:
@@ -703,7 +790,7 @@ def hierarchical_neighbor_allreduce_nonblocking(tensor: torch.Tensor,
 
 def _hierarchical_neighbor_allreduce_nonblocking(
         tensor, output, self_weight, neighbor_machine_weights,
-        send_neighbor_machines, enable_topo_check, name):
+        send_neighbor_machines, enable_topo_check, name, streaming_reduce=False):
     assert is_homogeneous, \
         "hierarchical_neighbor_allreduce should be used under homogeneous environment only"
     assert local_size() > 1, "If local size is 1, you should use neighbor allreduce directly."
@@ -756,13 +843,15 @@ def _hierarchical_neighbor_allreduce_nonblocking(
                 "Note it is 0-based index.")
         neighbor_weights[node_per_machine*m] = weights
     send_neighbors = [node_per_machine*m for m in send_neighbor_machines]
-    tensor_buffer = tensor.detach().clone()
+    # The local sum is written back to the tensor unless it is reduced in place.
+    tensor_buffer = tensor if streaming_reduce else tensor.detach().clone()
     is_hierarchical = True
     #TODO(ybc) support static machine topology case
     dynamic_neighbors_enabled = True
     handle = getattr(mpi_lib, function)(tensor_buffer, output, self_weight, neighbor_weights,
                                         send_neighbors, dynamic_neighbors_enabled, enable_topo_check,
                                         weighted_average_computation, is_hierarchical,
+                                        streaming_reduce, 0, 0.0,
                                         name.encode() if name is not None else "")
     _handle_map[handle] = (tensor_buffer, output)
     return handle
@@ -914,7 +1003,8 @@ def _win_create_function_factory(tensor):
     return 'bluefog_torch_win_create_' + tensor.type().replace('.', '_')
 
 
-def win_create(tensor: torch.Tensor, name: str, zero_init: bool = False) -> bool:
+def win_create(tensor: torch.Tensor, name: str, zero_init: bool = False,
+               compression: Optional[str] = None, compression_ratio: float = 0.01) -> bool:
     """ Create MPI window for remote memoery access.
 
     The window is dedicated to the provided tensor only, which is identified by unqiue name.
@@ -927,17 +1017,30 @@ def win_create(tensor: torch.Tensor, name: str, zero_init: bool = False) -> bool
         name (str): The unique name to associate the window object.
         zero_init (boll): If set true, the buffer value initialize as zero instead of
             the value of tensor.
+        compression: Compression of the tensor sent by win_put and win_accumulate, which
+            is one of None, 'fp16', 'int8' and 'topk'. 'fp16' and 'int8' are decompressed
+            into the neighbor buffers by win_update, and are not supported by
+            win_accumulate. What they lose of a win_put is added to the next win_put.
+            'topk' only sends the values which changed the most since the last win_put,
+            and win_update copies all the values put so far into the neighbor buffer, even
+            after it is reset by win_update or overwritten by win_get. The values of
+            win_accumulate not sent are added to the next win_accumulate.
+            Only float32 tensors on CPU are supported.
+        compression_ratio: The fraction of the values sent by 'topk' compression.
 
     Returns:
         bool: Indicate the creation succeed or not.
 
     Note: The window with same name across different bluefog processes should associate
-    the tensor with same shape. Otherwise, the rest win_ops like win_update, win_put may
-    encounter unrecoverable memory segmentation fault.
+    the tensor with same shape and compression. Otherwise, the rest win_ops like
+    win_update, win_put may encounter unrecoverable memory segmentation fault.
     """
     function = _check_function(_win_create_function_factory, tensor)
-    if getattr(mpi_lib, function)(tensor, name, zero_init):
+    _check_compression(tensor, compression, compression_ratio)
+    if getattr(mpi_lib, function)(tensor, name, zero_init,
+                                  _compressions[compression], compression_ratio):
         _win_map[name] = tensor
+        _win_compression_map[name] = compression
         return True
     return False
 
@@ -954,9 +1057,13 @@ def win_free(name: Optional[str] = None) -> bool:
     """
     if name is None:
         _win_map.clear()
+        _win_compression_map.clear()
+        _win_group_map.clear()
         name = ''
     else:
         _win_map.pop(name)
+        _win_compression_map.pop(name, None)
+        _win_group_map.pop(name, None)
     return getattr(mpi_lib, 'bluefog_torch_win_free')(name)
 
 
@@ -986,7 +1093,11 @@ def win_update(name: str,
                self_weight: Optional[float] = None,
                neighbor_weights: Optional[Dict[int, float]] = None,
                reset: bool = False, clone: bool = False,
-               require_mutex: bool = False) -> torch.Tensor:
+               require_mutex: bool = False,
+               min_version: Optional[Union[int, Dict[int, int]]] = None,
+               max_staleness: Optional[int] = None,
+               skip_stale: bool = False,
+               timeout: Optional[float] = None) -> torch.Tensor:
     """Locally synchronized the window objects and returned the reduced neighbor tensor.
     Note the returned tensor is the same tensor used in win_create and in-place modification
     is happened. During the update, a mutex for local variable is acquired.
@@ -1008,6 +1119,15 @@ def win_update(name: str,
             in-place change.
         require_mutex: If set to be true, the window mutex associated with local process will be
             acquired.
+        min_version: Wait until the neighbors have put or accumulated at least this many times
+            since the last win_update, see get_win_version. Either one value for all the
+            neighbors in neighbor_weights or a dictionary {rank: version}.
+        max_staleness: Wait until every in-neighbor, which has not sent new data for
+            max_staleness win_update in a row, sends new data. 0 waits for all of them.
+        skip_stale: If set to be true, the neighbors without new data since the last
+            win_update are left out of the average, and their weights are added to self_weight.
+        timeout: Seconds to wait for min_version and max_staleness at most, after which
+            the update goes on with the data arrived so far. Wait without limit if None.
 
     Returns:
         torch.Tensor: The average tensor of all neighbors' cooresponding tensors.
@@ -1017,6 +1137,9 @@ def win_update(name: str,
     bf.set_topology(.., is_weighted=True) is a better choice.
 
     Note2: self_weight and neighbor_weights must be presented at the same time.
+
+    Note3: The wait happens in the library without the mutex, so the neighbors can still
+    write while win_update waits for them.
     """
     tensor = _win_map[name]
     if clone:
@@ -1050,8 +1173,23 @@ def win_update(name: str,
         raise ValueError("Arguments self_weight and neighbor_weights have to be presented at "
                          "the same time")
 
+    if min_version is None:
+        min_versions = {}
+    elif isinstance(min_version, dict):
+        if not set(min_version.keys()).issubset(set(in_neighbor_ranks())):
+            raise ValueError("The key of min_version should only contain the ranks that belong "
+                             "to in-neighbors.")
+        min_versions = min_version
+    else:
+        min_versions = {r: int(min_version) for r in neighbor_weights}
+    if max_staleness is not None and max_staleness < 0:
+        raise ValueError("Argument max_staleness has to be non-negative.")
     if not getattr(mpi_lib, function)(tensor, name, self_weight, neighbor_weights,
-                                      reset, weighted_average_computation, require_mutex):
+                                      reset, weighted_average_computation, require_mutex,
+                                      min_versions,
+                                      -1 if max_staleness is None else max_staleness,
+                                      -1.0 if timeout is None else float(timeout),
+                                      skip_stale):
         raise RuntimeError("Cannot apply win_update on " + name)
     return tensor
 
@@ -1221,6 +1359,10 @@ def win_accumulate_nonblocking(tensor: torch.Tensor, name: str,
         `win_wait()`.
     """
     function = _check_function(_win_accumulate_function_factory, tensor)
+    if _win_compression_map.get(name) in ('fp16', 'int8'):
+        raise ValueError("Win_accumulate does not support {} compression, since the "
+                         "compressed tensors cannot be summed in the neighbor buffers."
+                         .format(_win_compression_map[name]))
     dst_weights = ({rank: 1.0 for rank in out_neighbor_ranks()}
                    if dst_weights is None else dst_weights)
     if self_weight is None:
@@ -1265,6 +1407,127 @@ def win_accumulate(tensor: torch.Tensor, name: str,
     return win_wait(handle)
 
 
+def win_create_group(tensors: List[torch.Tensor], name: str, zero_init: bool = False) -> bool:
+    """ Create one MPI window for a group of tensors, such as the parameters of a model.
+
+    The tensors are copied into one contiguous buffer once and turned into views of it, so
+    the whole group only needs one window (and one mutex, version and associated p window)
+    instead of one per tensor, and one win_put_group, win_accumulate_group or
+    win_update_group moves or averages all of them at once without copying. It is the
+    tensor fusion of the window ops. win_get, win_free and the other ops taking the name
+    work on the group as a whole.
+
+    Args:
+        tensors: The tensors in the group, which should have the same data type and device.
+        name: The unique name to associate the window object.
+        zero_init: If set true, the buffer value initialize as zero instead of the value
+            of tensors.
+
+    Returns:
+        bool: Indicate the creation succeed or not.
+
+    Note: The window group with same name across different bluefog processes should
+    contain the tensors with same shapes in the same order.
+
+    Note2: The tensors should be updated in-place afterwards, like optimizers do. Assigning
+    new data to them detaches them from the window.
+    """
+    if not tensors:
+        raise ValueError("Argument tensors should contain at least one tensor.")
+    if any(t.dtype != tensors[0].dtype or t.device != tensors[0].device for t in tensors):
+        raise ValueError("The tensors in a window group should have the same data type and "
+                         "device.")
+    buffer = torch.cat([t.detach().reshape(-1) for t in tensors])
+    if not win_create(buffer, name, zero_init):
+        return False
+    offset = 0
+    for t in tensors:
+        t.data = buffer[offset:offset + t.numel()].view_as(t)
+        offset += t.numel()
+    _win_group_map[name] = list(tensors)
+    return True
+
+
+def _win_group_buffer(name):
+    if name not in _win_group_map:
+        raise ValueError("Cannot find the window group {}. It should be created by "
+                         "win_create_group.".format(name))
+    return _win_map[name]
+
+
+def win_put_group(name: str,
+                  self_weight: Optional[float] = None,
+                  dst_weights: Optional[Dict[int, float]] = None,
+                  require_mutex: bool = False) -> bool:
+    """ Passively put all the tensors of the window group into neighbor's shared window
+    memory with one win_put. It is a blocking function.
+
+    Args:
+        name: The unique name of the window group created by win_create_group.
+        self_weight: In-place multiply the weight to the tensors (Happened after win_put
+            send tensor information to neigbors), Default is 1.0.
+        dst_weights: A dictionary that maps the destination ranks to the weight, see
+            win_put.
+        require_mutex: If set to be true, out-neighbor process's window mutex will be
+            acquired.
+
+    Returns:
+        A bool value to indicate the put succeeded or not.
+    """
+    return win_put(_win_group_buffer(name), name, self_weight, dst_weights, require_mutex)
+
+
+def win_accumulate_group(name: str,
+                         self_weight: Optional[float] = None,
+                         dst_weights: Optional[Dict[int, float]] = None,
+                         require_mutex: bool = False) -> bool:
+    """ Passively accumulate all the tensors of the window group into neighbor's shared
+    window memory with one win_accumulate. It is a blocking function.
+
+    Args:
+        name: The unique name of the window group created by win_create_group.
+        self_weight: In-place multiply the weight to the tensors (Happened after
+            win_accumulate send tensor information to neigbors), Default is 1.0.
+        dst_weights: A dictionary that maps the destination ranks to the weight, see
+            win_accumulate.
+        require_mutex: If set to be true, out-neighbor process's window mutex will be
+            acquired.
+
+    Returns:
+        A bool value to indicate the accumulate succeeded or not.
+    """
+    return win_accumulate(_win_group_buffer(name), name, self_weight, dst_weights,
+                          require_mutex)
+
+
+def win_update_group(name: str,
+                     self_weight: Optional[float] = None,
+                     neighbor_weights: Optional[Dict[int, float]] = None,
+                     reset: bool = False,
+                     require_mutex: bool = False) -> List[torch.Tensor]:
+    """ Locally synchronize the window group with one win_update and write the reduced
+    values back into the tensors of the group in-place.
+
+    The current values of the tensors are used as the self part of the average, so they
+    may be updated by the optimizer between the window ops.
+
+    Args:
+        name: The unique name of the window group created by win_create_group.
+        self_weight: The weight for self node, see win_update.
+        neighbor_weights: The weights for in-neighbor nodes, see win_update.
+        reset: If reset is True, the buffers of the neighbors included in neighbor_weights
+            will be reset to zero after the update.
+        require_mutex: If set to be true, the window mutex will be acquired.
+
+    Returns:
+        List[torch.Tensor]: The tensors of the group.
+    """
+    _win_group_buffer(name)  # Raises if the group does not exist.
+    win_update(name, self_weight, neighbor_weights, reset=reset,
+               require_mutex=require_mutex)
+    return list(_win_group_map[name])
+
+
 def win_poll(handle: int) -> bool:
     """Return whether the win ops identified by handle is done or not."""
     return mpi_lib.bluefog_torch_win_poll(handle) != 0
@@ -1294,7 +1557,7 @@ def get_win_version(name: str) -> Dict[int, int]:
     Returns:
         A dictionary maps from neighbor ranks to version. 0 means the latest
         tensor stored in win buffer has been read/sync. Non-negative value
-        means the tensor has been updated through put or get before read/sync.
+        means the tensor has been updated through put, accumulate or get before read/sync.
     """
     versions = [0] * size()
     returned_versions = mpi_lib.bluefog_torch_get_win_version(name, versions)
@@ -1302,6 +1565,22 @@ def get_win_version(name: str) -> Dict[int, int]:
     return neighbor_version
 
 
+def get_win_neighbor_tensor(name: str, rank: int) -> torch.Tensor:
+    """ Get the tensor of the window buffer receiving from the in-neighbor rank.
+
+    It shares the memory with the window buffer instead of copying it, so its values
+    change with the win ops. It keeps the last values after win_free.
+
+    Args:
+        name: The unique name to get the associated window object.
+        rank: An in-neighbor rank of the window.
+
+    Returns:
+        torch.Tensor: The neighbor tensor, which should not be modified.
+    """
+    return mpi_lib.bluefog_torch_get_win_neighbor_tensor(name, rank)
+
+
 # Lock for MPI Open a passive RMA epcoh, which has nothing to do with mutex.
 @contextmanager
 def win_lock(name: str):
@@ -109,6 +109,7 @@ bool WinTorchStorageManager::UnregisterWinName(const std::string& name) {
   if (it == tensors_map_.end()) {
     return false;
   }
+  UnbindSharedNeighborStorage(name);
   tensors_map_.erase(it);
   self_tensor_map_.erase(self_tensor_map_.find(name));
   device_map_.erase(device_map_.find(name));
@@ -116,6 +117,9 @@ bool WinTorchStorageManager::UnregisterWinName(const std::string& name) {
 }
 
 void WinTorchStorageManager::ClearAll() {
+  for (auto& kv : tensors_map_) {
+    UnbindSharedNeighborStorage(kv.first);
+  }
   tensors_map_.clear();
   self_tensor_map_.clear();
 }
@@ -152,6 +156,39 @@ bool WinTorchStorageManager::GetDeviceByName(const std::string& name,
   return true;
 }
 
+bool WinTorchStorageManager::BindSharedNeighborStorage(
+    const std::string& name) {
+  auto it = tensors_map_.find(name);
+  if (it == tensors_map_.end()) {
+    return false;
+  }
+  for (auto& kv : it->second) {
+    void* buffer = nullptr;
+    ThrowIfError(common::GetWindowSharedBuffer(name, kv.first, &buffer));
+    if (buffer == nullptr) continue;
+    // The window has copied the content of the tensor into the buffer.
+    ::torch::Tensor neighbor_tensor = kv.second->GetUnderlyingTensor();
+    neighbor_tensor.set_(::torch::from_blob(buffer, neighbor_tensor.sizes(),
+                                            neighbor_tensor.options()));
+    shared_bound_ranks_[name].push_back(kv.first);
+  }
+  return true;
+}
+
+void WinTorchStorageManager::UnbindSharedNeighborStorage(
+    const std::string& name) {
+  auto it = shared_bound_ranks_.find(name);
+  if (it == shared_bound_ranks_.end()) {
+    return;
+  }
+  for (int rank : it->second) {
+    ::torch::Tensor neighbor_tensor =
+        tensors_map_[name][rank]->GetUnderlyingTensor();
+    neighbor_tensor.set_(neighbor_tensor.clone());
+  }
+  shared_bound_ranks_.erase(it);
+}
+
 bool WinTorchStorageManager::GetStorageByNameRank(
     const std::string& name, const int rank,
     std::shared_ptr<TorchTensor>& tensor) {
@@ -215,13 +252,20 @@ bool WinTorchStorageManager::AvgWithNeighbor(
     return false;
   }
 
-  local_tensor.mul_(self_weight);
-
   auto neighbor_map = it->second;
+  std::vector<::torch::Tensor> neighbor_tensors;
+  std::vector<double> weights;
   for (auto& kv : neighbor_weights) {
-    double weight = kv.second;
-    auto neighbor_tesnor = neighbor_map.at(kv.first)->GetUnderlyingTensor();
-    local_tensor.add_(neighbor_tesnor.mul(weight));
+    neighbor_tensors.push_back(neighbor_map.at(kv.first)->GetUnderlyingTensor());
+    weights.push_back(kv.second);
+  }
+  // CPU float tensors are averaged in one pass over the memory.
+  if (!TryWeightedSum(local_tensor, local_tensor, self_weight,
+                      neighbor_tensors, weights)) {
+    local_tensor.mul_(self_weight);
+    for (size_t i = 0; i < neighbor_tensors.size(); ++i) {
+      local_tensor.add_(neighbor_tensors[i].mul(weights[i]));
+    }
   }
   if (associated_with_p) {
     double avg_p = GetWinAssociatedP(name) * self_weight;  // self value
@@ -281,7 +325,8 @@ bool WinTorchStorageManager::AvgWithNeighbor(
 void DoWinWait(int);
 
 int DoWinCreate(::torch::Tensor tensor, const std::string& name,
-                const bool zero_init) {
+                const bool zero_init, int compression,
+                double compression_ratio) {
   ThrowIfError(common::CheckInitialized());
 
   auto device = GetDeviceID(tensor);
@@ -295,6 +340,11 @@ int DoWinCreate(::torch::Tensor tensor, const std::string& name,
   } else {
     bf_tensor = std::make_shared<TorchTensor>(tensor);
   }
+  if (compression != 0 && device != CPU_DEVICE_ID) {
+    ThrowIfError(Status::InvalidArgument(
+        "Compressed windows are only supported on CPU, which requires "
+        "BLUEFOG_WIN_ON_GPU to be unset for GPU tensors."));
+  }
 
   // bf_neighbor_tensors is the vector with in-neighbor size and the order is
   // followed by neighbor order returned by bluefog_load_topology. 
@@ -308,6 +358,8 @@ int DoWinCreate(::torch::Tensor tensor, const std::string& name,
   auto handle = win_handle_manager.AllocateHandle();
   auto enqueue_result =
       EnqueueTensorWindowCreate(bf_tensor, bf_neighbor_tensors, name, device,
+                                (common::CompressionType)compression,
+                                compression_ratio,
                                 [handle](const Status& status) {
                                   win_handle_manager.MarkDone(handle, status);
                                 });
@@ -315,6 +367,7 @@ int DoWinCreate(::torch::Tensor tensor, const std::string& name,
   ThrowIfError(enqueue_result);
   // Blocking ops. Wait until it is done.
   DoWinWait(handle);
+  if (!win_storage_manager.BindSharedNeighborStorage(name)) return 0;
   return 1;
 }
 
@@ -344,13 +397,14 @@ int ResetNeighborTensor(const std::string& name,
 
 int DoWinSync(::torch::Tensor tensor, const std::string& name,
               double self_weight,
-              const std::unordered_map<int, double>& neighbor_weights,
-              bool reset, bool internal_avg, bool require_mutex) {
+              const std::unordered_map<int, double>& neighbor_weights_all,
+              bool reset, bool internal_avg, bool require_mutex,
+              const std::unordered_map<int, int>& min_versions,
+              int max_staleness, double timeout_seconds, bool skip_stale) {
   ThrowIfError(common::CheckInitialized());
 
   Timeline* timeline_ptr;
   Status timeline_status = GetBluefogTimeline(timeline_ptr);
-  timeline_ptr->ActivityStart(name, "WIN_SYNC_COMPUTE_AVERAGE");
 
   int device = CPU_DEVICE_ID;
   if (!win_storage_manager.GetDeviceByName(name, &device)) {
@@ -358,6 +412,33 @@ int DoWinSync(::torch::Tensor tensor, const std::string& name,
     return 0;
   }
 
+  // Wait for the neighbors before the mutex is acquired, which they need to
+  // write.
+  std::vector<int> versions;
+  if (!min_versions.empty() || max_staleness >= 0 || skip_stale) {
+    timeline_ptr->ActivityStart(name, "WIN_SYNC_WAIT_VERSION");
+    Status status = common::WaitWindowVersion(
+        name, min_versions, max_staleness, timeout_seconds, versions);
+    timeline_ptr->ActivityEnd(name);  // WIN_SYNC_WAIT_VERSION
+    if (!status.ok()) {
+      BFLOG(WARNING) << status.reason()
+                     << " Sync with the neighbors arrived so far.";
+    }
+  }
+  timeline_ptr->ActivityStart(name, "WIN_SYNC_COMPUTE_AVERAGE");
+
+  // The neighbors without a new version since the last sync are excluded, and
+  // their weights go to self so the weights still sum to the same.
+  std::unordered_map<int, double> neighbor_weights;
+  for (auto& kv : neighbor_weights_all) {
+    if (skip_stale && !versions.empty() && versions[kv.first] == 0) {
+      self_weight += kv.second;
+      internal_avg = true;
+    } else {
+      neighbor_weights.insert(kv);
+    }
+  }
+
   // We need to lock self avoid updating and win_put/win_accumulate happen at
   // simultaneous time.
   std::vector<int> neighbor_ranks;
@@ -369,7 +450,7 @@ int DoWinSync(::torch::Tensor tensor, const std::string& name,
     common::WindowMutexAcquire(name, neighbor_ranks, device, /*is_sync=*/true);
 
   bool associated_with_p = common::GetWinOpsWithAssociatedPState();
-  Status status = common::WindowSync(name, device);
+  Status status = common::WindowSync(name, device, versions);
 
   ::torch::Tensor tensor_buffer = tensor;
   if (WIN_ON_CPU && tensor.device().is_cuda()) {
@@ -656,6 +737,18 @@ std::vector<int> GetWinVersion(char* name,
   return versions;
 }
 
+::torch::Tensor GetWinNeighborTensor(const std::string& name, int rank) {
+  ThrowIfError(common::CheckInitialized());
+  std::shared_ptr<TorchTensor> bf_neighbor_tensor;
+  if (!win_storage_manager.GetStorageByNameRank(name, rank,
+                                                bf_neighbor_tensor)) {
+    ThrowIfError(Status::InvalidArgument("Cannot find the neighbor tensor of " +
+                                         name + " for rank " +
+                                         std::to_string(rank)));
+  }
+  return bf_neighbor_tensor->GetUnderlyingTensor();
+}
+
 void SetWinOpsWithAssociatedPState(bool value) {
   common::SetWinOpsWithAssociatedPState(value);
 }
@@ -722,6 +815,7 @@ void AddWinOpsIntoPybind(py::module& m) {
   m.def("bluefog_torch_win_mutex_release", &DoWinMutexRelease);
 
   m.def("bluefog_torch_get_win_version", &GetWinVersion);
+  m.def("bluefog_torch_get_win_neighbor_tensor", &GetWinNeighborTensor);
   
   m.def("bluefog_torch_win_associated_p", &GetWinAssociatedP);
   m.def("bluefog_torch_set_win_ops_with_associated_p_state", &SetWinOpsWithAssociatedPState);
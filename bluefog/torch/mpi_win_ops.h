@@ -65,6 +65,14 @@ class WinTorchStorageManager {
   // Get the device associated with registered name.
   bool GetDeviceByName(const std::string& name, int* device);
 
+  // Make the neighbor tensors of the ranks on the same node use the shared
+  // memory of the window, which those ranks write directly.
+  bool BindSharedNeighborStorage(const std::string& name);
+
+  // Give the tensors bound above their own copy of the shared memory, which
+  // is freed with the window while they may still be referenced.
+  void UnbindSharedNeighborStorage(const std::string& name);
+
   // Sum the local tensor with all neighbor tensors.
   bool SumWithNeighbor(const std::string& name, ::torch::Tensor local_tensor,
                        bool associated_with_p);
@@ -104,6 +112,9 @@ class WinTorchStorageManager {
 
   std::unordered_map<std::string, int> device_map_;
 
+  // { Tensor Name -> in-neighbor ranks of the tensors in shared memory }
+  std::unordered_map<std::string, std::vector<int>> shared_bound_ranks_;
+
   mutable std::mutex mutex_;
   int in_neighbor_degree_;
   int out_neighbor_degree_;
@@ -130,7 +141,9 @@ WIN_CREATE_H(torch_cuda_DoubleTensor, THCudaDoubleTensor)
       THTensor* tensor, char* name,                            \
       double self_weight,                                      \
       const std::unordered_map<int, double>& neighbor_weights, \
-      bool reset, bool internal_avg, bool require_mutex);
+      bool reset, bool internal_avg, bool require_mutex,       \
+      const std::unordered_map<int, int>& min_versions,        \
+      int max_staleness, double timeout_seconds, bool skip_stale);
 
 WIN_SYNC_H(torch_IntTensor, THIntTensor)
 WIN_SYNC_H(torch_LongTensor, THLongTensor)
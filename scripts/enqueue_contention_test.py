@@ -0,0 +1,154 @@
+"""Measure the enqueue throughput when many threads submit small ops at once.
+
+Two workloads are available:
+  * threads: several Python threads keep enqueueing nonblocking ops.
+  * hooks: the ops are enqueued by the gradient hooks of a model with many
+    small parameters during backward, which is what the optimizers do.
+
+Example:
+
+    mpirun -np 4 python scripts/enqueue_contention_test.py --workload threads --num-threads 8
+    mpirun -np 4 python scripts/enqueue_contention_test.py --workload hooks --num-layers 500
+"""
+import argparse
+import threading
+import time
+
+import numpy as np
+import torch
+
+import bluefog.torch as bf
+
+parser = argparse.ArgumentParser(description='Bluefog enqueue contention benchmark',
+                                 formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('--workload', type=str, default="threads",
+                    help='The workload to run. Supporting options are ' +
+                    '[threads(Default), hooks].')
+parser.add_argument('--op', type=str, default="neighbor_allreduce",
+                    help='The op to enqueue. Supporting options are ' +
+                    '[neighbor_allreduce(Default), allreduce].')
+parser.add_argument('--num-threads', type=int, default=8,
+                    help='number of Python threads enqueueing ops in threads workload')
+parser.add_argument('--ops-per-thread', type=int, default=200,
+                    help='number of ops enqueued by each thread in one iteration')
+parser.add_argument('--num-layers', type=int, default=200,
+                    help='number of small linear layers in hooks workload')
+parser.add_argument('--data-size', type=int, default=16,
+                    help='the number of float elements of each tensor.')
+parser.add_argument('--num-warmup', type=int, default=5,
+                    help='number of warm-up iterations that don\'t count towards benchmark')
+parser.add_argument('--num-iters', type=int, default=20,
+                    help='number of measured iterations')
+
+args = parser.parse_args()
+
+bf.init()
+
+
+def issue_op(tensor, name):
+    if args.op == "neighbor_allreduce":
+        return bf.neighbor_allreduce_nonblocking(tensor, name=name)
+    if args.op == "allreduce":
+        return bf.allreduce_nonblocking(tensor, name=name)
+    raise ValueError("Unknown args.op " + args.op)
+
+
+def run_threads_iteration(enqueue_times):
+    tensors = [torch.randn(args.data_size) for _ in range(args.num_threads)]
+    handles = [[] for _ in range(args.num_threads)]
+    barrier = threading.Barrier(args.num_threads)
+
+    def worker(tid):
+        barrier.wait()
+        for i in range(args.ops_per_thread):
+            start = time.perf_counter()
+            handle = issue_op(tensors[tid], "contention.{}.{}".format(tid, i))
+            enqueue_times.append(time.perf_counter() - start)
+            handles[tid].append(handle)
+
+    threads = [threading.Thread(target=worker, args=(tid,))
+               for tid in range(args.num_threads)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for thread_handles in handles:
+        for handle in thread_handles:
+            bf.synchronize(handle)
+    return args.num_threads * args.ops_per_thread
+
+
+class SmallLayersNet(torch.nn.Module):
+    def __init__(self):
+        super(SmallLayersNet, self).__init__()
+        self.layers = torch.nn.ModuleList(
+            [torch.nn.Linear(args.data_size, args.data_size)
+             for _ in range(args.num_layers)])
+
+    def forward(self, x):
+        for layer in self.layers:
+            x = layer(x)
+        return x
+
+
+model = SmallLayersNet()
+hook_handles = []
+
+
+def make_hook(name, enqueue_times):
+    def hook(grad):
+        start = time.perf_counter()
+        hook_handles.append(issue_op(grad, name))
+        enqueue_times.append(time.perf_counter() - start)
+    return hook
+
+
+hook_enqueue_times = []
+for param_name, param in model.named_parameters():
+    param.register_hook(make_hook("contention." + param_name, hook_enqueue_times))
+
+
+def run_hooks_iteration(enqueue_times):
+    hook_enqueue_times.clear()
+    hook_handles.clear()
+    model.zero_grad()
+    model(torch.randn(4, args.data_size)).sum().backward()
+    for handle in hook_handles:
+        bf.synchronize(handle)
+    enqueue_times.extend(hook_enqueue_times)
+    return len(hook_handles)
+
+
+def run_iteration(enqueue_times):
+    if args.workload == "threads":
+        return run_threads_iteration(enqueue_times)
+    if args.workload == "hooks":
+        return run_hooks_iteration(enqueue_times)
+    raise ValueError("Unknown args.workload " + args.workload)
+
+
+def log(s):
+    if bf.rank() == 0:
+        print(s, flush=True)
+
+
+log('Running warmup...')
+for _ in range(args.num_warmup):
+    run_iteration([])
+
+log('Running benchmark...')
+enqueue_times = []
+num_ops = 0
+bf.barrier()
+start = time.perf_counter()
+for _ in range(args.num_iters):
+    num_ops += run_iteration(enqueue_times)
+elapsed = time.perf_counter() - start
+
+enqueue_times = np.array(enqueue_times) * 1e6
+log('Workload: %s, op: %s, size: %d, ops per rank: %d' %
+    (args.workload, args.op, bf.size(), num_ops))
+log('Throughput: %.1f ops/sec per rank' % (num_ops / elapsed))
+log('Enqueue time (us): mean %.1f, p50 %.1f, p99 %.1f, max %.1f' %
+    (np.mean(enqueue_times), np.percentile(enqueue_times, 50),
+     np.percentile(enqueue_times, 99), np.max(enqueue_times)))
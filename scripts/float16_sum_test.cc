@@ -0,0 +1,167 @@
+// Check that every float16_sum and bfloat16_sum implementation supported by
+// this CPU gives the same bits as the scalar one, then measure their throughput.
+// Compile and run with
+//   mpicxx -O2 -std=c++14 -I. -o float16_sum_test scripts/float16_sum_test.cc bluefog/common/half.cc && ./float16_sum_test
+
+#include <stdio.h>
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bluefog/common/half.h"
+
+using SumFunc = std::function<void(int impl, const unsigned short* in,
+                                   unsigned short* inout, int len)>;
+
+// A 16-bit float format and its implementations, indexed by their enum value.
+struct Format {
+  std::string name;
+  std::vector<std::string> impl_names;
+  std::function<bool(int impl)> supported;
+  SumFunc sum;
+  int best_impl;
+  // Exponent mask in the bits, which are all set for NaN and infinity.
+  unsigned short exponent_mask;
+};
+
+bool IsNaN(const Format& format, unsigned short h) {
+  return (h & format.exponent_mask) == format.exponent_mask &&
+         (h & ~format.exponent_mask & 0x7fff) != 0;
+}
+
+// Returns the number of elements which differ from the scalar implementation.
+// NaN only needs to be NaN, since the payload and sign of NaN are not kept.
+int CheckBitExact(const Format& format, int impl,
+                  const std::vector<unsigned short>& in,
+                  const std::vector<unsigned short>& inout) {
+  std::vector<unsigned short> expected = inout;
+  std::vector<unsigned short> actual = inout;
+  format.sum(0, in.data(), expected.data(), in.size());
+  format.sum(impl, in.data(), actual.data(), in.size());
+  int mismatches = 0;
+  for (size_t i = 0; i < in.size(); i++) {
+    bool same = IsNaN(format, expected[i]) ? IsNaN(format, actual[i])
+                                           : expected[i] == actual[i];
+    if (!same) {
+      if (mismatches < 10) {
+        printf("  0x%04x + 0x%04x: expected 0x%04x, got 0x%04x\n", in[i],
+               inout[i], expected[i], actual[i]);
+      }
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+  using namespace bluefog::common;
+  std::vector<Format> formats = {
+      {"float16",
+       {"scalar", "f16c", "avx512f", "avx512fp16"},
+       [](int impl) { return Float16SumSupported((Float16SumImpl)impl); },
+       [](int impl, const unsigned short* in, unsigned short* inout, int len) {
+         Float16Sum((Float16SumImpl)impl, in, inout, len);
+       },
+       (int)Float16SumBestImpl(),
+       0x7c00},
+      {"bfloat16",
+       {"scalar", "avx2", "avx512f"},
+       [](int impl) { return BFloat16SumSupported((BFloat16SumImpl)impl); },
+       [](int impl, const unsigned short* in, unsigned short* inout, int len) {
+         BFloat16Sum((BFloat16SumImpl)impl, in, inout, len);
+       },
+       (int)BFloat16SumBestImpl(),
+       0x7f80},
+  };
+
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<int> bits(0, 0xffff);
+
+  // Every 16-bit value against a set of special and random values, which
+  // covers zeros, subnormals, overflow to infinity and the ties of rounding.
+  std::vector<unsigned short> others = {0x0000, 0x8000, 0x0001, 0x8001, 0x03ff,
+                                        0x0400, 0x3c00, 0xbc00, 0x7bff, 0xfbff,
+                                        0x7c00, 0xfc00, 0x7e00, 0x1400, 0x6800,
+                                        0x007f, 0x0080, 0x3f80, 0x7f7f, 0x7f80,
+                                        0xff80, 0x7fc0};
+  for (int i = 0; i < 64; i++) {
+    others.push_back(bits(gen));
+  }
+  std::vector<unsigned short> in;
+  std::vector<unsigned short> inout;
+  for (unsigned short other : others) {
+    for (int h = 0; h <= 0xffff; h++) {
+      in.push_back(h);
+      inout.push_back(other);
+    }
+  }
+  // Plus random pairs with an odd length, so that the scalar tail is used.
+  for (int i = 0; i < (1 << 22) + 7; i++) {
+    in.push_back(bits(gen));
+    inout.push_back(bits(gen));
+  }
+
+  // Sums of moderate values, so that the timing is not about special values.
+  const int kLength = 1 << 24;
+  const int kIters = 20;
+  std::uniform_real_distribution<float> values(-1.0f, 1.0f);
+  std::vector<float> a_float(kLength);
+  std::vector<float> b_float(kLength);
+  for (int i = 0; i < kLength; i++) {
+    a_float[i] = values(gen);
+    b_float[i] = values(gen);
+  }
+
+  int failures = 0;
+  for (const Format& format : formats) {
+    printf("%s\n", format.name.c_str());
+    for (size_t impl = 1; impl < format.impl_names.size(); impl++) {
+      if (!format.supported(impl)) {
+        printf("  %-10s not supported, skipped\n",
+               format.impl_names[impl].c_str());
+        continue;
+      }
+      int mismatches = CheckBitExact(format, impl, in, inout);
+      printf("  %-10s %s (%d mismatches in %zu sums)\n",
+             format.impl_names[impl].c_str(),
+             mismatches == 0 ? "bit-exact" : "FAILED", mismatches, in.size());
+      failures += mismatches > 0;
+    }
+
+    std::vector<unsigned short> a(kLength);
+    std::vector<unsigned short> b(kLength);
+    for (int i = 0; i < kLength; i++) {
+      if (format.name == "float16") {
+        Float2HalfBits(&a_float[i], &a[i]);
+        Float2HalfBits(&b_float[i], &b[i]);
+      } else {
+        Float2BFloat16Bits(&a_float[i], &a[i]);
+        Float2BFloat16Bits(&b_float[i], &b[i]);
+      }
+    }
+    for (size_t impl = 0; impl < format.impl_names.size(); impl++) {
+      if (!format.supported(impl)) {
+        continue;
+      }
+      std::vector<unsigned short> c = b;
+      format.sum(impl, a.data(), c.data(), kLength);  // warm up
+      auto start = std::chrono::steady_clock::now();
+      for (int iter = 0; iter < kIters; iter++) {
+        format.sum(impl, a.data(), c.data(), kLength);
+      }
+      double elapsed = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start).count();
+      // Two reads and one write per element.
+      double gbytes = 3.0 * sizeof(unsigned short) * kLength * kIters / 1e9;
+      printf("  %-10s %8.2f ms per %d elements, %6.2f GB/s\n",
+             format.impl_names[impl].c_str(), elapsed * 1e3 / kIters, kLength,
+             gbytes / elapsed);
+    }
+    printf("  %s_sum uses %s\n", format.name.c_str(),
+           format.impl_names[format.best_impl].c_str());
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+"""Measure the per-op overhead with thousands of small tensors in flight.
+
+Every iteration issues one nonblocking op per tensor, like the hooks of a
+model with many small parameters, then waits for all of them. The wall time
+and the CPU time of the process (both threads) are reported per op. Run it
+on two builds to compare the bookkeeping of the tensor queue, e.g.:
+
+    mpirun -np 4 python scripts/many_small_ops_test.py
+    mpirun -np 4 python scripts/many_small_ops_test.py --noname
+"""
+import argparse
+import time
+
+import numpy as np
+import torch
+
+import bluefog.torch as bf
+
+parser = argparse.ArgumentParser(description='Bluefog many small ops benchmark',
+                                 formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('--op', type=str, default="neighbor_allreduce",
+                    help='The op to measure. Supporting options are ' +
+                    '[neighbor_allreduce(Default), allreduce].')
+parser.add_argument('--num-tensors', type=int, default=2000,
+                    help='number of tensors in flight in every iteration')
+parser.add_argument('--data-size', type=int, default=16,
+                    help='the number of float elements of every tensor.')
+parser.add_argument('--num-warmup', type=int, default=5,
+                    help='number of warm-up iterations that don\'t count towards benchmark')
+parser.add_argument('--num-iters', type=int, default=20,
+                    help='number of measured iterations')
+parser.add_argument('--noname', action='store_true', default=False,
+                    help='let bluefog generate a new name for every op instead of reusing ' +
+                    'one name per tensor')
+
+args = parser.parse_args()
+
+bf.init()
+
+tensors = [torch.randn(args.data_size) for _ in range(args.num_tensors)]
+
+
+def issue_op(tensor, name):
+    if args.op == "neighbor_allreduce":
+        return bf.neighbor_allreduce_nonblocking(tensor, name=name)
+    if args.op == "allreduce":
+        return bf.allreduce_nonblocking(tensor, name=name)
+    raise ValueError("Unknown args.op " + args.op)
+
+
+def measure(num_iters):
+    wall_times = np.zeros(num_iters)
+    cpu_times = np.zeros(num_iters)
+    for i in range(num_iters):
+        bf.barrier()
+        wall_start = time.perf_counter()
+        cpu_start = time.process_time()
+        handles = [issue_op(t, None if args.noname else "param.{}".format(j))
+                   for j, t in enumerate(tensors)]
+        for handle in handles:
+            bf.synchronize(handle)
+        cpu_times[i] = time.process_time() - cpu_start
+        wall_times[i] = time.perf_counter() - wall_start
+    return wall_times * 1e6 / args.num_tensors, cpu_times * 1e6 / args.num_tensors
+
+
+def log(s):
+    if bf.rank() == 0:
+        print(s, flush=True)
+
+
+log('Running warmup...')
+measure(args.num_warmup)
+
+log('Running benchmark...')
+wall_times, cpu_times = measure(args.num_iters)
+
+log('Op: %s, size: %d, tensors: %d, data size: %d floats, names: %s' %
+    (args.op, bf.size(), args.num_tensors, args.data_size,
+     "generated" if args.noname else "reused"))
+log('Wall time per op (us): mean %.2f, min %.2f' % (np.mean(wall_times), np.min(wall_times)))
+log('CPU time per op (us): mean %.2f, min %.2f' % (np.mean(cpu_times), np.min(cpu_times)))
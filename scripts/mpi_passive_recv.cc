@@ -1,12 +1,22 @@
 // A pure C++ mpi to implement passive receive.
 // Compile and run with
 //   mpicxx -o mpi_passive_recv mpi_passive_recv.cc -std=c++11 && bfrun -np 4 mpi_passive_recv
+//
+// With the argument "win", rank 0 computes without entering MPI while the
+// other ranks put into its window, and the latency of their puts is printed.
+// Add "progress" to poll the MPI progress engine in another thread of rank 0
+// like BLUEFOG_WIN_PROGRESS_THREAD, e.g.
+//   bfrun -np 4 mpi_passive_recv win
+//   bfrun -np 4 mpi_passive_recv win progress
 
 #include <mpi.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <memory>
 #include <queue>
 #include <thread>
@@ -166,6 +176,76 @@ void sendrecv_gossip(const int self_rank, const int target_rank) {
   printf("Rank [%d]: recv from %d\n", self_rank, recvbuf[1]);
 }
 
+const int kWinLength = 1 << 16;
+const int kNumPuts = 50;
+const int kComputeMilliseconds = 200;
+
+void win_progress(std::atomic_bool& shut_down) {
+  while (!shut_down.load()) {
+    int flag = 0;
+    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag,
+               MPI_STATUS_IGNORE);
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+// Rank 0 busy computes for kComputeMilliseconds at a time, and only enters
+// MPI in between. The other ranks keep putting into the window of rank 0.
+void win_passive_put(const int self_rank, const int size, bool progress) {
+  std::vector<float> win_mem(self_rank == 0 ? kWinLength * size : 0);
+  MPI_Win win;
+  MPI_Win_create(win_mem.data(), win_mem.size() * sizeof(float), sizeof(float),
+                 MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if (self_rank == 0) {
+    std::atomic_bool shut_down(false);
+    std::thread progress_thread;
+    if (progress) {
+      progress_thread = std::thread(win_progress, std::ref(shut_down));
+    }
+    int num_done = 0;
+    volatile double sink = 0;
+    while (num_done < size - 1) {
+      auto end = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(kComputeMilliseconds);
+      while (std::chrono::steady_clock::now() < end) {
+        sink = sink + 1.0;
+      }
+      int flag = 0;
+      MPI_Iprobe(MPI_ANY_SOURCE, kTag, MPI_COMM_WORLD, &flag,
+                 MPI_STATUS_IGNORE);
+      if (flag) {
+        MPI_Recv(nullptr, 0, MPI_INT, MPI_ANY_SOURCE, kTag, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+        num_done++;
+      }
+    }
+    shut_down = true;
+    if (progress) progress_thread.join();
+  } else {
+    std::vector<float> sendbuf(kWinLength, (float)self_rank);
+    std::vector<double> latencies;
+    for (int i = 0; i < kNumPuts; i++) {
+      auto start = std::chrono::steady_clock::now();
+      MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+      MPI_Put(sendbuf.data(), kWinLength, MPI_FLOAT, 0, self_rank * kWinLength,
+              kWinLength, MPI_FLOAT, win);
+      MPI_Win_unlock(0, win);
+      latencies.push_back(std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("Rank [%d]: put latency (ms) p50 %.3f, p90 %.3f, max %.3f\n",
+           self_rank, latencies[kNumPuts / 2], latencies[kNumPuts * 9 / 10],
+           latencies.back());
+    MPI_Send(nullptr, 0, MPI_INT, 0, kTag, MPI_COMM_WORLD);
+  }
+  MPI_Win_free(&win);
+}
+
 int main(int argc, char** argv) {
   int rank, nproc;
   int mpi_threads_provided;
@@ -189,7 +269,9 @@ int main(int argc, char** argv) {
   //   passive_recv(nproc);
   // }
 
-  if (rank != 0) {
+  if (argc > 1 && strcmp(argv[1], "win") == 0) {
+    win_passive_put(rank, nproc, argc > 2 && strcmp(argv[2], "progress") == 0);
+  } else if (rank != 0) {
     any_send(rank);
   } else {
     std::atomic_bool shut_down(false);
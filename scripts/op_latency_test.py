@@ -0,0 +1,93 @@
+"""Measure the enqueue-to-callback latency of small ops.
+
+Run it once with the default fixed-cycle background thread and once with
+the event-driven one to compare the latency distribution, e.g.:
+
+    mpirun -np 4 python scripts/op_latency_test.py
+    BLUEFOG_EVENT_DRIVEN=1 mpirun -np 4 python scripts/op_latency_test.py
+"""
+import argparse
+import os
+import time
+
+import numpy as np
+import torch
+
+import bluefog.torch as bf
+from bluefog.common import topology_util
+
+parser = argparse.ArgumentParser(description='Bluefog op latency benchmark',
+                                 formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('--op', type=str, default="neighbor_allreduce",
+                    help='The op to measure. Supporting options are ' +
+                    '[neighbor_allreduce(Default), allreduce, broadcast, allgather].')
+parser.add_argument('--data-size', type=int, default=16,
+                    help='the number of float elements of the tensor.')
+parser.add_argument('--num-warmup', type=int, default=100,
+                    help='number of warm-up ops that don\'t count towards benchmark')
+parser.add_argument('--num-iters', type=int, default=2000,
+                    help='number of measured ops')
+parser.add_argument('--interval-us', type=float, default=0.0,
+                    help='idle time between two consecutive ops in microseconds')
+parser.add_argument('--virtual-topology', type=str, default="expo2",
+                    help='The underlying virtual topology. Supporting options are ' +
+                    '[expo2(Default), ring].')
+
+args = parser.parse_args()
+
+bf.init()
+if args.virtual_topology == "ring":
+    bf.set_topology(topology_util.RingGraph(bf.size()))
+elif args.virtual_topology != "expo2":
+    raise ValueError("Unknown args.virtual_topology, supporting options are " +
+                     "[expo2(Default), ring].")
+
+data = torch.randn(args.data_size)
+
+
+def issue_op(name):
+    if args.op == "neighbor_allreduce":
+        return bf.neighbor_allreduce_nonblocking(data, name=name)
+    if args.op == "allreduce":
+        return bf.allreduce_nonblocking(data, name=name)
+    if args.op == "broadcast":
+        return bf.broadcast_nonblocking(data, root_rank=0, name=name)
+    if args.op == "allgather":
+        return bf.allgather_nonblocking(data, name=name)
+    raise ValueError("Unknown args.op " + args.op)
+
+
+def measure(num_iters):
+    latencies = np.zeros(num_iters)
+    for i in range(num_iters):
+        bf.barrier()
+        if args.interval_us > 0:
+            time.sleep(args.interval_us * 1e-6)
+        start = time.perf_counter()
+        handle = issue_op("latency.{}".format(args.op))
+        bf.synchronize(handle)
+        latencies[i] = time.perf_counter() - start
+    return latencies * 1e6
+
+
+def log(s):
+    if bf.rank() == 0:
+        print(s, flush=True)
+
+
+log('Running warmup...')
+measure(args.num_warmup)
+
+log('Running benchmark...')
+latencies = measure(args.num_iters)
+
+# Average the latency of every iteration over all ranks.
+latencies = bf.allreduce(torch.from_numpy(latencies), average=False, name="latency.all")
+latencies = latencies.numpy() / bf.size()
+
+log('Mode: %s, op: %s, size: %d, data size: %d floats' %
+    ("event-driven" if os.environ.get("BLUEFOG_EVENT_DRIVEN") == "1" else "cycle",
+     args.op, bf.size(), args.data_size))
+log('Latency (us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f' %
+    (np.mean(latencies), np.percentile(latencies, 50), np.percentile(latencies, 90),
+     np.percentile(latencies, 99), np.max(latencies)))
@@ -22,6 +22,13 @@ parser.add_argument('--internal-num-iters', type=int, default=10,
 parser.add_argument('--virtual-topology', type=str, default="expo2",
                     help='The underlying virtual topology. Supporting options are ' +
                     '[expo2(Default), ring, mesh, star].')
+parser.add_argument('--op', type=str, default="neighbor_allreduce",
+                    help='The op to measure. Supporting options are ' +
+                    '[neighbor_allreduce(Default), hierarchical_neighbor_allreduce, win_put, ' +
+                    'win_accumulate].')
+parser.add_argument('--distinct-win-weights', action='store_true', default=False,
+                    help='weight the tensor of win_put and win_accumulate differently for ' +
+                    'every out-neighbor instead of 1.')
 parser.add_argument('--seed', type=int, default=2020, help='Seed for randomness.')
 parser.add_argument('--profiler', action='store_true', default=False,
                     help='disables profiler')
@@ -51,10 +58,32 @@ else:
     raise ValueError("Unknown args.virtual_topology, supporting options are " +
                      "[expo2(Default), ring, mesh, star].")
 
+dst_weights = None
+if args.op in ("win_put", "win_accumulate"):
+    bf.win_create(data, name="single_ops_test", zero_init=True)
+    if args.distinct_win_weights:
+        # Compare with BLUEFOG_WIN_BATCHED_RMA=1.
+        dst_weights = {r: 1.0 / (i + 2) for i, r in enumerate(bf.out_neighbor_ranks())}
+elif args.op == "hierarchical_neighbor_allreduce":
+    # Compare with BLUEFOG_HIERARCHICAL_SHARED_MEMORY=1.
+    bf.set_machine_topology(topology_util.RingGraph(bf.machine_size()))
+elif args.op != "neighbor_allreduce":
+    raise ValueError("Unknown args.op, supporting options are " +
+                     "[neighbor_allreduce(Default), hierarchical_neighbor_allreduce, " +
+                     "win_put, win_accumulate].")
+
+
 def benchmark_step():
     global args, data
     for _ in range(args.internal_num_iters):
-        bf.neighbor_allreduce(data)
+        if args.op == "win_put":
+            bf.win_put(data, name="single_ops_test", dst_weights=dst_weights)
+        elif args.op == "win_accumulate":
+            bf.win_accumulate(data, name="single_ops_test", dst_weights=dst_weights)
+        elif args.op == "hierarchical_neighbor_allreduce":
+            bf.hierarchical_neighbor_allreduce(data)
+        else:
+            bf.neighbor_allreduce(data)
 
 
 def log(s, nl=True):
@@ -0,0 +1,87 @@
+"""Measure the window mutex under contention.
+
+Ranks 1..k win_accumulate into rank 0 with the mutex for a fixed time while
+rank 0 keeps calling win_update with the mutex, for every number of writers k
+from 1 to size - 1. Throughput and latency are printed per k, e.g.:
+
+    mpirun -np 16 python scripts/win_mutex_benchmark.py
+"""
+import argparse
+import time
+
+import numpy as np
+import torch
+
+import bluefog.torch as bf
+from bluefog.common import topology_util
+
+parser = argparse.ArgumentParser(description='Bluefog window mutex benchmark',
+                                 formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('--data-size', type=int, default=16,
+                    help='the number of float elements of the tensor.')
+parser.add_argument('--duration', type=float, default=2.0,
+                    help='seconds measured for every number of writers')
+parser.add_argument('--num-warmup', type=int, default=20,
+                    help='number of warm-up ops of every writer')
+
+args = parser.parse_args()
+
+bf.init()
+if bf.size() < 2:
+    raise ValueError("The benchmark needs at least 2 processes.")
+bf.set_topology(topology_util.StarGraph(bf.size()))
+
+tensor = torch.randn(args.data_size)
+name = "mutex_benchmark"
+bf.win_create(tensor, name=name, zero_init=True)
+
+
+def log(s):
+    if bf.rank() == 0:
+        print(s, flush=True)
+
+
+def run(num_writers, duration):
+    """Returns the latencies of the ops of this rank in microseconds."""
+    latencies = []
+    bf.barrier()
+    end = time.perf_counter() + duration
+    if bf.rank() == 0:
+        while time.perf_counter() < end:
+            start = time.perf_counter()
+            bf.win_update(name, require_mutex=True)
+            latencies.append(time.perf_counter() - start)
+    elif bf.rank() <= num_writers:
+        while time.perf_counter() < end:
+            start = time.perf_counter()
+            bf.win_accumulate(tensor, name, dst_weights={0: 1.0},
+                              require_mutex=True)
+            latencies.append(time.perf_counter() - start)
+    bf.barrier()
+    return np.array(latencies) * 1e6
+
+
+log('Data size: %d floats, %.1f s per number of writers' %
+    (args.data_size, args.duration))
+log('%8s %14s %14s %10s %10s %14s' %
+    ('writers', 'accumulate/s', 'update/s', 'p50 (us)', 'p99 (us)',
+     'fairness'))
+for k in range(1, bf.size()):
+    run(k, args.num_warmup * 1e-3)
+    latencies = run(k, args.duration)
+    is_writer = 1 <= bf.rank() <= k
+    counts = torch.zeros(bf.size())
+    counts[bf.rank()] = len(latencies)
+    counts = bf.allreduce(counts, average=False, name="mutex_benchmark.counts")
+    writer_latencies = bf.allgather(
+        torch.from_numpy(latencies if is_writer else np.zeros(0)).double(),
+        name="mutex_benchmark.latencies").numpy()
+    writer_counts = counts[1:k + 1].numpy()
+    # Ratio of the fewest to the most ops of the writers, 1 is perfectly fair.
+    fairness = writer_counts.min() / max(writer_counts.max(), 1)
+    log('%8d %14.1f %14.1f %10.1f %10.1f %14.2f' %
+        (k, writer_counts.sum() / args.duration, counts[0].item() / args.duration,
+         np.percentile(writer_latencies, 50), np.percentile(writer_latencies, 99),
+         fairness))
+
+bf.win_free(name)
@@ -303,6 +303,7 @@ def get_common_options(build_ext):
         'third_party/flatbuffers/include',
     ]
     SOURCES = ["bluefog/common/common.cc",
+               "bluefog/common/compressor.cc",
                "bluefog/common/cuda_util.cc",
                "bluefog/common/half.cc",
                "bluefog/common/logging.cc",
@@ -310,9 +311,12 @@ def get_common_options(build_ext):
                "bluefog/common/mpi_context.cc",
                "bluefog/common/mpi_controller.cc",
                "bluefog/common/operations.cc",
+               "bluefog/common/parameter_manager.cc",
+               "bluefog/common/response_cache.cc",
                "bluefog/common/tensor_queue.cc",
                "bluefog/common/thread_pool.cc",
-               "bluefog/common/timeline.cc"]
+               "bluefog/common/timeline.cc",
+               "bluefog/common/weighted_sum.cc"]
     COMPILE_FLAGS = cpp_flags + shlex.split(mpi_flags)
     LINK_FLAGS = link_flags + shlex.split(mpi_flags)
     LIBRARY_DIRS = []
@@ -106,6 +106,24 @@ class OpsTests(tf.test.TestCase):
             self.assertTrue(diff <= threshold,
                             "bf.allreduce produces incorrect results")
 
+    def test_bluefog_allreduce_bfloat16_cpu(self):
+        """Test on CPU that the allreduce correctly sums bfloat16 tensors."""
+        rank = bf.rank()
+        size = bf.size()
+        # The sum of the ranks is exact in bfloat16 up to 256.
+        if size > 16:
+            return
+        dims = [1, 2, 3]
+        for dim in dims:
+            with tf.device("/cpu:0"):
+                tensor = tf.cast(tf.ones([17] * dim) * rank, dtype=tf.bfloat16)
+                summed = bf.allreduce(tensor, average=False)
+            max_difference = tf.reduce_max(
+                tf.abs(tf.cast(summed, tf.float32) - size * (size - 1) / 2))
+            diff = self.evaluate(max_difference)
+            self.assertTrue(diff == 0,
+                            "bf.allreduce produces incorrect results for bfloat16")
+
     def test_bluefog_allreduce_gpu(self):
         """Test that the allreduce works on GPUs."""
         # Only do this test if there are GPUs available.
@@ -220,7 +238,7 @@ class OpsTests(tf.test.TestCase):
             return
 
         dtypes = [tf.int32, tf.int64, tf.float32,
-                  tf.float64, tf.bool]
+                  tf.float64, tf.bfloat16, tf.bool]
         dims = [1, 2, 3]
         root_ranks = list(range(size))
         for dtype, dim, root_rank in itertools.product(dtypes, dims, root_ranks):
@@ -285,7 +303,7 @@ class OpsTests(tf.test.TestCase):
         rank = bf.rank()
         size = bf.size()
 
-        dtypes = [tf.int32, tf.int64, tf.float32, tf.float64, tf.bool]
+        dtypes = [tf.int32, tf.int64, tf.float32, tf.float64, tf.bfloat16, tf.bool]
         dims = [1, 2, 3]
         for dtype, dim in itertools.product(dtypes, dims):
             tensor = tf.ones([17] * dim) * rank
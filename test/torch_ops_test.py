@@ -133,6 +133,30 @@ class OpsTests(unittest.TestCase):
                 torch.allclose(broadcasted_tensor, root_tensor)
             ), "bf.broadcast_ produces incorrect broadcasted tensor"
 
+    def test_broadcast_fused(self):
+        """Test that the nonblocking broadcasts from different root ranks are fused correctly."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        num_tensors = 10
+        handles = []
+        tensors = []
+        for i in range(num_tensors):
+            root_rank = i % 2
+            tensor = torch.FloatTensor(i + 1, 7).fill_(rank * num_tensors + i)
+            tensors.append(tensor)
+            handles.append(bf.broadcast_nonblocking_(
+                tensor, root_rank=root_rank, name="broadcast_fused_tensor_{}".format(i)))
+
+        for i, handle in enumerate(handles):
+            bf.synchronize(handle)
+            root_rank = i % 2
+            assert (tensors[i] == root_rank * num_tensors + i).all(), \
+                "bf.broadcast(fused) produces incorrect broadcasted tensor"
+
     def test_allreduce_avg(self):
         """Test that the allreduce correctly average 1D, 2D, 3D tensors."""
         size = bf.size()
@@ -181,6 +205,34 @@ class OpsTests(unittest.TestCase):
                 torch.allclose(output, tensor.mul(size))
             ), "bf.allreduce(sum) produces incorrect tensor"
 
+    def test_allreduce_bfloat16(self):
+        """Test that the allreduce correctly sums and averages bfloat16 tensors."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.BFloat16Tensor]
+        if TEST_ON_GPU:
+            dtypes += [torch.cuda.BFloat16Tensor]
+
+        dims = [1, 2, 3]
+        for dtype, dim, average in itertools.product(dtypes, dims, [False, True]):
+            # Small integers are exact in bfloat16, so is their sum.
+            tensor = torch.FloatTensor(*([23] * dim)).fill_(1).mul_(rank)
+            tensor = self.cast_and_place(tensor, dtype)
+            name = "allreduce_bfloat16_{}_{}_{}".format(dim, dtype, average)
+
+            output = bf.allreduce(tensor, average=average, name=name)
+            assert output.dtype == torch.bfloat16
+            expected = size * (size - 1) / 2
+            if average:
+                expected /= size
+            assert (
+                (output.float() - expected).abs().max() < LOOSE_EPSILON * size
+            ), "bf.allreduce produces incorrect bfloat16 tensor"
+
     def test_allreduce_avg_inplace(self):
         """Test that the allreduce correctly averages 1D, 2D, 3D tensors inplace."""
         size = bf.size()
@@ -242,6 +294,37 @@ class OpsTests(unittest.TestCase):
                 torch.allclose(tensor_2, output_2)
             ), "bf.allreduce(fusion) produces incorrect tensor 2"
 
+    def test_allreduce_fusion_mixed_dtypes(self):
+        """Test that the interleaved float32 and float16 allreduces are fused correctly."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.FloatTensor, torch.HalfTensor]
+        if TEST_ON_GPU:
+            dtypes = [torch.cuda.FloatTensor, torch.cuda.HalfTensor]
+
+        # Both dtypes are in flight together, so each one is fused in its own bucket.
+        tensors, handles = [], []
+        for i in range(8):
+            dtype = dtypes[i % 2]
+            tensor = torch.FloatTensor(*([23] * (i % 3 + 1))).fill_(1).mul_(rank + i)
+            tensor = self.cast_and_place(tensor, dtype)
+            tensors.append(tensor)
+            handles.append(bf.allreduce_nonblocking(
+                tensor, average=True, name="allreduce_fusion_mixed_dtypes_{}".format(i)))
+        for i, (tensor, handle) in enumerate(zip(tensors, handles)):
+            output = bf.synchronize(handle)
+            assert output.dtype == tensor.dtype, \
+                "bf.allreduce(fusion of mixed dtypes) changes the dtype"
+            output, = self.convert_cpu_fp16_to_fp32(output)
+            expected = (size - 1) / 2.0 + i
+            assert (
+                (output.data - expected).abs().max() < EPSILON
+            ), "bf.allreduce(fusion of mixed dtypes) produces incorrect tensor {}".format(i)
+
     def test_allreduce_fusion_inplace(self):
         """Test that the allreduce works under tensor fusion."""
         size = bf.size()
@@ -282,6 +365,60 @@ class OpsTests(unittest.TestCase):
                 torch.allclose(tensor_2, exp_tenosr_2)
             ), "bf.allreduce(fusion) produces incorrect tensor 2"
 
+    def test_allreduce_repeated_name(self):
+        """Test that the allreduce works when the same name is reused with shape changed."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        # The shape changes after a few iterations, which invalidates the cached response.
+        shapes = [[23]] * 5 + [[23, 2]] * 5 + [[23]] * 5
+        for shape in shapes:
+            tensor_1 = torch.FloatTensor(*shape).fill_(1).mul_(rank)
+            tensor_2 = torch.FloatTensor(*shape).fill_(1).mul_(rank+0.5)
+            handle_1 = bf.allreduce_nonblocking(tensor_1, average=True,
+                                                name="allreduce_repeated_tensor_1")
+            handle_2 = bf.allreduce_nonblocking(tensor_2, average=True,
+                                                name="allreduce_repeated_tensor_2")
+            output_1 = bf.synchronize(handle_1)
+            output_2 = bf.synchronize(handle_2)
+            assert list(output_1.shape) == shape, "bf.allreduce produces incorrect shape"
+            assert (
+                torch.allclose(output_1, torch.ones(*shape).mul_((size-1)/2))
+            ), "bf.allreduce(repeated) produces incorrect tensor 1"
+            assert (
+                torch.allclose(output_2, torch.ones(*shape).mul_((size-1)/2 + 0.5))
+            ), "bf.allreduce(repeated) produces incorrect tensor 2"
+
+    def test_allreduce_duplicated_name(self):
+        """Test that enqueueing a tensor with the name of a pending one fails right away."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        # The other ranks only enqueue after the broadcast from rank 0, so the first
+        # allreduce of rank 0 is still pending when it enqueues the same name again.
+        tensor = torch.FloatTensor(23).fill_(1).mul_(rank)
+        if rank == 0:
+            handle = bf.allreduce_nonblocking(tensor, average=True,
+                                              name="allreduce_duplicated_name")
+            with pytest.raises(ValueError):
+                bf.allreduce_nonblocking(tensor.clone(), average=True,
+                                         name="allreduce_duplicated_name")
+            bf.broadcast(torch.zeros(1), root_rank=0, name="allreduce_duplicated_name.go")
+        else:
+            bf.broadcast(torch.zeros(1), root_rank=0, name="allreduce_duplicated_name.go")
+            handle = bf.allreduce_nonblocking(tensor, average=True,
+                                              name="allreduce_duplicated_name")
+        output = bf.synchronize(handle)
+        assert (
+            torch.allclose(output, torch.ones(23).mul_((size-1)/2))
+        ), "bf.allreduce(duplicated name) produces incorrect tensor"
+
     def test_allgather(self):
         """Test that the allgather correctly gathers 1D, 2D, 3D tensors."""
         size = bf.size()
@@ -362,6 +499,75 @@ class OpsTests(unittest.TestCase):
                 assert rank_tensor.data.max() == i, \
                     "bf.allgather(var) produces incorrect gathered tensor"
 
+    @unittest.skipIf(bf.nccl_built(), 'nccl do not support variable size on allgather')
+    def test_allgather_fused_variable_size(self):
+        """Test that the nonblocking allgathers of variable size tensors are fused correctly."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        # Support tests up to MPI Size of 35
+        if size > 35:
+            return
+        tensor_sizes = ([17, 32, 81, 12, 15, 23, 22] * 5)[:size]
+        num_tensors = 10
+        handles = []
+        for i in range(num_tensors):
+            tensor = torch.FloatTensor(
+                *([tensor_sizes[rank] + i, 5])).fill_(1).mul_(rank * num_tensors + i)
+            tensor = self.cast_and_place(tensor, torch.FloatTensor)
+            handles.append(bf.allgather_nonblocking(
+                tensor, name="allgather_fused_tensor_{}".format(i)))
+
+        for i, handle in enumerate(handles):
+            gathered = bf.synchronize(handle)
+            expected_size = sum(tensor_sizes) + size * i
+            assert list(gathered.shape) == [expected_size, 5], \
+                "bf.allgather(fused) produces incorrect gathered shape"
+            offset = 0
+            for r in range(size):
+                rank_tensor = gathered[offset:offset + tensor_sizes[r] + i]
+                offset += tensor_sizes[r] + i
+                assert rank_tensor.data.min() == r * num_tensors + i, \
+                    "bf.allgather(fused) produces incorrect gathered tensor"
+                assert rank_tensor.data.max() == r * num_tensors + i, \
+                    "bf.allgather(fused) produces incorrect gathered tensor"
+
+    def test_allgather_fused_oversized(self):
+        """Test that the fused allgathers larger than the fusion buffer are gathered one by one."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        # Rank 0 plans the fusion with its small tensors, while the tensors gathered from the
+        # other ranks don't fit in the fusion buffer of 8MB.
+        slice_size = 100000
+        tensor_sizes = [1] + [8] * (size - 1)
+        num_tensors = 2
+        handles = []
+        for i in range(num_tensors):
+            tensor = torch.FloatTensor(
+                tensor_sizes[rank], slice_size).fill_(1).mul_(rank * num_tensors + i)
+            handles.append(bf.allgather_nonblocking(
+                tensor, name="allgather_fused_oversized_tensor_{}".format(i)))
+
+        for i, handle in enumerate(handles):
+            gathered = bf.synchronize(handle)
+            assert list(gathered.shape) == [sum(tensor_sizes), slice_size], \
+                "bf.allgather(fused oversized) produces incorrect gathered shape"
+            offset = 0
+            for r in range(size):
+                rank_tensor = gathered[offset:offset + tensor_sizes[r]]
+                offset += tensor_sizes[r]
+                assert rank_tensor.data.min() == r * num_tensors + i, \
+                    "bf.allgather(fused oversized) produces incorrect gathered tensor"
+                assert rank_tensor.data.max() == r * num_tensors + i, \
+                    "bf.allgather(fused oversized) produces incorrect gathered tensor"
+
     def test_neighbor_allreduce_sum_precision(self):
         """Test that the neighbor allreduce precision (sum) 1D, 2D, 3D tensors correctly."""
         size = bf.size()
@@ -635,6 +841,161 @@ class OpsTests(unittest.TestCase):
                  sum_value).abs().max() < eps
             ), "bf.neighbor_allreduce (avg) produces incorrect reduced tensor"
 
+    def test_neighbor_allreduce_compression(self):
+        """Test that the compressed neighbor all reduce (avg) 1D, 2D, 3D tensors correctly."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        # By default, we use exponential two ring topology.
+        num_indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) % size for i in range(num_indegree)]
+        sum_value = np.sum(neighbor_ranks) + rank
+
+        # Small integers are exact in float16 and topk keeps all the values with
+        # ratio 1.0, while int8 may be one quantization step away for each neighbor.
+        compressions = [('fp16', 0.01, EPSILON), ('topk', 1.0, EPSILON),
+                        ('int8', 0.01, num_indegree * size / 127.0)]
+        dims = [1, 2, 3]
+        for (compression, ratio, eps), dim in itertools.product(compressions, dims):
+            tensor = torch.FloatTensor(*([23] * dim)).fill_(1).mul_(rank)
+            name = "neighbor_allreduce_{}_{}".format(dim, compression)
+            reduced_tensor = bf.neighbor_allreduce(tensor, name=name, compression=compression,
+                                                   compression_ratio=ratio)
+            assert (
+                list(reduced_tensor.shape) == [23] * dim
+            ), "bf.neighbor_allreduce (compressed) produces incorrect reduced shape"
+            assert (
+                (reduced_tensor.data.mul_(num_indegree+1) -
+                 sum_value).abs().max() < eps
+            ), "bf.neighbor_allreduce (compressed) produces incorrect reduced tensor"
+
+    def test_neighbor_allreduce_topk_error_feedback(self):
+        """Test that top-k compression carries the dropped values over to the next calls."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        num_indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) % size for i in range(num_indegree)]
+        neighbor_scale = np.sum(neighbor_ranks) + num_indegree
+
+        # Every neighbor sends the 2 largest of its residual plus [1, 2, 3, 4]
+        # scaled by rank + 1, and keeps the others for the next call.
+        base = torch.FloatTensor([1, 2, 3, 4])
+        tensor = base.mul(rank + 1)
+        expected_sent = [[0, 0, 3, 4], [0, 4, 0, 4], [0, 0, 6, 4]]
+        total_sent = torch.zeros(4)
+        for sent in expected_sent:
+            reduced_tensor = bf.neighbor_allreduce(
+                tensor, name="neighbor_allreduce_topk_error_feedback",
+                compression='topk', compression_ratio=0.5)
+            received = reduced_tensor.mul(num_indegree+1) - tensor
+            assert (
+                (received - torch.FloatTensor(sent).mul(neighbor_scale)).abs().max() < EPSILON
+            ), "bf.neighbor_allreduce (topk) does not carry the residual over"
+            total_sent.add_(received)
+        # What is not received yet is still in the residuals of the neighbors.
+        residual = torch.FloatTensor([3, 2, 0, 0]).mul(neighbor_scale)
+        assert (
+            (total_sent + residual - base.mul(3 * neighbor_scale)).abs().max() < EPSILON
+        ), "bf.neighbor_allreduce (topk) loses the values it does not send"
+
+    def test_neighbor_allreduce_int8_nonuniform(self):
+        """Test that int8 compression keeps non-uniform values within one step per block."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        num_indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) % size for i in range(num_indegree)]
+
+        # Three blocks of 256 values (the last one partial) of different magnitudes,
+        # so every block is quantized with its own scale.
+        def make_tensor(r):
+            index = torch.arange(600, dtype=torch.float32)
+            return torch.sin(index).mul_(index.div(256).floor_().add_(1)).mul_(r + 1)
+
+        def quantization_step(t):
+            blocks = torch.nn.functional.pad(t.abs(), (0, 768 - 600)).view(3, 256)
+            return blocks.max(dim=1)[0].div(127).repeat_interleave(256)[:600]
+
+        tensor = make_tensor(rank)
+        expected = sum(make_tensor(r) for r in neighbor_ranks)
+        eps = sum(quantization_step(make_tensor(r)) for r in neighbor_ranks) + EPSILON
+        for _ in range(3):
+            reduced_tensor = bf.neighbor_allreduce(
+                tensor, name="neighbor_allreduce_int8_nonuniform", compression='int8')
+            received = reduced_tensor.mul(num_indegree+1) - tensor
+            assert (
+                ((received - expected).abs() <= eps).all()
+            ), "bf.neighbor_allreduce (int8) produces incorrect reduced tensor"
+
+    def test_hierarchical_neighbor_allreduce_self_machine(self):
+        """Test the hierarchical neighbor allreduce with every machine as its own neighbor."""
+        if bf.local_size() <= 1 or not bf.is_homogeneous():
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to local size 1 or heterogeneous machines".format(fname))
+            return
+        rank = bf.rank()
+        local_size = bf.local_size()
+        machine_rank = bf.machine_rank()
+        # The machine sends its local sum to itself, so the result is the local average.
+        local_avg = rank - bf.local_rank() + (local_size - 1) / 2.0
+
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        # The tensors grow, so the shared memory for them does, and the smallest one
+        # leaves some local ranks without a slice to sum.
+        dims = [1, 2, 3]
+        for dtype, dim in itertools.product(dtypes, dims):
+            tensor = torch.FloatTensor(*([23] * dim)).fill_(1).mul_(rank)
+            tensor = self.cast_and_place(tensor, dtype)
+            name = "hierarchical_neighbor_allreduce_{}_{}".format(dim, dtype)
+            reduced_tensor = bf.hierarchical_neighbor_allreduce(
+                tensor, self_weight=0.5, neighbor_machine_weights={machine_rank: 0.5},
+                send_neighbor_machines=[machine_rank], name=name)
+            assert (
+                list(reduced_tensor.shape) == [23] * dim
+            ), "bf.hierarchical_neighbor_allreduce produces incorrect reduced shape"
+            assert (
+                (reduced_tensor.data - local_avg).abs().max() < EPSILON
+            ), "bf.hierarchical_neighbor_allreduce produces incorrect reduced tensor"
+
+    def test_hierarchical_neighbor_allreduce_fused(self):
+        """Test the fused hierarchical neighbor allreduce of nonblocking calls."""
+        if bf.local_size() <= 1 or not bf.is_homogeneous():
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to local size 1 or heterogeneous machines".format(fname))
+            return
+        rank = bf.rank()
+        local_size = bf.local_size()
+        machine_rank = bf.machine_rank()
+        local_avg = rank - bf.local_rank() + (local_size - 1) / 2.0
+
+        # Tensors of different sizes and values are fused, and every result is copied
+        # back to its own output.
+        handles = []
+        for i, dim in enumerate([1, 2, 3, 2, 1]):
+            tensor = torch.FloatTensor(*([23] * dim)).fill_(1).mul_(rank + i)
+            handles.append(bf.hierarchical_neighbor_allreduce_nonblocking(
+                tensor, self_weight=0.5, neighbor_machine_weights={machine_rank: 0.5},
+                send_neighbor_machines=[machine_rank],
+                name="hierarchical_neighbor_allreduce_fused_{}".format(i)))
+        for i, handle in enumerate(handles):
+            reduced_tensor = bf.synchronize(handle)
+            assert (
+                (reduced_tensor.data - (local_avg + i)).abs().max() < EPSILON
+            ), "bf.hierarchical_neighbor_allreduce (fused) produces incorrect reduced tensor"
+
     def test_neighbor_allreduce_avg_meshgrid_topo(self):
         """
         Test that the neighbor all reduce (avg) 1D, 2D, 3D tensors
@@ -1063,6 +1424,76 @@ class OpsTests(unittest.TestCase):
             assert sorted(candidate_ranks) == gathered_ranks, \
                 "bf.neighbor_allgather produces incorrect gathered tensor"
 
+    def test_neighbor_allgather_fused_variable_size(self):
+        """Test that the nonblocking neighbor_allgathers of variable size tensors are fused."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        # The in-degree of the center differs from the others.
+        bf.set_topology(topology_util.StarGraph(size))
+        # The gathered tensors follow the ascending order of the in-neighbors.
+        in_neighbors = sorted(bf.in_neighbor_ranks())
+
+        tensor_sizes = [r % 5 + 1 for r in range(size)]
+        num_tensors = 10
+        handles = []
+        for i in range(num_tensors):
+            tensor = torch.FloatTensor(
+                tensor_sizes[rank] + i, 5).fill_(1).mul_(rank * num_tensors + i)
+            handles.append(bf.neighbor_allgather_nonblocking(
+                tensor, name="neighbor_allgather_fused_tensor_{}".format(i)))
+
+        for i, handle in enumerate(handles):
+            gathered = bf.synchronize(handle)
+            expected_size = sum(tensor_sizes[r] + i for r in in_neighbors)
+            assert list(gathered.shape) == [expected_size, 5], \
+                "bf.neighbor_allgather(fused) produces incorrect gathered shape"
+            offset = 0
+            for r in in_neighbors:
+                rank_tensor = gathered[offset:offset + tensor_sizes[r] + i]
+                offset += tensor_sizes[r] + i
+                assert rank_tensor.data.min() == r * num_tensors + i, \
+                    "bf.neighbor_allgather(fused) produces incorrect gathered tensor"
+                assert rank_tensor.data.max() == r * num_tensors + i, \
+                    "bf.neighbor_allgather(fused) produces incorrect gathered tensor"
+
+    def test_neighbor_allgather_fused_oversized(self):
+        """Test that all ranks agree to gather one by one when the fused tensors don't fit."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 2:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size <= 2".format(fname))
+            return
+        # Rank 0 is a leaf, so the two tensors are fused. They fit in the fusion buffer of 8MB on
+        # the leaves but not on the center, which receives from all the leaves.
+        center_rank = 1
+        bf.set_topology(topology_util.StarGraph(size, center_rank=center_rank))
+        # The gathered tensors follow the ascending order of the in-neighbors.
+        in_neighbors = sorted(bf.in_neighbor_ranks())
+
+        slice_size = 87500
+        num_tensors = 2
+        handles = []
+        for i in range(num_tensors):
+            tensor = torch.FloatTensor(5, slice_size).fill_(1).mul_(rank * num_tensors + i)
+            handles.append(bf.neighbor_allgather_nonblocking(
+                tensor, name="neighbor_allgather_fused_oversized_tensor_{}".format(i)))
+
+        for i, handle in enumerate(handles):
+            gathered = bf.synchronize(handle)
+            assert list(gathered.shape) == [5 * len(in_neighbors), slice_size], \
+                "bf.neighbor_allgather(fused oversized) produces incorrect gathered shape"
+            for j, r in enumerate(in_neighbors):
+                rank_tensor = gathered[j * 5:(j + 1) * 5]
+                assert rank_tensor.data.min() == r * num_tensors + i, \
+                    "bf.neighbor_allgather(fused oversized) produces incorrect gathered tensor"
+                assert rank_tensor.data.max() == r * num_tensors + i, \
+                    "bf.neighbor_allgather(fused oversized) produces incorrect gathered tensor"
+
     @unittest.skip("Need re-design of API.")
     def test_pair_gossip(self):
         size = bf.size()
@@ -337,6 +337,153 @@ class WinOpsTests(unittest.TestCase):
             is_freed = bf.win_free(window_name)
             assert is_freed, "bf.win_free do not free window object successfully."
 
+    def test_win_update_with_min_version_and_skip_stale(self):
+        """Test win_update waits for the new versions and leaves out the stale neighbors."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        if TEST_ON_GPU:
+            dtypes += [torch.cuda.FloatTensor, torch.cuda.DoubleTensor]
+
+        # By default, we use exponential two ring topology.
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        for dtype in dtypes:
+            tensor = torch.FloatTensor(23).fill_(1).mul_(rank)
+            tensor = self.cast_and_place(tensor, dtype)
+            window_name = "win_update_min_version_{}".format(dtype)
+            bf.win_create(tensor, window_name, zero_init=True)
+            # No barrier, win_update waits until every in-neighbor has put.
+            bf.win_put(tensor, window_name)
+            sync_result = bf.win_update(window_name, min_version=1, clone=True)
+            assert (sync_result.data - avg_value).abs().max() < EPSILON, (
+                "win_update with min_version produces wrong results "
+                "[{}-{}]!={} at rank {}.".format(
+                    sync_result.min(), sync_result.max(), avg_value, rank))
+
+            # Nothing is put since the last win_update, so all the neighbors are left out.
+            bf.barrier()
+            stale_result = bf.win_update(window_name, skip_stale=True, clone=True)
+            assert (stale_result.data - rank).abs().max() < EPSILON, (
+                "win_update with skip_stale produces wrong results "
+                "[{}-{}]!={} at rank {}.".format(
+                    stale_result.min(), stale_result.max(), rank, rank))
+
+        for dtype in dtypes:
+            window_name = "win_update_min_version_{}".format(dtype)
+            is_freed = bf.win_free(window_name)
+            assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_update_with_max_staleness(self):
+        """Test win_update waits for the neighbors which missed max_staleness updates."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        tensor = torch.FloatTensor(23).fill_(1).mul_(rank)
+        window_name = "win_update_max_staleness"
+        bf.win_create(tensor, window_name, zero_init=True)
+        bf.barrier()
+        # Nothing is put yet, so every neighbor misses this update.
+        bf.win_update(window_name, clone=True)
+        # No barrier, win_update waits until every in-neighbor has put.
+        bf.win_put(tensor, window_name)
+        sync_result = bf.win_update(window_name, max_staleness=1, clone=True)
+        assert (sync_result.data - avg_value).abs().max() < EPSILON, (
+            "win_update with max_staleness produces wrong results "
+            "[{}-{}]!={} at rank {}.".format(
+                sync_result.min(), sync_result.max(), avg_value, rank))
+        versions = bf.get_win_version(window_name)
+        assert all(versions[r] == 0 for r in neighbor_ranks), (
+            "win_update with max_staleness does not take the versions it saw.")
+
+        bf.barrier()
+        is_freed = bf.win_free(window_name)
+        assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_update_with_timeout(self):
+        """Test win_update gives up waiting after the timeout with the data arrived so far."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        tensor = torch.FloatTensor(23).fill_(1).mul_(rank)
+        window_name = "win_update_timeout"
+        bf.win_create(tensor, window_name, zero_init=True)
+        bf.win_put(tensor, window_name)
+        bf.barrier()
+        # Every neighbor puts once only, so the second version never comes.
+        start = time.time()
+        sync_result = bf.win_update(window_name, min_version=2, timeout=0.5, clone=True)
+        assert time.time() - start >= 0.5, "win_update returns before the timeout."
+        assert (sync_result.data - avg_value).abs().max() < EPSILON, (
+            "win_update with timeout produces wrong results "
+            "[{}-{}]!={} at rank {}.".format(
+                sync_result.min(), sync_result.max(), avg_value, rank))
+        versions = bf.get_win_version(window_name)
+        assert all(versions[r] == 0 for r in neighbor_ranks), (
+            "win_update with timeout does not take the versions it saw.")
+
+        bf.barrier()
+        is_freed = bf.win_free(window_name)
+        assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_update_with_skip_stale_partial(self):
+        """Test win_update with skip_stale only leaves out the neighbors without new data."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        # Only the even ranks put, and the weights of the odd neighbors go to self.
+        fresh_ranks = [r for r in neighbor_ranks if r % 2 == 0]
+        num_stale = len(neighbor_ranks) - len(fresh_ranks)
+        expected_value = (rank * (1 + num_stale) + np.sum(fresh_ranks)) / float(indegree+1)
+
+        tensor = torch.FloatTensor(23).fill_(1).mul_(rank)
+        window_name = "win_update_skip_stale_partial"
+        bf.win_create(tensor, window_name, zero_init=True)
+        if rank % 2 == 0:
+            bf.win_put(tensor, window_name)
+        bf.barrier()
+        sync_result = bf.win_update(window_name, skip_stale=True, clone=True)
+        assert (sync_result.data - expected_value).abs().max() < EPSILON, (
+            "win_update with skip_stale produces wrong results "
+            "[{}-{}]!={} at rank {}.".format(
+                sync_result.min(), sync_result.max(), expected_value, rank))
+
+        bf.barrier()
+        is_freed = bf.win_free(window_name)
+        assert is_freed, "bf.win_free do not free window object successfully."
+
     def test_win_put_with_varied_tensor_elements(self):
         """Test that the window put operation."""
         size = bf.size()
@@ -423,6 +570,288 @@ class WinOpsTests(unittest.TestCase):
             is_freed = bf.win_free(window_name)
             assert is_freed, "bf.win_free do not free window object successfully."
 
+    def test_win_neighbor_tensor_after_free(self):
+        """Test that the neighbor tensors keep their values after win_free."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        # By default, we use exponential two ring topology.
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+
+        tensor = torch.FloatTensor(DIM_SIZE, DIM_SIZE).fill_(1).mul_(rank)
+        window_name = "win_neighbor_tensor_after_free"
+        bf.win_create(tensor, window_name, zero_init=True)
+        neighbor_tensors = {r: bf.get_win_neighbor_tensor(window_name, r)
+                            for r in neighbor_ranks}
+        bf.win_put(tensor, window_name)
+        bf.barrier()
+        bf.win_update(window_name)
+        bf.barrier()
+        # With BLUEFOG_WIN_SHARED_MEMORY=1, the neighbor tensors on the same machine
+        # live in the shared memory freed with the window.
+        assert bf.win_free(window_name), "bf.win_free do not free window object successfully."
+        for r, neighbor_tensor in neighbor_tensors.items():
+            assert (neighbor_tensor - r).abs().max() < EPSILON, (
+                "The neighbor tensor of rank {} after win_free has wrong value ".format(r) +
+                "[{}-{}] at rank {}.".format(neighbor_tensor.min(), neighbor_tensor.max(),
+                                             rank))
+
+    def test_win_put_and_accumulate_with_distinct_weights(self):
+        """Test that the window put and accumulate operations with a different weight per target."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        if TEST_ON_GPU:
+            dtypes += [torch.cuda.FloatTensor, torch.cuda.DoubleTensor]
+
+        # By default, we use exponential two ring topology. The tensor put to rank + 2**i
+        # is weighted by i + 2, so every weighted tensor is in flight at the same time.
+        indegree = int(np.ceil(np.log2(size)))
+        dst_weights = {(rank + 2**i) % size: i + 2.0 for i in range(indegree)}
+        neighbor_ranks = [(rank - 2**i) % size for i in range(indegree)]
+        neighbor_weights = {r: 1.0 for r in neighbor_ranks}
+        expected_value = sum((i + 2.0) * r for i, r in enumerate(neighbor_ranks))
+
+        dims = [1, 2, 3]
+        for dtype, dim in itertools.product(dtypes, dims):
+            tensor = torch.FloatTensor(*([DIM_SIZE] * dim)).fill_(1).mul_(rank)
+            tensor = self.cast_and_place(tensor, dtype)
+            window_name = "win_put_distinct_weights_{}_{}".format(dim, dtype)
+            bf.win_create(tensor, window_name, zero_init=True)
+            bf.win_put(tensor, window_name, dst_weights=dst_weights)
+            bf.barrier()
+            sync_result = bf.win_update(window_name, self_weight=0.0,
+                                        neighbor_weights=neighbor_weights, reset=True)
+            assert (sync_result.data - expected_value).abs().max() < EPSILON, (
+                "bf.win_put with distinct weights produces wrong tensor value " +
+                "[{}-{}]!={} at rank {}.".format(sync_result.min(),
+                                                 sync_result.max(), expected_value, rank))
+
+            bf.barrier()
+            bf.win_accumulate(tensor, window_name, dst_weights=dst_weights)
+            bf.barrier()
+            sync_result = bf.win_update(window_name, self_weight=0.0,
+                                        neighbor_weights=neighbor_weights)
+            assert (sync_result.data - expected_value).abs().max() < EPSILON, (
+                "bf.win_accumulate with distinct weights produces wrong tensor value " +
+                "[{}-{}]!={} at rank {}.".format(sync_result.min(),
+                                                 sync_result.max(), expected_value, rank))
+            bf.barrier()
+            is_freed = bf.win_free(window_name)
+            assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_put_and_accumulate_with_compression(self):
+        """Test that the window put and accumulate operations with compression."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        # By default, we use exponential two ring topology.
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        # Constant tensors of small integers are kept exactly by all the compressions,
+        # and top-k compression with ratio 1 sends all the values.
+        compressions = ['fp16', 'int8', 'topk']
+        dims = [1, 2, 3]
+        for compression, dim in itertools.product(compressions, dims):
+            tensor = torch.FloatTensor(*([DIM_SIZE] * dim)).fill_(1).mul_(rank)
+            window_name = "win_put_compressed_{}_{}".format(compression, dim)
+            bf.win_create(tensor, window_name, compression=compression,
+                          compression_ratio=1.0)
+            bf.win_put(tensor, window_name)
+            bf.barrier()
+            sync_result = bf.win_update(window_name)
+            assert (list(sync_result.shape) == [DIM_SIZE] * dim), (
+                "bf.win_update after compressed win_put produces wrong shape tensor.")
+            assert (sync_result.data - avg_value).abs().max() < 1e-3, (
+                "bf.win_update after {} win_put produces wrong tensor value ".format(
+                    compression) +
+                "[{}-{}]!={} at rank {}.".format(sync_result.min(),
+                                                 sync_result.max(), avg_value, rank))
+            if compression == 'topk':
+                # Accumulated into the reset neighbor buffers, the average is the same.
+                bf.win_update(window_name, reset=True)
+                tensor.fill_(rank)
+                bf.barrier()
+                bf.win_accumulate(tensor, window_name)
+                bf.barrier()
+                sync_result = bf.win_update(window_name)
+                assert (sync_result.data - avg_value).abs().max() < 1e-3, (
+                    "bf.win_update after topk win_accumulate produces wrong tensor value " +
+                    "[{}-{}]!={} at rank {}.".format(sync_result.min(), sync_result.max(),
+                                                     avg_value, rank))
+            else:
+                with self.assertRaises(ValueError):
+                    bf.win_accumulate(tensor, window_name)
+            bf.barrier()
+            is_freed = bf.win_free(window_name)
+            assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_put_topk_after_reset_and_accumulate(self):
+        """Test that topk win_put keeps the neighbor buffers right after reset and win_accumulate."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        neighbor_weights = {r: 1.0 for r in neighbor_ranks}
+        neighbor_scale = np.sum(neighbor_ranks) + indegree
+
+        # Every rank puts [1, 2, 3, 4] scaled by rank + 1, and topk sends 2 values
+        # after the first win_put.
+        base = torch.FloatTensor([1, 2, 3, 4])
+        tensor = base.mul(rank + 1)
+        window_name = "win_put_topk_replica"
+        bf.win_create(tensor, window_name, zero_init=True, compression='topk',
+                      compression_ratio=0.5)
+
+        def neighbor_sum():
+            bf.barrier()
+            return bf.win_update(window_name, self_weight=0.0,
+                                 neighbor_weights=neighbor_weights, clone=True)
+
+        bf.win_put(tensor, window_name)
+        sync_result = neighbor_sum()
+        assert (sync_result - base.mul(neighbor_scale)).abs().max() < EPSILON, (
+            "bf.win_put (topk) produces wrong neighbor buffers at the first put.")
+
+        # The reset buffers get the whole tensor back with the next put, even though
+        # the tensor is the same.
+        bf.win_update(window_name, self_weight=0.0, neighbor_weights=neighbor_weights,
+                      reset=True, clone=True)
+        bf.barrier()
+        bf.win_put(tensor, window_name)
+        sync_result = neighbor_sum()
+        assert (sync_result - base.mul(neighbor_scale)).abs().max() < EPSILON, (
+            "bf.win_put (topk) produces wrong neighbor buffers after the reset.")
+
+        # win_accumulate adds [0, 0, 3, 4] and keeps [1, 2, 0, 0] for later. win_put
+        # only sends the 2 values changed the most since the last put, so putting
+        # [2, 4, 6, 8] twice gets all of it there.
+        bf.win_accumulate(tensor, window_name)
+        sync_result = neighbor_sum()
+        assert (sync_result - torch.FloatTensor([1, 2, 6, 8]).mul(neighbor_scale)
+                ).abs().max() < EPSILON, (
+                    "bf.win_accumulate (topk) produces wrong neighbor buffers.")
+        bf.win_put(tensor.mul(2), window_name)
+        sync_result = neighbor_sum()
+        assert (sync_result - torch.FloatTensor([1, 2, 6, 8]).mul(neighbor_scale)
+                ).abs().max() < EPSILON, (
+                    "bf.win_put (topk) produces wrong neighbor buffers after win_accumulate.")
+        bf.win_put(tensor.mul(2), window_name)
+        sync_result = neighbor_sum()
+        assert (sync_result - base.mul(2 * neighbor_scale)).abs().max() < EPSILON, (
+            "bf.win_put (topk) produces wrong neighbor buffers at the second put.")
+
+        bf.barrier()
+        is_freed = bf.win_free(window_name)
+        assert is_freed, "bf.win_free do not free window object successfully."
+
+    def test_win_put_and_update_group(self):
+        """Test that the window group put and update operations."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        if TEST_ON_GPU:
+            dtypes += [torch.cuda.FloatTensor, torch.cuda.DoubleTensor]
+
+        # By default, we use exponential two ring topology.
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        shapes = [[DIM_SIZE], [DIM_SIZE, 3], [2, DIM_SIZE, 5]]
+        for dtype in dtypes:
+            tensors = [self.cast_and_place(torch.FloatTensor(*shape).fill_(1).mul_(rank),
+                                           dtype) for shape in shapes]
+            window_name = "win_group_{}".format(dtype)
+            assert bf.win_create_group(tensors, window_name), (
+                "bf.win_create_group do not create window object successfully.")
+            bf.win_put_group(window_name)
+            bf.barrier()
+            results = bf.win_update_group(window_name)
+            for tensor, result, shape in zip(tensors, results, shapes):
+                assert result is tensor, "bf.win_update_group should update in-place."
+                assert list(tensor.shape) == shape, (
+                    "bf.win_update_group produces wrong shape tensor.")
+                assert (tensor.data - avg_value).abs().max() < EPSILON, (
+                    "bf.win_update_group after win_put_group produces wrong tensor value " +
+                    "[{}-{}]!={} at rank {}.".format(tensor.min(), tensor.max(),
+                                                     avg_value, rank))
+            bf.barrier()
+            assert bf.win_free(window_name), (
+                "bf.win_free do not free window object successfully.")
+
+    def test_win_accumulate_and_update_group(self):
+        """Test that the window group accumulate and update operations."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+        dtypes = [torch.FloatTensor, torch.DoubleTensor]
+        if TEST_ON_GPU:
+            dtypes += [torch.cuda.FloatTensor, torch.cuda.DoubleTensor]
+
+        # By default, we use exponential two ring topology. The self_weight of
+        # win_accumulate_group halves the tensors of the group in-place.
+        outdegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(outdegree)]  # in-neighbor
+        avg_value = (rank * 0.5 + np.sum(neighbor_ranks)) / float(outdegree+1)
+
+        shapes = [[DIM_SIZE], [DIM_SIZE, 3], [2, DIM_SIZE, 5]]
+        for dtype in dtypes:
+            tensors = [self.cast_and_place(torch.FloatTensor(*shape).fill_(1).mul_(rank),
+                                           dtype) for shape in shapes]
+            window_name = "win_accumulate_group_{}".format(dtype)
+            assert bf.win_create_group(tensors, window_name, zero_init=True), (
+                "bf.win_create_group do not create window object successfully.")
+            bf.win_accumulate_group(window_name, self_weight=0.5)
+            for tensor in tensors:
+                assert (tensor.data - rank * 0.5).abs().max() < EPSILON, (
+                    "bf.win_accumulate_group should apply self_weight in-place.")
+            bf.barrier()
+            results = bf.win_update_group(window_name)
+            for tensor, result, shape in zip(tensors, results, shapes):
+                assert result is tensor, "bf.win_update_group should update in-place."
+                assert list(tensor.shape) == shape, (
+                    "bf.win_update_group produces wrong shape tensor.")
+                assert (tensor.data - avg_value).abs().max() < EPSILON, (
+                    "bf.win_update_group after win_accumulate_group produces wrong tensor " +
+                    "value [{}-{}]!={} at rank {}.".format(tensor.min(), tensor.max(),
+                                                           avg_value, rank))
+            bf.barrier()
+            assert bf.win_free(window_name), (
+                "bf.win_free do not free window object successfully.")
+
     def test_win_accumulate(self):
         """Test that the window accumulate operation."""
         size = bf.size()
@@ -459,6 +888,42 @@ class WinOpsTests(unittest.TestCase):
                 "[{}-{}]!={} at rank {}.".format(sync_result.min(),
                                                  sync_result.max(), avg_value, rank))
 
+    def test_win_accumulate_with_reset(self):
+        """Test that win_update with reset clears the neighbor buffers win_accumulate adds to."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        outdegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(outdegree)]  # in-neighbor
+        out_neighbor_ranks = [(rank + 2**i) % size for i in range(outdegree)]
+        neighbor_weights = {r: 1.0 for r in neighbor_ranks}
+        # Every rank accumulates half of its tensor to the out-neighbors.
+        sum_value = np.sum(neighbor_ranks) / 2.0
+
+        tensor = torch.FloatTensor(DIM_SIZE, DIM_SIZE).fill_(1).mul_(rank)
+        window_name = "win_accumulate_with_reset"
+        bf.win_create(tensor, window_name, zero_init=True)
+        for _ in range(2):
+            bf.win_accumulate(tensor, window_name,
+                              dst_weights={r: 0.5 for r in out_neighbor_ranks})
+            bf.barrier()
+            sync_result = bf.win_update(window_name, self_weight=0.0,
+                                        neighbor_weights=neighbor_weights,
+                                        reset=True, clone=True)
+            assert (sync_result.data - sum_value).abs().max() < EPSILON, (
+                "bf.win_update with reset after win_accumulate produces wrong tensor value " +
+                "[{}-{}]!={} at rank {}.".format(sync_result.min(),
+                                                 sync_result.max(), sum_value, rank))
+            bf.barrier()
+
+        is_freed = bf.win_free(window_name)
+        assert is_freed, "bf.win_free do not free window object successfully."
+
     def test_win_accumulate_with_varied_tensor_elements(self):
         """Test that the window accumulate operation."""
         size = bf.size()
@@ -737,6 +1202,41 @@ class WinOpsTests(unittest.TestCase):
                 assert (t_end - t_start) < 2, \
                     "The mutex acquire time should be shorter than 2 second"
 
+    def test_win_mutex_with_win_put_in_background(self):
+        """Test that win_put with require_mutex waits for the win_mutex of the same process."""
+        size = bf.size()
+        rank = bf.rank()
+        if size <= 1:
+            fname = inspect.currentframe().f_code.co_name
+            warnings.warn("Skip {} due to size 1".format(fname))
+            return
+
+        # By default, we use exponential two ring topology.
+        indegree = int(np.ceil(np.log2(size)))
+        neighbor_ranks = [(rank - 2**i) %
+                          size for i in range(indegree)]  # in-neighbor
+        avg_value = (rank + np.sum(neighbor_ranks)) / float(indegree+1)
+
+        tensor = torch.FloatTensor([DIM_SIZE]).fill_(1).mul_(rank)
+        window_name = "win_mutex_with_win_put"
+        bf.win_create(tensor, window_name, zero_init=True)
+        # The background thread asks for the mutexes this thread holds, and gets them
+        # once they are released.
+        with bf.win_mutex(window_name):
+            handle = bf.win_put_nonblocking(tensor, window_name, require_mutex=True)
+            time.sleep(0.1)
+            assert not bf.win_poll(handle), (
+                "bf.win_put with require_mutex finishes while the mutex is held.")
+        bf.win_wait(handle)
+        bf.barrier()
+        sync_result = bf.win_update(window_name)
+        assert (sync_result.data - avg_value).abs().max() < EPSILON, (
+            "bf.win_update after win_put with require_mutex produces wrong tensor value " +
+            "[{}-{}]!={} at rank {}.".format(sync_result.min(),
+                                             sync_result.max(), avg_value, rank))
+        bf.barrier()
+        assert bf.win_free(window_name), "bf.win_free do not free window object successfully."
+
     @unittest.skip("It is most likely because the win_mutex is called through the main thread")
     def test_win_mutex_given_ranks(self):
         size = bf.size()